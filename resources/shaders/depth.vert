@@ -0,0 +1,33 @@
+#version 450
+
+// Position only variant of main.vert for the depth prepass and the
+// visibility pass. gl_Position is invariant and computed the same way in
+// both, so the opaque pass can test for equal depth.
+layout(location = 0) in vec3 inPosition;
+
+// Read by visibility.frag, unused by depth only pipelines
+layout(location = 0) flat out uint outInstance;
+
+layout(set = 0, binding = 0) uniform ViewProjectionData {
+	mat4 view;
+	mat4 projection;
+};
+
+struct InstanceData {
+	mat4 model;
+	mat4 previousModel;
+	mat3 normal;
+	uint material;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Instances {
+	InstanceData instances[];
+};
+
+invariant gl_Position;
+
+void main() {
+	InstanceData instance = instances[gl_InstanceIndex];
+	gl_Position = projection * view * instance.model * vec4(inPosition, 1.0);
+	outInstance = uint(gl_InstanceIndex);
+}
@@ -9,17 +9,45 @@ layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 3) out vec3 fragNormal;
 layout(location = 4) out vec2 fragTexCoord;
+layout(location = 6) flat out uint fragMaterial;
 
 layout(set = 0, binding = 0) uniform ViewProjectionData {
 	mat4 view;
 	mat4 projection;
 };
 
-layout(push_constant) uniform PushConstants { mat4 model; };
+struct InstanceData {
+	mat4 model;
+	mat4 previousModel;
+	mat3 normal;
+	uint material;
+};
+
+// One entry per draw instance, firstInstance of the draws points at theirs
+layout(std430, set = 2, binding = 0) readonly buffer Instances {
+	InstanceData instances[];
+};
+
+// Compact vertices store positions normalized to the mesh bounds (undone by
+// the instance model matrix) and octahedral encoded normals.
+layout(constant_id = 0) const bool COMPACT_VERTICES = false;
+
+vec3 octahedralDecode(vec2 encoded) {
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0);
+	normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+	return normalize(normal);
+}
+
+// Matches depth.vert, see DepthPrepass
+invariant gl_Position;
 
 void main() {
-	gl_Position = projection * view * model * vec4(inPosition, 1.0);
+	InstanceData instance = instances[gl_InstanceIndex];
+	gl_Position = projection * view * instance.model * vec4(inPosition, 1.0);
 
-	fragNormal = inNormal;
+	vec3 normal = COMPACT_VERTICES ? octahedralDecode(inNormal.xy) : inNormal;
+	fragNormal = normalize(instance.normal * normal);
 	fragTexCoord = inTexCoord;
-}
\ No newline at end of file
+	fragMaterial = instance.material;
+}
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct MaterialParameters {
+	uint albedoTexture;
+	vec4 baseColor;
+};
+
+layout(location = 0) out vec4 outColor;
+layout(location = 3) in vec3 normal;
+layout(location = 4) in vec2 textCoords;
+layout(location = 6) flat in uint materialIndex;
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+layout(std430, set = 1, binding = 1) readonly buffer Materials {
+	MaterialParameters materials[];
+};
+
+void main() {
+	MaterialParameters material = materials[materialIndex];
+	vec4 albedo = texture(
+		textures[nonuniformEXT(material.albedoTexture)], textCoords
+	);
+	outColor = vec4(albedo.rgb * material.baseColor.rgb, 1.0);
+}
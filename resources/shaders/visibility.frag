@@ -0,0 +1,13 @@
+#version 450
+
+// Matches VISIBILITY_TRIANGLE_BITS
+const uint TRIANGLE_BITS = 18u;
+
+layout(location = 0) flat in uint instance;
+layout(location = 0) out uint outVisibility;
+
+void main() {
+	// Without geometry or tessellation stages gl_PrimitiveID counts the
+	// triangles of the draw instance
+	outVisibility = (instance << TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
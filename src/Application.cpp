@@ -11,6 +11,7 @@
 #include <filesystem>
 #include <iostream>
 #include <memory>
+#include <string>
 
 #include "Renderer.hpp"
 
@@ -30,7 +31,7 @@ Application::Application(const std::filesystem::path& path) {
 		throw;
 	}
 	m_renderer = std::make_unique<Renderer>(m_window);
-	m_renderer->load(path);
+	m_renderer->load(path, { .vertexFormat = VertexFormat::Compact });
 }
 
 int Application::run() {
@@ -86,6 +87,21 @@ int Application::run() {
 		}
 
 		m_renderer->render();
+
+		const CullStatistics& culling = m_renderer->getCullStatistics();
+		const BarrierStatistics& barriers =
+			m_renderer->getBarrierStatistics();
+		std::string title = "SDLVulk Test - " +
+		                    std::to_string(culling.visible) + " visible, " +
+		                    std::to_string(culling.frustumCulled) +
+		                    " frustum culled, " +
+		                    std::to_string(culling.sizeCulled) +
+		                    " too small, " +
+		                    std::to_string(culling.occlusionCulled) +
+		                    " occluded, " +
+		                    std::to_string(barriers.pipelineBarriers) +
+		                    " barriers";
+		SDL_SetWindowTitle(m_window, title.c_str());
 	};
 
 	return 0;
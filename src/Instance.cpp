@@ -1,4 +1,6 @@
 #include <Instance.hpp>
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <iostream>
 #include <string_view>
@@ -12,8 +14,11 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE;
 vk::Instance createInstance();
 void setupDebug(vk::Instance instance);
 vk::PhysicalDevice getPhysicalDevice(vk::Instance instance);
-vk::Device createDevice(vk::PhysicalDevice physicalDevice);
+vk::Device createDevice(
+	vk::PhysicalDevice physicalDevice, const Instance::Features& features
+);
 Instance::QueueFamilies getQueueFamilies(vk::PhysicalDevice device);
+Instance::Features getFeatures(vk::PhysicalDevice device);
 
 Instance Instance::Create(SDL_Window* window) {
 	VULKAN_HPP_DEFAULT_DISPATCHER.init();
@@ -28,7 +33,8 @@ Instance Instance::Create(SDL_Window* window) {
 		std::cerr << SDL_GetError() << std::endl;
 	}
 	vk::PhysicalDevice physicalDevice = getPhysicalDevice(instance);
-	vk::Device device = createDevice(physicalDevice);
+	Instance::Features features = getFeatures(physicalDevice);
+	vk::Device device = createDevice(physicalDevice, features);
 
 	VULKAN_HPP_DEFAULT_DISPATCHER.init(device);
 
@@ -38,6 +44,7 @@ Instance Instance::Create(SDL_Window* window) {
 		.physicalDevice = physicalDevice,
 		.instance = instance,
 		.queueFamiliesIndices = getQueueFamilies(physicalDevice),
+		.features = features,
 	};
 }
 
@@ -114,9 +121,7 @@ void setupDebug(vk::Instance instance) {
 
 bool isDeviceSuitable(vk::PhysicalDevice device) {
 	vk::PhysicalDeviceProperties properties = device.getProperties();
-	vk::PhysicalDeviceFeatures features = device.getFeatures();
-	return properties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu &&
-	       features.geometryShader;
+	return properties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
 }
 
 vk::PhysicalDevice getPhysicalDevice(vk::Instance instance) {
@@ -148,9 +153,63 @@ Instance::QueueFamilies getQueueFamilies(vk::PhysicalDevice device) {
 			families.transferIndex = i;
 	}
 
+	// The transfer queue is used by the loading thread, a compute family
+	// shared with it would need a second queue
+	families.computeIndex = families.graphicsIndex;
+	for (int i = 0; i < properties.size(); i++) {
+		auto flags = properties[i].queueFlags;
+		if (flags & vk::QueueFlagBits::eCompute &&
+		    !(flags & vk::QueueFlagBits::eGraphics) &&
+		    i != families.transferIndex) {
+			families.computeIndex = i;
+			break;
+		}
+	}
+
 	return families;
 }
 
+Instance::Features getFeatures(vk::PhysicalDevice device) {
+	auto chain = device.getFeatures2<
+		vk::PhysicalDeviceFeatures2,
+		vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR,
+		vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+	const vk::PhysicalDeviceFeatures& features =
+		chain.get<vk::PhysicalDeviceFeatures2>().features;
+	const auto& timeline =
+		chain.get<vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR>();
+	const auto& indexing =
+		chain.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+
+	std::vector<vk::ExtensionProperties> extensions =
+		device.enumerateDeviceExtensionProperties();
+	auto hasExtension = [&](std::string_view name) {
+		return std::any_of(
+			extensions.begin(),
+			extensions.end(),
+			[&](const vk::ExtensionProperties& extension) {
+				return name == extension.extensionName.data();
+			}
+		);
+	};
+
+	return {
+		.drawIndirectFirstInstance = features.drawIndirectFirstInstance ==
+		                             vk::True,
+		.timelineSemaphore = hasExtension("VK_KHR_timeline_semaphore") &&
+		                     timeline.timelineSemaphore,
+		.descriptorIndexing =
+			hasExtension("VK_EXT_descriptor_indexing") &&
+			indexing.shaderSampledImageArrayNonUniformIndexing &&
+			indexing.descriptorBindingSampledImageUpdateAfterBind &&
+			indexing.descriptorBindingPartiallyBound &&
+			indexing.runtimeDescriptorArray,
+		.geometryShader = features.geometryShader == vk::True,
+		.shaderStorageImageWriteWithoutFormat =
+			features.shaderStorageImageWriteWithoutFormat == vk::True,
+	};
+}
+
 //// Device
 const std::vector<const char*> deviceLayers {};
 const std::vector<const char*> deviceExtensions {
@@ -160,22 +219,37 @@ const std::vector<const char*> deviceExtensions {
 	"VK_KHR_create_renderpass2",
 	"VK_KHR_multiview",
 	"VK_KHR_maintenance2",
-	"VK_KHR_synchronization2"
+	"VK_KHR_synchronization2",
+	"VK_KHR_push_descriptor",
+	"VK_KHR_draw_indirect_count",
+	"VK_KHR_maintenance3",
 };
-vk::Device createDevice(vk::PhysicalDevice physicalDevice) {
+vk::Device createDevice(
+	vk::PhysicalDevice physicalDevice, const Instance::Features& features
+) {
 	Instance::QueueFamilies queueFamilies = getQueueFamilies(physicalDevice);
-	vk::DeviceQueueCreateInfo queueInfo[] {
-		vk::DeviceQueueCreateInfo {
-								   .queueFamilyIndex = queueFamilies.graphicsIndex,
-								   .queueCount = 3,
-								   .pQueuePriorities = std::array<float,            3> { 1.f, 1.f, 1.f }.data(),
-								   },
-		vk::DeviceQueueCreateInfo {
-								   .queueFamilyIndex = queueFamilies.transferIndex,
-								   .queueCount = 1,
-								   .pQueuePriorities = std::array<float, 1> { 1.f }.data(),
-								   }
-	};
+	// Families can be shared, each is created once
+	std::array<float, 3> priorities { 1.f, 1.f, 1.f };
+	std::vector<vk::DeviceQueueCreateInfo> queueInfos;
+	for (uint32_t family :
+	     { queueFamilies.graphicsIndex,
+	       queueFamilies.transferIndex,
+	       queueFamilies.computeIndex }) {
+		if (std::any_of(
+				queueInfos.begin(),
+				queueInfos.end(),
+				[&](const vk::DeviceQueueCreateInfo& info) {
+					return info.queueFamilyIndex == family;
+				}
+			))
+			continue;
+
+		queueInfos.push_back({
+			.queueFamilyIndex = family,
+			.queueCount = family == queueFamilies.graphicsIndex ? 3u : 1u,
+			.pQueuePriorities = priorities.data(),
+		});
+	}
 
 	vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeature {
 		.dynamicRendering = true,
@@ -183,15 +257,46 @@ vk::Device createDevice(vk::PhysicalDevice physicalDevice) {
 	vk::PhysicalDeviceSynchronization2FeaturesKHR syncronizationFeature {
 		.pNext = &dynamicRenderingFeature, .synchronization2 = true
 	};
+	// Optional features are chained, and their extensions enabled, only
+	// when the device supports them
+	std::vector<const char*> extensions = deviceExtensions;
+	void* next = &syncronizationFeature;
+	vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeature {
+		.pNext = next, .timelineSemaphore = true
+	};
+	if (features.timelineSemaphore) {
+		extensions.push_back("VK_KHR_timeline_semaphore");
+		next = &timelineFeature;
+	}
+
+	vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeature {
+		.pNext = next,
+		.shaderSampledImageArrayNonUniformIndexing = true,
+		.descriptorBindingSampledImageUpdateAfterBind = true,
+		.descriptorBindingPartiallyBound = true,
+		.runtimeDescriptorArray = true,
+	};
+	if (features.descriptorIndexing) {
+		extensions.push_back("VK_EXT_descriptor_indexing");
+		next = &descriptorIndexingFeature;
+	}
+
+	vk::PhysicalDeviceFeatures enabledFeatures {
+		.geometryShader = features.geometryShader,
+		.drawIndirectFirstInstance = features.drawIndirectFirstInstance,
+		.shaderStorageImageWriteWithoutFormat =
+			features.shaderStorageImageWriteWithoutFormat,
+	};
 
 	vk::DeviceCreateInfo info {
-		.pNext = &syncronizationFeature,
-		.queueCreateInfoCount = 2,
-		.pQueueCreateInfos = queueInfo,
+		.pNext = next,
+		.queueCreateInfoCount = (uint32_t)queueInfos.size(),
+		.pQueueCreateInfos = queueInfos.data(),
 		.enabledLayerCount = (uint32_t)deviceLayers.size(),
 		.ppEnabledLayerNames = deviceLayers.data(),
-		.enabledExtensionCount = (uint32_t)deviceExtensions.size(),
-		.ppEnabledExtensionNames = deviceExtensions.data(),
+		.enabledExtensionCount = (uint32_t)extensions.size(),
+		.ppEnabledExtensionNames = extensions.data(),
+		.pEnabledFeatures = &enabledFeatures,
 	};
 
 	return physicalDevice.createDevice(info);
@@ -10,6 +10,24 @@ struct Instance {
 		uint32_t graphicsIndex = 0;
 		uint32_t transferIndex = 0;
 		uint32_t presentIndex = 0;
+		// Family without graphics support for async compute, the graphics
+		// one when the device has none
+		uint32_t computeIndex = 0;
+	};
+	// Optional features enabled on the device, paths needing a missing one
+	// are turned off
+	struct Features {
+		// Indirect draws starting past instance 0, GPU driven and meshlet
+		// culling select the instance data of their draws with it
+		bool drawIndirectFirstInstance = false;
+		// Orders the graphics and async compute submissions of a frame
+		bool timelineSemaphore = false;
+		// Bindless materials index a partially written texture array
+		bool descriptorIndexing = false;
+		// gl_PrimitiveID in fragment shaders and stores to the swapchain
+		// formatted color target, both used by the visibility buffer path
+		bool geometryShader = false;
+		bool shaderStorageImageWriteWithoutFormat = false;
 	};
 	vk::Device device;
 	vk::SurfaceKHR surface;
@@ -17,6 +35,7 @@ struct Instance {
 	vk::Instance instance;
 
 	QueueFamilies queueFamiliesIndices;
+	Features features;
 
 	static Instance Create(SDL_Window* window);
 };
@@ -1,17 +1,144 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/glm.hpp>
+#include <limits>
 #include <memory>
+#include <vulkan/vulkan_enums.hpp>
 
 #include "material/MaterialManager.hpp"
 #include "resources/Buffer.hpp"
 
-struct Primitive {
-	uint32_t baseVertex;
+inline uint32_t getIndexSize(vk::IndexType type) {
+	return type == vk::IndexType::eUint16 ? sizeof(uint16_t)
+	                                      : sizeof(uint32_t);
+}
+
+constexpr uint32_t MAX_LODS = 4;
+
+struct PrimitiveLod {
 	uint32_t baseIndex;
 	uint32_t indexCount;
+	// Mesh space deviation from the full detail level
+	float error;
+	// Clusters covering the index range, empty when meshlets were not built
+	uint32_t meshletOffset = 0;
+	uint32_t meshletCount = 0;
+};
+
+struct BoundingSphere {
+	glm::vec3 center;
+	float radius;
+};
+
+struct AABB {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+	inline void grow(glm::vec3 point) {
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+	inline void grow(const AABB& other) {
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+	inline glm::vec3 center() const { return (min + max) * 0.5f; }
+	inline float area() const {
+		glm::vec3 extent = glm::max(max - min, glm::vec3(0));
+		return 2 * (extent.x * extent.y + extent.y * extent.z +
+		            extent.z * extent.x);
+	}
+};
+
+// Bounds of a transformed box, obtained by projecting its half extent on
+// the absolute value of the transform.
+inline AABB transformAABB(const AABB& box, const glm::mat4& transform) {
+	glm::vec3 center = transform * glm::vec4(box.center(), 1);
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	glm::mat3 absolute(
+		glm::abs(glm::vec3(transform[0])),
+		glm::abs(glm::vec3(transform[1])),
+		glm::abs(glm::vec3(transform[2]))
+	);
+	glm::vec3 transformedExtent = absolute * extent;
+	return { center - transformedExtent, center + transformedExtent };
+}
+
+struct Primitive {
+	// Source mesh, shared by every instance of it in the scene
+	uint32_t mesh;
+	uint32_t baseVertex;
+	// Levels share the vertices of level 0 and are ordered from the most
+	// detailed to the coarsest.
+	std::array<PrimitiveLod, MAX_LODS> lods;
+	uint32_t lodCount = 1;
+	// Mesh space bounds of the full precision vertices
+	BoundingSphere boundingSphere;
+	AABB bounds;
+	vk::IndexType indexType = vk::IndexType::eUint32;
 	MaterialInstance material;
-	glm::mat4x4 modelMatrix;
+	// Node of the scene graph holding the model matrix
+	uint32_t transform;
+	// Maps quantized positions back to mesh space, identity for full
+	// precision vertices.
+	glm::mat4x4 dequantization = glm::mat4x4(1);
+};
+
+// Per draw data read by main.vert with gl_InstanceIndex, laid out as std430.
+// Written for every visible primitive in "instance_buffer", or by GpuCull
+// in "gpu_instances".
+struct InstanceData {
+	// Include the dequantization of the primitive
+	glm::mat4 model;
+	glm::mat4 previousModel;
+	// Inverse transpose of the node transform, columns padded to vec4
+	glm::mat3x4 normal;
+	uint32_t material;
+	// Index range of the drawn level, for VisibilityResolve to fetch the
+	// triangles of the draw
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t indexSize;
 };
+
+// Largest axis scale of a transform, bounds radii and errors are multiplied
+// by it when moved out of mesh space.
+inline float getMaxScale(const glm::mat4& transform) {
+	return glm::sqrt(glm::max(
+		glm::max(
+			glm::dot(transform[0], transform[0]),
+			glm::dot(transform[1], transform[1])
+		),
+		glm::dot(transform[2], transform[2])
+	));
+}
+
+// Coarsest level whose error, projected at the closest point of the bounds,
+// stays within `threshold` pixels.
+inline uint32_t selectLod(
+	const Primitive& primitive,
+	const glm::mat4& model,
+	const GlobalResources::Camera& camera,
+	float viewportHeight,
+	float threshold
+) {
+	float scale = getMaxScale(model);
+
+	glm::vec4 center =
+		camera.view * model * glm::vec4(primitive.boundingSphere.center, 1);
+	float distance = glm::length(glm::vec3(center)) -
+	                 primitive.boundingSphere.radius * scale;
+	if (distance <= 0) return 0;
+
+	float pixelsPerUnit =
+		viewportHeight * glm::abs(camera.projection[1][1]) / (2 * distance);
+
+	uint32_t lod = 0;
+	while (lod + 1 < primitive.lodCount &&
+	       primitive.lods[lod + 1].error * scale * pixelsPerUnit <= threshold)
+		lod++;
+	return lod;
+}
@@ -4,10 +4,14 @@
 #include <mfidl.h>
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
+#include <cassert>
+#include <functional>
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/trigonometric.hpp>
 #include <memory>
+#include <utility>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
@@ -21,8 +25,15 @@
 #include "material/MaterialManager.hpp"
 #include "memory/MemoryAllocator.hpp"
 #include "rendergraph/tasks/BufferCopy.hpp"
+#include "rendergraph/tasks/ClusterCull.hpp"
+#include "rendergraph/tasks/DepthPrepass.hpp"
+#include "rendergraph/tasks/GpuCull.hpp"
+#include "rendergraph/tasks/HiZBuild.hpp"
+#include "rendergraph/tasks/ImageClear.hpp"
 #include "rendergraph/tasks/ImageCopy.hpp"
 #include "rendergraph/tasks/OpaquePass.hpp"
+#include "rendergraph/tasks/VisibilityPass.hpp"
+#include "rendergraph/tasks/VisibilityResolve.hpp"
 #include "resources/ResourceManager.hpp"
 #include "scene/Scene.hpp"
 #include "scene/SceneLoader.hpp"
@@ -57,24 +68,16 @@ Renderer::Renderer(SDL_Window* window) {
 		m_resourceManager->getNamedBuffer("gset_buffer_local");
 	m_globalData = (GlobalResources*)globalBuffer.allocation.address;
 
-	m_renderGraph = std::make_unique<RenderGraph>(
-		m_instance, *m_swapchain, *m_resourceManager
-	);
-	m_renderGraph->addBuffer(
-		"gset_buffer",
-		{
-			.size = sizeof(GlobalResources),
-			.usage = vk::BufferUsageFlagBits::eTransferDst |
-	                 vk::BufferUsageFlagBits::eUniformBuffer,
-			.location = AllocationLocation::Device,
-			.transient = true,
-		}
-	);
+	resetRenderGraph();
 
 	m_materialManager =
 		std::make_unique<MaterialManager>(m_instance, *m_resourceManager);
 }
 
+Renderer::~Renderer() {
+	if (m_instance.device) m_instance.device.waitIdle();
+}
+
 void Renderer::createSwapchain() {
 	vk::CommandPoolCreateInfo info;
 	info.queueFamilyIndex = m_instance.queueFamiliesIndices.graphicsIndex;
@@ -94,7 +97,37 @@ void Renderer::createSwapchain() {
 	m_swapchain = std::make_unique<Swapchain>(m_instance.device, swapchainInfo);
 }
 
-void Renderer::createRenderGraph() {
+// Graph without scene tasks, which are added once the scene is ready. Until
+// then it only clears the swapchain image, so frames keep being presented.
+void Renderer::resetRenderGraph() {
+	m_renderGraph = std::make_unique<RenderGraph>(
+		m_instance, *m_swapchain, *m_resourceManager, m_threadPool
+	);
+	m_renderGraph->addBuffer(
+		"gset_buffer",
+		{
+			.size = sizeof(GlobalResources),
+			.usage = vk::BufferUsageFlagBits::eTransferDst |
+	                 vk::BufferUsageFlagBits::eUniformBuffer,
+			.location = AllocationLocation::Device,
+			.transient = true,
+		}
+	);
+	m_renderGraph->addTask(
+		"loading_clear", std::make_unique<ImageClear>(OUTPUT_IMAGE)
+	);
+	m_renderGraph->build();
+}
+
+// Per frame sections of transient buffers bound as storage buffers must
+// respect minStorageBufferOffsetAlignment, which is at most 256 bytes.
+uint32_t alignStorageSize(size_t size) {
+	return std::max<uint32_t>((size + 255) / 256 * 256, 256);
+}
+
+void Renderer::createRenderGraph(const GeometryCapacity& capacity) {
+	m_renderGraph->setTaskEnabled("loading_clear", false);
+
 	Buffer& globalBuffer =
 		m_resourceManager->getNamedBuffer("gset_buffer_local");
 
@@ -112,6 +145,16 @@ void Renderer::createRenderGraph() {
 
 	m_renderGraph->addTask("data_update", std::move(copyDescriptorBufferPass));
 
+	// Every primitive is at most one draw instance. Scenes whose IDs do not
+	// fit are drawn directly, with the same bindless materials.
+	if (capacity.primitiveCount > VISIBILITY_MAX_INSTANCES ||
+	    capacity.maxDrawTriangles > VISIBILITY_MAX_TRIANGLES)
+		m_loadSettings.visibilityBuffer = false;
+
+	// The visibility buffer path shades main_color from a compute pass
+	bool visibility = m_loadSettings.visibilityBuffer;
+	vk::ImageUsageFlags colorUsage = {};
+	if (visibility) colorUsage = vk::ImageUsageFlagBits::eStorage;
 	m_renderGraph->addImage(
 		"main_color",
 		ResourceManager::ImageDescription {
@@ -120,7 +163,7 @@ void Renderer::createRenderGraph() {
 			.format = vk::Format::eB8G8R8A8Unorm,
 			.usage = vk::ImageUsageFlagBits::eColorAttachment |
 	                 vk::ImageUsageFlagBits::eTransferSrc |
-	                 vk::ImageUsageFlagBits::eTransferDst,
+	                 vk::ImageUsageFlagBits::eTransferDst | colorUsage,
 
 			.transient = true,
 
@@ -133,39 +176,426 @@ void Renderer::createRenderGraph() {
 			.height = 600,
 			.format = vk::Format::eD16Unorm,
 			.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment |
-	                 vk::ImageUsageFlagBits::eTransferDst,
+	                 vk::ImageUsageFlagBits::eTransferDst |
+	                 vk::ImageUsageFlagBits::eSampled,
 			.transient = true,
 		}
 	);
 
-	auto opaquePass = std::make_unique<OpaquePass>(
-		m_materialManager->getBaseMaterial(), true
+	// Sized for the whole scene, primitives keep being added while streaming
+	uint32_t primitiveCount = std::max(capacity.primitiveCount, 1u);
+	if (visibility) {
+		m_renderGraph->addImage(
+			"visibility_buffer",
+			ResourceManager::ImageDescription {
+				.width = 800,
+				.height = 600,
+				.format = vk::Format::eR32Uint,
+				.usage = vk::ImageUsageFlagBits::eColorAttachment |
+		                 vk::ImageUsageFlagBits::eStorage,
+				.transient = true,
+			}
+		);
+	}
+	m_renderGraph->addBuffer(
+		"instance_buffer",
+		{
+			.size = alignStorageSize(primitiveCount * sizeof(InstanceData)),
+			.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+			.location = AllocationLocation::Host,
+			.transient = true,
+		}
 	);
 
-	m_renderGraph->addTask("main_pass", std::move(opaquePass));
+	OpaquePass::DrawMode drawMode = OpaquePass::DrawMode::Instanced;
+	if (m_loadSettings.gpuDriven)
+		drawMode = OpaquePass::DrawMode::GpuDriven;
+	else if (m_loadSettings.buildMeshlets && !visibility)
+		drawMode = OpaquePass::DrawMode::Clusters;
+
+	auto createOpaquePass = [&](bool clear) -> std::unique_ptr<OpaquePass> {
+		if (visibility) {
+			return std::make_unique<VisibilityPass>(
+				m_materialManager->getBaseMaterial(),
+				clear,
+				drawMode,
+				m_loadSettings.cacheDrawCommands
+			);
+		}
+		return std::make_unique<OpaquePass>(
+			m_materialManager->getBaseMaterial(),
+			clear,
+			drawMode,
+			m_loadSettings.cacheDrawCommands
+		);
+	};
+
+	if (drawMode == OpaquePass::DrawMode::GpuDriven) {
+		m_renderGraph->addBuffer(
+			"gpu_primitives",
+			{
+				.size = alignStorageSize(
+					primitiveCount * sizeof(GpuCull::GpuPrimitive)
+				),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+				.location = AllocationLocation::Host,
+				.transient = true,
+			}
+		);
+		// Node transforms of the frame and of the one before it
+		for (auto name : { "gpu_transforms", "gpu_previous_transforms" }) {
+			m_renderGraph->addBuffer(
+				name,
+				{
+					.size = alignStorageSize(
+						std::max(capacity.transformCount, 1u) *
+						sizeof(glm::mat4)
+					),
+					.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+					.location = AllocationLocation::Host,
+					.transient = true,
+				}
+			);
+		}
+		m_renderGraph->addBuffer(
+			"draw_commands",
+			{
+				.size = alignStorageSize(
+					primitiveCount * sizeof(vk::DrawIndexedIndirectCommand)
+				),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer |
+		                 vk::BufferUsageFlagBits::eIndirectBuffer,
+				.location = AllocationLocation::Device,
+				.transient = true,
+			}
+		);
+		// One count per bucket, there are at most as many as primitives
+		m_renderGraph->addBuffer(
+			"draw_counts",
+			{
+				.size = alignStorageSize(primitiveCount * sizeof(uint32_t)),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer |
+		                 vk::BufferUsageFlagBits::eIndirectBuffer |
+		                 vk::BufferUsageFlagBits::eTransferDst,
+				.location = AllocationLocation::Device,
+				.transient = true,
+			}
+		);
+		m_renderGraph->addBuffer(
+			"gpu_instances",
+			{
+				.size = alignStorageSize(primitiveCount * sizeof(InstanceData)),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+				.location = AllocationLocation::Device,
+				.transient = true,
+			}
+		);
+
+		// Visibility of the previous frame, read by the early cull and
+		// written by the late one
+		m_renderGraph->addBuffer(
+			"draw_visibility",
+			{
+				.size = alignStorageSize(primitiveCount * sizeof(uint32_t)),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer |
+		                 vk::BufferUsageFlagBits::eTransferDst,
+				.location = AllocationLocation::Device,
+			}
+		);
+		uint32_t pyramidSize = m_loadSettings.occlusionCulling
+		                           ? HiZBuild::GetPyramidSize({ 800, 600 })
+		                           : 1;
+		m_renderGraph->addBuffer(
+			"depth_pyramid",
+			{
+				.size = alignStorageSize(pyramidSize * sizeof(float)),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+				.location = AllocationLocation::Device,
+				.transient = true,
+			}
+		);
+	}
+
+	// Tasks run in the order they are added. Occlusion culling draws in two
+	// phases around the depth pyramid build. Its late cull reuses the
+	// instance slots of the early one, which the visibility IDs written by
+	// the early pass still point at.
+	bool occlusionCulling = drawMode == OpaquePass::DrawMode::GpuDriven &&
+	                        m_loadSettings.occlusionCulling && !visibility;
+	if (occlusionCulling) {
+		m_renderGraph->addTask(
+			"gpu_cull_early",
+			std::make_unique<GpuCull>(
+				m_instance.device,
+				GpuCull::Phase::Early,
+				vk::Extent2D { 800, 600 }
+			)
+		);
+		m_renderGraph->addTask("main_pass", createOpaquePass(true));
+		m_renderGraph->addTask(
+			"hiz_build", std::make_unique<HiZBuild>(m_instance.device)
+		);
+		m_renderGraph->addTask(
+			"gpu_cull_late",
+			std::make_unique<GpuCull>(
+				m_instance.device,
+				GpuCull::Phase::Late,
+				vk::Extent2D { 800, 600 }
+			)
+		);
+		m_renderGraph->addTask("late_pass", createOpaquePass(false));
+	} else if (drawMode == OpaquePass::DrawMode::GpuDriven) {
+		m_renderGraph->addTask(
+			"gpu_cull", std::make_unique<GpuCull>(m_instance.device)
+		);
+	}
+
+	if (drawMode == OpaquePass::DrawMode::Clusters) {
+		m_renderGraph->addBuffer(
+			"cluster_draws",
+			{
+				.size = alignStorageSize(
+					primitiveCount * sizeof(ClusterCull::ClusterDraw)
+				),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+				.location = AllocationLocation::Host,
+				.transient = true,
+			}
+		);
+		m_renderGraph->addBuffer(
+			"cluster_indices",
+			{
+				.size = alignStorageSize(
+					capacity.drawIndexCount * sizeof(uint32_t)
+				),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer |
+		                 vk::BufferUsageFlagBits::eIndexBuffer,
+				.location = AllocationLocation::Device,
+				.transient = true,
+			}
+		);
+		m_renderGraph->addBuffer(
+			"cluster_commands",
+			{
+				.size = alignStorageSize(
+					primitiveCount * sizeof(vk::DrawIndexedIndirectCommand)
+				),
+				.usage = vk::BufferUsageFlagBits::eStorageBuffer |
+		                 vk::BufferUsageFlagBits::eIndirectBuffer,
+				.location = AllocationLocation::Device,
+				.transient = true,
+			}
+		);
+
+		m_renderGraph->addTask(
+			"cluster_cull", std::make_unique<ClusterCull>(m_instance.device)
+		);
+	}
+
+	if (!occlusionCulling) {
+		// Registered first, the builder orders the opaque pass depth test
+		// after the prepass writes
+		if (m_materialManager->getBaseMaterial()->depthPipeline) {
+			m_renderGraph->addTask(
+				"depth_prepass",
+				std::make_unique<DepthPrepass>(
+					m_materialManager->getBaseMaterial(),
+					drawMode,
+					m_loadSettings.cacheDrawCommands
+				)
+			);
+		}
+
+		m_renderGraph->addTask("main_pass", createOpaquePass(true));
+	}
+
+	if (visibility) {
+		m_renderGraph->addTask(
+			"visibility_resolve",
+			std::make_unique<VisibilityResolve>(
+				m_instance.device,
+				m_materialManager->getBaseMaterial(),
+				m_loadSettings.vertexFormat,
+				drawMode == OpaquePass::DrawMode::GpuDriven ? "gpu_instances"
+				                                            : "instance_buffer"
+			)
+		);
+	}
 
 	auto imageCopyTask = std::make_unique<ImageCopy>("main_color", "result");
 	m_renderGraph->addTask("result_copy", std::move(imageCopyTask));
 
-	m_renderGraph->build();
+	m_renderGraph->build(m_loadSettings.asyncCompute);
 }
 
 void Renderer::render() {
+	if (m_sceneLoader) {
+		m_sceneLoader->update(*m_currentScene);
+		if (!m_sceneReady && m_sceneLoader->isReady()) {
+			createRenderGraph(m_sceneLoader->getCapacity());
+			m_sceneReady = true;
+		}
+		if (m_sceneLoader->isFinished()) m_sceneLoader.reset();
+	}
+
 	glm::mat4 proj =
 		glm::perspectiveRH_ZO(glm::radians(60.f), 800.f / 600.f, 0.1f, 1000.0f);
 
 	proj[1][1] *= -1;
-	m_globalData->camera = {
+	GlobalResources::Camera camera {
 		.view = m_camera.getViewVector(),
 		.projection = proj,
 	};
+	m_globalData->camera = camera;
+
+	// Materials and buffers of the scene are still being created
+	if (!m_sceneReady) {
+		m_renderGraph->submit({}, {}, {}, camera, m_drawVersion);
+		return;
+	}
 
-	m_renderGraph->submit(m_currentScene->getPrimitives());
+	bool drawsChanged = false;
+	if (m_currentScene->update()) {
+		m_culler.setBounds(m_currentScene->getWorldBounds());
+		drawsChanged = true;
+	}
+
+	// GPU driven rendering culls every primitive in GpuCull instead, its
+	// results stay on the GPU
+	m_visiblePrimitives.clear();
+	m_cullStatistics = {};
+	if (!m_loadSettings.gpuDriven) {
+		m_cullStatistics = m_culler.cull(
+			camera.view, camera.projection, 600.f, m_visiblePrimitives
+		);
+		if (m_loadSettings.softwareOcclusion) cullOccluded(camera);
+		drawsChanged |= sortDraws(camera);
+	}
+
+	// Textures and material sets are created while the scene streams in
+	if (m_resourceManager->getResourceCount() != m_resourceCount ||
+	    m_materialManager->getVersion() != m_materialVersion) {
+		m_resourceCount = m_resourceManager->getResourceCount();
+		m_materialVersion = m_materialManager->getVersion();
+		drawsChanged = true;
+	}
+	if (drawsChanged) m_drawVersion++;
+
+	SceneGraph& sceneGraph = m_currentScene->getSceneGraph();
+	m_renderGraph->submit(
+		m_currentScene->getPrimitives(),
+		m_loadSettings.gpuDriven ? m_visiblePrimitives
+		                         : m_drawList.getPrimitives(),
+		sceneGraph.getWorldTransforms(),
+		camera,
+		m_drawVersion
+	);
+	m_barrierStatistics = m_renderGraph->getBarrierStatistics();
 };
 
-void Renderer::load(const std::filesystem::path& path) {
-	SceneLoader loader(*m_resourceManager, *m_materialManager);
-	m_currentScene = std::make_unique<Scene>(loader.load(path));
+// Rasterizes the visible occluders covering the most of the screen, within
+// the triangle budget, then drops the visible primitives hidden behind them
+void Renderer::cullOccluded(const GlobalResources::Camera& camera) {
+	const auto& occluders = m_currentScene->getOccluders();
+	const std::vector<Primitive>& primitives = m_currentScene->getPrimitives();
+	const std::vector<AABB>& bounds = m_currentScene->getWorldBounds();
+	const std::vector<glm::mat4>& transforms =
+		m_currentScene->getSceneGraph().getWorldTransforms();
+	glm::mat4 viewProjection = camera.projection * camera.view;
+	glm::vec3 cameraPosition = glm::inverse(camera.view)[3];
+
+	std::vector<std::pair<float, uint32_t>> candidates;
+	for (uint32_t index : m_visiblePrimitives) {
+		if (!occluders.contains(primitives[index].mesh)) continue;
+
+		glm::vec3 extent = bounds[index].max - bounds[index].min;
+		float distance = glm::max(
+			glm::distance(bounds[index].center(), cameraPosition), 1e-3f
+		);
+		candidates.push_back({
+			glm::dot(extent, extent) / (distance * distance),
+			index,
+		});
+	}
+	std::sort(candidates.begin(), candidates.end(), std::greater());
+
+	m_occlusionBuffer.clear();
+	uint32_t triangleCount = 0;
+	for (auto [size, index] : candidates) {
+		const Primitive& primitive = primitives[index];
+		const OccluderMesh& occluder = occluders.at(primitive.mesh);
+		uint32_t occluderTriangles = occluder.indices.size() / 3;
+		if (triangleCount + occluderTriangles > m_loadSettings.occluderBudget)
+			continue;
+
+		triangleCount += occluderTriangles;
+		m_occlusionBuffer.addOccluder(
+			occluder, viewProjection * transforms[primitive.transform]
+		);
+	}
+	m_occlusionBuffer.rasterize();
+
+	uint32_t visibleCount = m_visiblePrimitives.size();
+	std::erase_if(m_visiblePrimitives, [&](uint32_t index) {
+		return !m_occlusionBuffer.isVisible(bounds[index], viewProjection);
+	});
+	m_cullStatistics.occlusionCulled =
+		visibleCount - m_visiblePrimitives.size();
+	m_cullStatistics.visible = m_visiblePrimitives.size();
+}
+
+bool Renderer::sortDraws(const GlobalResources::Camera& camera) {
+	const std::vector<Primitive>& primitives = m_currentScene->getPrimitives();
+	const std::vector<AABB>& bounds = m_currentScene->getWorldBounds();
+	glm::vec3 cameraPosition = glm::inverse(camera.view)[3];
 
-	createRenderGraph();
-}
\ No newline at end of file
+	return m_drawList.update(m_visiblePrimitives, [&](uint32_t index) {
+		const Primitive& primitive = primitives[index];
+		// Every primitive uses the base material pipeline for now
+		return DrawList::MakeKey(
+			0,
+			primitive.material.instanceIndex,
+			primitive.indexType == vk::IndexType::eUint32,
+			primitive.mesh,
+			glm::distance(bounds[index].center(), cameraPosition)
+		);
+	});
+}
+
+void Renderer::load(
+	const std::filesystem::path& path, const SceneLoader::LoadSettings& settings
+) {
+	// Joins the loader of the previous scene, which still uploads to it
+	m_sceneLoader.reset();
+	if (m_sceneReady) {
+		// The tasks were created for the previous scene and settings, whose
+		// frames may still be in flight
+		m_instance.device.waitIdle();
+		resetRenderGraph();
+		m_sceneReady = false;
+	}
+
+	// Paths needing a feature the device lacks are turned off
+	m_loadSettings = settings;
+	const Instance::Features& features = m_instance.features;
+	// GPU and meshlet culling write the instance index of each draw as its
+	// first one
+	if (!features.drawIndirectFirstInstance) {
+		m_loadSettings.gpuDriven = false;
+		m_loadSettings.buildMeshlets = false;
+	}
+	if (!features.timelineSemaphore) m_loadSettings.asyncCompute = false;
+	if (!features.descriptorIndexing) m_loadSettings.bindlessMaterials = false;
+	// The visibility buffer also shades with bindless materials
+	if (!features.descriptorIndexing || !features.geometryShader ||
+	    !features.shaderStorageImageWriteWithoutFormat)
+		m_loadSettings.visibilityBuffer = false;
+	m_currentScene = std::make_unique<Scene>();
+	m_sceneLoader = std::make_unique<SceneLoader>(
+		m_instance.device,
+		*m_resourceManager,
+		*m_materialManager,
+		m_loadSettings
+	);
+	m_sceneLoader->loadAsync(path);
+}
@@ -2,18 +2,25 @@
 
 #include <SDL3/SDL_video.h>
 
+#include <cstdint>
 #include <filesystem>
 #include <memory>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "Camera.hpp"
 #include "Instance.hpp"
 #include "Rendergraph/RenderGraph.hpp"
 #include "Swapchain.hpp"
+#include "ThreadPool.hpp"
+#include "culling/OcclusionBuffer.hpp"
+#include "culling/PrimitiveCuller.hpp"
 #include "material/MaterialManager.hpp"
 #include "memory/MemoryAllocator.hpp"
+#include "rendergraph/DrawList.hpp"
 #include "resources/ResourceManager.hpp"
 #include "scene/Scene.hpp"
+#include "scene/SceneLoader.hpp"
 
 
 class Renderer {
@@ -25,6 +32,10 @@ private:
 	vk::CommandPool m_commandPool;
 	vk::DescriptorPool m_descriptorPool;
 
+	// Referenced by the render graph and the occlusion buffer, so it is
+	// declared before them and destroyed after them
+	ThreadPool m_threadPool;
+
 	std::unique_ptr<MemoryAllocator> m_memoryAllocator;
 	std::unique_ptr<ResourceManager> m_resourceManager;
 	std::unique_ptr<MaterialManager> m_materialManager;
@@ -33,17 +44,53 @@ private:
 	std::unique_ptr<Swapchain> m_swapchain;
 	std::unique_ptr<Scene> m_currentScene;
 
+	// Settings of the current scene, the loader keeps its own copy
+	SceneLoader::LoadSettings m_loadSettings;
+	// Alive while the current scene is streamed in
+	std::unique_ptr<SceneLoader> m_sceneLoader;
+	bool m_sceneReady = false;
+
+	PrimitiveCuller m_culler;
+	OcclusionBuffer m_occlusionBuffer { m_threadPool };
+	std::vector<uint32_t> m_visiblePrimitives;
+	CullStatistics m_cullStatistics;
+	BarrierStatistics m_barrierStatistics;
+	DrawList m_drawList;
+	// See Resources::drawVersion
+	uint64_t m_drawVersion = 0;
+	uint32_t m_resourceCount = 0;
+	uint32_t m_materialVersion = 0;
+
 	Camera m_camera;
 
 	GlobalResources* m_globalData;
 
 	void createSwapchain();
-	void createRenderGraph();
+	void resetRenderGraph();
+	void createRenderGraph(const GeometryCapacity& capacity);
+	void cullOccluded(const GlobalResources::Camera& camera);
+	// Returns whether the draw order changed
+	bool sortDraws(const GlobalResources::Camera& camera);
 
 public:
 	Renderer(SDL_Window* window);
-	void load(const std::filesystem::path& path);
+	// Waits for the submitted frames before the graph is destroyed
+	~Renderer();
+	// Starts streaming the scene in, primitives appear as they are uploaded
+	void load(
+		const std::filesystem::path& path,
+		const SceneLoader::LoadSettings& settings = {}
+	);
 	void render();
 
 	inline Camera& getCamera() { return m_camera; }
+	// CPU culling results of the last rendered frame, all zero with GPU
+	// driven rendering
+	inline const CullStatistics& getCullStatistics() const {
+		return m_cullStatistics;
+	}
+	// Synchronization recorded by the last rendered frame
+	inline const BarrierStatistics& getBarrierStatistics() const {
+		return m_barrierStatistics;
+	}
 };
\ No newline at end of file
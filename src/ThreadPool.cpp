@@ -0,0 +1,75 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+ThreadPool::ThreadPool(uint32_t workerCount) {
+	for (uint32_t i = 0; i < workerCount; i++)
+		m_workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+	for (auto& worker : m_workers) worker.join();
+}
+
+uint32_t ThreadPool::GetDefaultWorkerCount() {
+	return std::max(std::thread::hardware_concurrency(), 2u) - 1;
+}
+
+void ThreadPool::runIterations() {
+	for (uint32_t i = m_next++; i < m_count; i = m_next++) (*m_job)(i);
+}
+
+void ThreadPool::work() {
+	uint64_t generation = 0;
+	while (true) {
+		std::unique_lock lock(m_mutex);
+		m_wake.wait(lock, [&] {
+			return m_stopping || m_generation != generation;
+		});
+		if (m_stopping) return;
+		generation = m_generation;
+		lock.unlock();
+
+		runIterations();
+
+		lock.lock();
+		if (--m_active == 0) m_done.notify_one();
+	}
+}
+
+void ThreadPool::parallelFor(
+	uint32_t count, const std::function<void(uint32_t)>& job
+) {
+	if (count == 0) return;
+	if (count == 1 || m_workers.empty()) {
+		for (uint32_t i = 0; i < count; i++) job(i);
+		return;
+	}
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_next = 0;
+		m_active = m_workers.size();
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	runIterations();
+
+	// Workers read the job until they leave the loop, so it has to stay
+	// alive until all of them did
+	std::unique_lock lock(m_mutex);
+	m_done.wait(lock, [&] { return m_active == 0; });
+	m_job = nullptr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running the iterations of a loop in parallel.
+// The calling thread takes part in the loop and returns once every
+// iteration completed. Jobs must not start other loops on the same pool.
+class ThreadPool {
+private:
+	std::vector<std::thread> m_workers;
+
+	// Guarded by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const std::function<void(uint32_t)>* m_job = nullptr;
+	uint32_t m_count = 0;
+	// Workers that did not finish the current loop yet
+	uint32_t m_active = 0;
+	uint64_t m_generation = 0;
+	bool m_stopping = false;
+
+	std::atomic<uint32_t> m_next = 0;
+
+	void work();
+	void runIterations();
+
+public:
+	// Defaults to one worker per hardware thread besides the caller
+	ThreadPool(uint32_t workerCount = GetDefaultWorkerCount());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void parallelFor(uint32_t count, const std::function<void(uint32_t)>& job);
+
+	// Threads running a loop, including the caller
+	inline uint32_t size() const { return m_workers.size() + 1; }
+
+	static uint32_t GetDefaultWorkerCount();
+};
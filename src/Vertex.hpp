@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+enum class VertexFormat : uint8_t {
+	Full,
+	Compact,
+};
+
+struct Vertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texcoord;
+};
+
+// 16 byte layout: positions normalized to the mesh bounds, octahedral
+// normals and half float texture coordinates.
+struct CompactVertex {
+	glm::u16vec4 position;
+	glm::i16vec2 normal;
+	glm::u16vec2 texcoord;
+};
+
+inline uint32_t getVertexStride(VertexFormat format) {
+	return format == VertexFormat::Compact ? sizeof(CompactVertex)
+	                                       : sizeof(Vertex);
+}
+
+// Positions lead both layouts, depth only passes read them from a tightly
+// packed stream of this stride
+inline uint32_t getPositionStride(VertexFormat format) {
+	return format == VertexFormat::Compact ? sizeof(glm::u16vec4)
+	                                       : sizeof(glm::vec3);
+}
+
+inline glm::vec2 octahedralEncode(glm::vec3 normal) {
+	normal /= glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+	glm::vec2 encoded(normal.x, normal.y);
+	if (normal.z < 0) {
+		glm::vec2 sign(
+			encoded.x >= 0 ? 1.f : -1.f, encoded.y >= 0 ? 1.f : -1.f
+		);
+		encoded = (1.f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+	}
+	return encoded;
+}
+
+inline CompactVertex compressVertex(
+	const Vertex& vertex, glm::vec3 boundsMin, glm::vec3 boundsExtent
+) {
+	glm::vec3 position = (vertex.position - boundsMin) / boundsExtent;
+	return CompactVertex {
+		.position = glm::packUnorm<uint16_t>(
+			glm::clamp(glm::vec4(position, 1), 0.f, 1.f)
+		),
+		.normal = glm::packSnorm<int16_t>(octahedralEncode(vertex.normal)),
+		.texcoord = glm::packHalf(vertex.texcoord),
+	};
+}
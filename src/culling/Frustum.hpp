@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// World space planes of a zero to one depth range view projection, normals
+// pointing inside and normalized so plane distances are in world units
+inline std::array<glm::vec4, 6> getFrustumPlanes(
+	const glm::mat4& viewProjection
+) {
+	auto row = [&](uint32_t i) {
+		return glm::vec4(
+			viewProjection[0][i],
+			viewProjection[1][i],
+			viewProjection[2][i],
+			viewProjection[3][i]
+		);
+	};
+
+	// The near plane is the third row alone
+	std::array<glm::vec4, 6> planes {
+		row(3) + row(0), row(3) - row(0), row(3) + row(1),
+		row(3) - row(1), row(2),          row(3) - row(2),
+	};
+	for (auto& plane : planes) plane /= glm::length(glm::vec3(plane));
+
+	return planes;
+}
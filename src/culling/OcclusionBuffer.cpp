@@ -0,0 +1,282 @@
+#include "OcclusionBuffer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "Primitive.hpp"
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+
+using namespace simd;
+
+static_assert(OcclusionBuffer::TILE_WIDTH % LANE_COUNT == 0);
+
+// Bounds are moved towards the camera by this much before being tested, so
+// occluders do not hide themselves through rounding errors
+constexpr float DEPTH_BIAS = 1e-6f;
+
+// Pixel coordinates and zero to one depth, y pointing down like the
+// flipped projection of the renderer
+glm::vec3 toScreen(glm::vec4 clip, glm::vec2 size) {
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return glm::vec3(
+		(ndc.x * 0.5f + 0.5f) * size.x, (ndc.y * 0.5f + 0.5f) * size.y, ndc.z
+	);
+}
+
+// Pixel centers of the first lanes of a span
+Lanes getLaneCenters(float firstX) {
+	std::array<float, LANE_COUNT> centers;
+	for (uint32_t i = 0; i < LANE_COUNT; i++) centers[i] = firstX + i + 0.5f;
+	return load(centers.data());
+}
+
+OcclusionBuffer::OcclusionBuffer(
+	ThreadPool& threadPool, uint32_t width, uint32_t height
+) :
+	m_threadPool(threadPool) {
+	m_tilesX = std::max((width + TILE_WIDTH - 1) / TILE_WIDTH, 1u);
+	m_tilesY = std::max((height + TILE_HEIGHT - 1) / TILE_HEIGHT, 1u);
+	m_width = m_tilesX * TILE_WIDTH;
+	m_height = m_tilesY * TILE_HEIGHT;
+
+	m_depth.resize(m_width * m_height);
+	m_tileDepth.resize(m_tilesX * m_tilesY);
+	m_bins.resize(m_tilesX * m_tilesY);
+	clear();
+}
+
+void OcclusionBuffer::clear() {
+	std::fill(m_depth.begin(), m_depth.end(), 1.f);
+	std::fill(m_tileDepth.begin(), m_tileDepth.end(), 1.f);
+	m_triangles.clear();
+}
+
+void OcclusionBuffer::addOccluder(
+	const OccluderMesh& mesh, const glm::mat4& modelViewProjection
+) {
+	std::vector<glm::vec4> clipPositions;
+	clipPositions.reserve(mesh.positions.size());
+	for (const auto& position : mesh.positions)
+		clipPositions.push_back(modelViewProjection * glm::vec4(position, 1));
+
+	glm::vec2 size(m_width, m_height);
+	for (uint32_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const glm::vec4& clipA = clipPositions[mesh.indices[i]];
+		const glm::vec4& clipB = clipPositions[mesh.indices[i + 1]];
+		const glm::vec4& clipC = clipPositions[mesh.indices[i + 2]];
+		if (clipA.z < 0 || clipB.z < 0 || clipC.z < 0) continue;
+
+		glm::vec3 a = toScreen(clipA, size);
+		glm::vec3 b = toScreen(clipB, size);
+		glm::vec3 c = toScreen(clipC, size);
+
+		// Both windings are drawn, back faces are behind the front ones of
+		// closed meshes anyway
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (area == 0) continue;
+		if (area < 0) {
+			std::swap(b, c);
+			area = -area;
+		}
+
+		// Pixels whose center is inside the triangle bounds
+		glm::ivec2 min(
+			std::ceil(std::min({ a.x, b.x, c.x }) - 0.5f),
+			std::ceil(std::min({ a.y, b.y, c.y }) - 0.5f)
+		);
+		glm::ivec2 max(
+			std::floor(std::max({ a.x, b.x, c.x }) - 0.5f),
+			std::floor(std::max({ a.y, b.y, c.y }) - 0.5f)
+		);
+		min = glm::max(min, glm::ivec2(0));
+		max = glm::min(max, glm::ivec2(m_width - 1, m_height - 1));
+		if (min.x > max.x || min.y > max.y) continue;
+
+		Triangle triangle;
+		triangle.min = min;
+		triangle.max = max;
+		std::array<std::pair<glm::vec3, glm::vec3>, 3> edges {
+			std::pair { a, b },
+			std::pair { b, c },
+			std::pair { c, a },
+		};
+		for (uint32_t edge = 0; edge < 3; edge++) {
+			auto [from, to] = edges[edge];
+			triangle.edgeX[edge] = from.y - to.y;
+			triangle.edgeY[edge] = to.x - from.x;
+			triangle.edgeOffset[edge] =
+				(to.y - from.y) * from.x - (to.x - from.x) * from.y;
+		}
+
+		glm::vec3 ab = b - a;
+		glm::vec3 ac = c - a;
+		float depthX = (ab.z * ac.y - ac.z * ab.y) / area;
+		float depthY = (ac.z * ab.x - ab.z * ac.x) / area;
+		triangle.depthPlane = glm::vec3(
+			depthX, depthY, a.z - depthX * a.x - depthY * a.y
+		);
+		m_triangles.push_back(triangle);
+	}
+}
+
+void OcclusionBuffer::rasterize() {
+	for (auto& bin : m_bins) bin.clear();
+	for (uint32_t i = 0; i < m_triangles.size(); i++) {
+		const Triangle& triangle = m_triangles[i];
+		for (uint32_t y = triangle.min.y / TILE_HEIGHT;
+		     y <= triangle.max.y / TILE_HEIGHT;
+		     y++) {
+			for (uint32_t x = triangle.min.x / TILE_WIDTH;
+			     x <= triangle.max.x / TILE_WIDTH;
+			     x++)
+				m_bins[y * m_tilesX + x].push_back(i);
+		}
+	}
+
+	m_threadPool.parallelFor(m_bins.size(), [&](uint32_t tile) {
+		rasterizeTile(tile);
+	});
+}
+
+void OcclusionBuffer::rasterizeTile(uint32_t tile) {
+	glm::ivec2 tileMin(
+		tile % m_tilesX * TILE_WIDTH, tile / m_tilesX * TILE_HEIGHT
+	);
+	glm::ivec2 tileMax = tileMin + glm::ivec2(TILE_WIDTH - 1, TILE_HEIGHT - 1);
+	Lanes zero = splat(0);
+
+	for (uint32_t index : m_bins[tile]) {
+		const Triangle& triangle = m_triangles[index];
+		glm::ivec2 min = glm::max(triangle.min, tileMin);
+		glm::ivec2 max = glm::min(triangle.max, tileMax);
+		// Spans start on a lane boundary so they stay inside the tile
+		uint32_t firstX = min.x / LANE_COUNT * LANE_COUNT;
+		Lanes firstCenters = getLaneCenters(firstX);
+
+		Lanes edgeSteps[3];
+		for (uint32_t edge = 0; edge < 3; edge++)
+			edgeSteps[edge] = splat(triangle.edgeX[edge] * LANE_COUNT);
+		Lanes depthStep = splat(triangle.depthPlane.x * LANE_COUNT);
+
+		for (int32_t y = min.y; y <= max.y; y++) {
+			float centerY = y + 0.5f;
+			Lanes edges[3];
+			for (uint32_t edge = 0; edge < 3; edge++) {
+				edges[edge] = add(
+					mul(splat(triangle.edgeX[edge]), firstCenters),
+					splat(
+						triangle.edgeY[edge] * centerY +
+						triangle.edgeOffset[edge]
+					)
+				);
+			}
+			Lanes depth = add(
+				mul(splat(triangle.depthPlane.x), firstCenters),
+				splat(
+					triangle.depthPlane.y * centerY + triangle.depthPlane.z
+				)
+			);
+
+			float* row = &m_depth[y * m_width];
+			for (int32_t x = firstX; x <= max.x; x += LANE_COUNT) {
+				Mask inside = both(
+					both(greaterEqual(edges[0], zero),
+				         greaterEqual(edges[1], zero)),
+					greaterEqual(edges[2], zero)
+				);
+				if (bits(inside) != 0) {
+					Lanes current = load(row + x);
+					store(
+						row + x,
+						select(inside, simd::min(current, depth), current)
+					);
+				}
+
+				for (uint32_t edge = 0; edge < 3; edge++)
+					edges[edge] = add(edges[edge], edgeSteps[edge]);
+				depth = add(depth, depthStep);
+			}
+		}
+	}
+
+	Lanes farthest = splat(0);
+	for (int32_t y = tileMin.y; y <= tileMax.y; y++) {
+		const float* row = &m_depth[y * m_width];
+		for (int32_t x = tileMin.x; x <= tileMax.x; x += LANE_COUNT)
+			farthest = simd::max(farthest, load(row + x));
+	}
+	std::array<float, LANE_COUNT> lanes;
+	store(lanes.data(), farthest);
+	m_tileDepth[tile] = *std::max_element(lanes.begin(), lanes.end());
+}
+
+bool OcclusionBuffer::isVisible(
+	const AABB& bounds, const glm::mat4& viewProjection
+) const {
+	glm::vec2 size(m_width, m_height);
+	glm::vec2 screenMin(std::numeric_limits<float>::max());
+	glm::vec2 screenMax(std::numeric_limits<float>::lowest());
+	float nearest = std::numeric_limits<float>::max();
+	for (uint32_t i = 0; i < 8; i++) {
+		glm::vec3 corner(
+			i & 1 ? bounds.max.x : bounds.min.x,
+			i & 2 ? bounds.max.y : bounds.min.y,
+			i & 4 ? bounds.max.z : bounds.min.z
+		);
+		glm::vec4 clip = viewProjection * glm::vec4(corner, 1);
+		// Boxes crossing the near plane cover the whole view
+		if (clip.z < 0) return true;
+
+		glm::vec3 screen = toScreen(clip, size);
+		screenMin = glm::min(screenMin, glm::vec2(screen));
+		screenMax = glm::max(screenMax, glm::vec2(screen));
+		nearest = std::min(nearest, screen.z);
+	}
+
+	glm::ivec2 first = glm::max(glm::ivec2(glm::floor(screenMin)), 0);
+	glm::ivec2 last = glm::min(
+		glm::ivec2(glm::floor(screenMax)),
+		glm::ivec2(m_width - 1, m_height - 1)
+	);
+	if (first.x > last.x || first.y > last.y) return false;
+
+	nearest -= DEPTH_BIAS;
+	Lanes nearestLanes = splat(nearest);
+	for (uint32_t tileY = first.y / TILE_HEIGHT; tileY <= last.y / TILE_HEIGHT;
+	     tileY++) {
+		for (uint32_t tileX = first.x / TILE_WIDTH;
+		     tileX <= last.x / TILE_WIDTH;
+		     tileX++) {
+			// Every occluder of the tile is in front of the box
+			if (m_tileDepth[tileY * m_tilesX + tileX] < nearest) continue;
+
+			glm::ivec2 tileMin(tileX * TILE_WIDTH, tileY * TILE_HEIGHT);
+			glm::ivec2 min = glm::max(first, tileMin);
+			glm::ivec2 max = glm::min(
+				last, tileMin + glm::ivec2(TILE_WIDTH - 1, TILE_HEIGHT - 1)
+			);
+			int32_t firstX = min.x / LANE_COUNT * LANE_COUNT;
+
+			for (int32_t y = min.y; y <= max.y; y++) {
+				const float* row = &m_depth[y * m_width];
+				for (int32_t x = firstX; x <= max.x; x += LANE_COUNT) {
+					// Lanes of the span inside the box
+					uint32_t start = std::max(min.x - x, 0);
+					uint32_t end = std::min<int32_t>(max.x - x + 1, LANE_COUNT);
+					uint32_t valid = (1u << end) - (1u << start);
+
+					Mask behind = greaterEqual(load(row + x), nearestLanes);
+					if (bits(behind) & valid) return true;
+				}
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Primitive.hpp"
+#include "ThreadPool.hpp"
+
+// Simplified mesh drawn into the occlusion buffer. Positions are in mesh
+// space and only the ones referenced by the indices are kept.
+struct OccluderMesh {
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+// Low resolution depth buffer rasterized on the CPU from a few occluder
+// meshes, along the lines of masked occlusion culling. Triangles are binned
+// to tiles, each tile is rasterized by a single thread of the pool, several
+// pixels at a time with SIMD. Bounds are then tested against the farthest
+// depth of the tiles they cover before their pixels.
+//
+// Occluders only ever write the nearest depth, so the result does not depend
+// on the thread count or on the order tiles are processed in.
+class OcclusionBuffer {
+public:
+	struct Triangle;
+
+	static constexpr uint32_t TILE_WIDTH = 32;
+	static constexpr uint32_t TILE_HEIGHT = 8;
+
+private:
+	ThreadPool& m_threadPool;
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_tilesX;
+	uint32_t m_tilesY;
+
+	// Zero to one depth, row major
+	std::vector<float> m_depth;
+	// Farthest depth of each tile
+	std::vector<float> m_tileDepth;
+
+	std::vector<Triangle> m_triangles;
+	// Triangles overlapping each tile, in submission order
+	std::vector<std::vector<uint32_t>> m_bins;
+
+	void rasterizeTile(uint32_t tile);
+
+public:
+	// The size is rounded up to whole tiles
+	OcclusionBuffer(
+		ThreadPool& threadPool, uint32_t width = 256, uint32_t height = 128
+	);
+
+	void clear();
+	// Triangles crossing the near plane are skipped, which only makes the
+	// buffer less occluding
+	void addOccluder(
+		const OccluderMesh& mesh, const glm::mat4& modelViewProjection
+	);
+	// Draws the triangles added since the last clear
+	void rasterize();
+
+	// False when every pixel covered by the box is behind an occluder
+	bool isVisible(const AABB& bounds, const glm::mat4& viewProjection) const;
+
+	inline uint32_t getWidth() const { return m_width; }
+	inline uint32_t getHeight() const { return m_height; }
+	inline const std::vector<float>& getDepth() const { return m_depth; }
+	inline uint32_t getTriangleCount() const { return m_triangles.size(); }
+};
+
+// Edge functions and depth plane in pixel coordinates, with the edges
+// oriented so covered pixel centers have all three positive
+struct OcclusionBuffer::Triangle {
+	glm::vec3 edgeX;
+	glm::vec3 edgeY;
+	glm::vec3 edgeOffset;
+	glm::vec3 depthPlane;
+	glm::ivec2 min;
+	glm::ivec2 max;
+};
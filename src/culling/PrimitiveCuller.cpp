@@ -0,0 +1,126 @@
+#include "PrimitiveCuller.hpp"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Frustum.hpp"
+#include "Primitive.hpp"
+#include "Simd.hpp"
+
+using namespace simd;
+
+void PrimitiveCuller::setBounds(const std::vector<AABB>& bounds) {
+	m_count = bounds.size();
+	uint32_t paddedCount =
+		(m_count + LANE_COUNT - 1) / LANE_COUNT * LANE_COUNT;
+
+	for (auto* values : { &m_centerX, &m_centerY, &m_centerZ, &m_extentX,
+	                      &m_extentY, &m_extentZ })
+		values->assign(paddedCount, 0);
+
+	for (uint32_t i = 0; i < m_count; i++) {
+		glm::vec3 center = bounds[i].center();
+		glm::vec3 extent = (bounds[i].max - bounds[i].min) * 0.5f;
+		m_centerX[i] = center.x;
+		m_centerY[i] = center.y;
+		m_centerZ[i] = center.z;
+		m_extentX[i] = extent.x;
+		m_extentY[i] = extent.y;
+		m_extentZ[i] = extent.z;
+	}
+}
+
+CullStatistics PrimitiveCuller::cull(
+	const glm::mat4& view,
+	const glm::mat4& projection,
+	float viewportHeight,
+	std::vector<uint32_t>& visible
+) const {
+	std::array<glm::vec4, 6> planes = getFrustumPlanes(projection * view);
+	glm::vec3 camera = glm::inverse(view)[3];
+
+	struct PlaneLanes {
+		Lanes x, y, z, w;
+		// Absolute normal, projects the half extents on the normal
+		Lanes absX, absY, absZ;
+	};
+	std::array<PlaneLanes, 6> planeLanes;
+	for (uint32_t i = 0; i < planes.size(); i++) {
+		const glm::vec4& plane = planes[i];
+		planeLanes[i] = {
+			.x = splat(plane.x),
+			.y = splat(plane.y),
+			.z = splat(plane.z),
+			.w = splat(plane.w),
+			.absX = splat(glm::abs(plane.x)),
+			.absY = splat(glm::abs(plane.y)),
+			.absZ = splat(glm::abs(plane.z)),
+		};
+	}
+
+	// A box is too small when the diameter of its bounding sphere,
+	// r * height * projection[1][1] / distance, is below the threshold.
+	// Compared squared to avoid the square roots.
+	float pixelsPerUnit = viewportHeight * glm::abs(projection[1][1]);
+	Lanes sizeScale = splat(pixelsPerUnit * pixelsPerUnit);
+	Lanes minSize = splat(m_minScreenSize * m_minScreenSize);
+	Lanes cameraX = splat(camera.x);
+	Lanes cameraY = splat(camera.y);
+	Lanes cameraZ = splat(camera.z);
+	Lanes zero = splat(0);
+
+	CullStatistics statistics;
+	for (uint32_t first = 0; first < m_count; first += LANE_COUNT) {
+		Lanes centerX = load(&m_centerX[first]);
+		Lanes centerY = load(&m_centerY[first]);
+		Lanes centerZ = load(&m_centerZ[first]);
+		Lanes extentX = load(&m_extentX[first]);
+		Lanes extentY = load(&m_extentY[first]);
+		Lanes extentZ = load(&m_extentZ[first]);
+
+		Mask outside = less(zero, zero);
+		for (const PlaneLanes& plane : planeLanes) {
+			Lanes distance = add(
+				add(mul(plane.x, centerX), mul(plane.y, centerY)),
+				add(mul(plane.z, centerZ), plane.w)
+			);
+			Lanes radius = add(
+				add(mul(plane.absX, extentX), mul(plane.absY, extentY)),
+				mul(plane.absZ, extentZ)
+			);
+			outside = either(outside, less(add(distance, radius), zero));
+		}
+
+		Lanes offsetX = sub(centerX, cameraX);
+		Lanes offsetY = sub(centerY, cameraY);
+		Lanes offsetZ = sub(centerZ, cameraZ);
+		Lanes distance = add(
+			add(mul(offsetX, offsetX), mul(offsetY, offsetY)),
+			mul(offsetZ, offsetZ)
+		);
+		Lanes radius = add(
+			add(mul(extentX, extentX), mul(extentY, extentY)),
+			mul(extentZ, extentZ)
+		);
+		Mask small =
+			less(mul(radius, sizeScale), mul(minSize, distance));
+
+		// Padding lanes past the last primitive are ignored
+		uint32_t lanes = m_count - first < LANE_COUNT ? m_count - first
+		                                              : LANE_COUNT;
+		uint32_t valid = (1u << lanes) - 1;
+		uint32_t outsideBits = bits(outside) & valid;
+		uint32_t smallBits = bits(small) & valid & ~outsideBits;
+		uint32_t visibleBits = valid & ~(outsideBits | smallBits);
+
+		statistics.frustumCulled += std::popcount(outsideBits);
+		statistics.sizeCulled += std::popcount(smallBits);
+		statistics.visible += std::popcount(visibleBits);
+		for (; visibleBits != 0; visibleBits &= visibleBits - 1)
+			visible.push_back(first + std::countr_zero(visibleBits));
+	}
+	return statistics;
+}
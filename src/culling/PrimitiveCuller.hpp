@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Primitive.hpp"
+
+struct CullStatistics {
+	uint32_t visible = 0;
+	uint32_t frustumCulled = 0;
+	// Inside the frustum but smaller than the minimum screen size
+	uint32_t sizeCulled = 0;
+	// Hidden behind occluders in the OcclusionBuffer
+	uint32_t occlusionCulled = 0;
+};
+
+// Rejects primitives whose world bounds are outside the view frustum or
+// project to fewer than `minScreenSize` pixels. Bounds are kept as structure
+// of arrays and tested several at a time with AVX, SSE or NEON, falling back
+// to scalar code on other targets.
+class PrimitiveCuller {
+private:
+	float m_minScreenSize;
+
+	// Box centers and half extents, padded to a multiple of the SIMD width
+	std::vector<float> m_centerX;
+	std::vector<float> m_centerY;
+	std::vector<float> m_centerZ;
+	std::vector<float> m_extentX;
+	std::vector<float> m_extentY;
+	std::vector<float> m_extentZ;
+	uint32_t m_count = 0;
+
+public:
+	PrimitiveCuller(float minScreenSize = 1.f) :
+		m_minScreenSize(minScreenSize) {}
+
+	void setBounds(const std::vector<AABB>& bounds);
+
+	// Appends the indices of the surviving primitives to `visible`, in
+	// increasing order
+	CullStatistics cull(
+		const glm::mat4& view,
+		const glm::mat4& projection,
+		float viewportHeight,
+		std::vector<uint32_t>& visible
+	) const;
+};
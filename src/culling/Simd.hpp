@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Lanes of floats processed together with AVX, SSE or NEON, falling back to
+// a single scalar lane on other targets. Masks are turned into one bit per
+// lane with `bits`.
+namespace simd {
+
+#if defined(__AVX__)
+using Lanes = __m256;
+using Mask = __m256;
+constexpr uint32_t LANE_COUNT = 8;
+
+inline Lanes load(const float* values) { return _mm256_loadu_ps(values); }
+inline void store(float* values, Lanes lanes) {
+	_mm256_storeu_ps(values, lanes);
+}
+inline Lanes splat(float value) { return _mm256_set1_ps(value); }
+inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+inline Lanes min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+inline Lanes max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+inline Mask less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Mask greaterEqual(Lanes a, Lanes b) {
+	return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+inline Mask either(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+inline Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+inline Lanes select(Mask mask, Lanes a, Lanes b) {
+	return _mm256_blendv_ps(b, a, mask);
+}
+inline uint32_t bits(Mask mask) { return _mm256_movemask_ps(mask); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+using Lanes = __m128;
+using Mask = __m128;
+constexpr uint32_t LANE_COUNT = 4;
+
+inline Lanes load(const float* values) { return _mm_loadu_ps(values); }
+inline void store(float* values, Lanes lanes) { _mm_storeu_ps(values, lanes); }
+inline Lanes splat(float value) { return _mm_set1_ps(value); }
+inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+inline Lanes max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+inline Mask less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+inline Mask greaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+inline Mask either(Mask a, Mask b) { return _mm_or_ps(a, b); }
+inline Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+inline Lanes select(Mask mask, Lanes a, Lanes b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+inline uint32_t bits(Mask mask) { return _mm_movemask_ps(mask); }
+
+#elif defined(__ARM_NEON)
+using Lanes = float32x4_t;
+using Mask = uint32x4_t;
+constexpr uint32_t LANE_COUNT = 4;
+
+inline Lanes load(const float* values) { return vld1q_f32(values); }
+inline void store(float* values, Lanes lanes) { vst1q_f32(values, lanes); }
+inline Lanes splat(float value) { return vdupq_n_f32(value); }
+inline Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+inline Lanes min(Lanes a, Lanes b) { return vminq_f32(a, b); }
+inline Lanes max(Lanes a, Lanes b) { return vmaxq_f32(a, b); }
+inline Mask less(Lanes a, Lanes b) { return vcltq_f32(a, b); }
+inline Mask greaterEqual(Lanes a, Lanes b) { return vcgeq_f32(a, b); }
+inline Mask either(Mask a, Mask b) { return vorrq_u32(a, b); }
+inline Mask both(Mask a, Mask b) { return vandq_u32(a, b); }
+inline Lanes select(Mask mask, Lanes a, Lanes b) {
+	return vbslq_f32(mask, a, b);
+}
+inline uint32_t bits(Mask mask) {
+	const uint32_t weights[4] = { 1, 2, 4, 8 };
+	uint32x4_t weighted = vandq_u32(mask, vld1q_u32(weights));
+	uint32x2_t sum = vadd_u32(vget_low_u32(weighted), vget_high_u32(weighted));
+	return vget_lane_u32(vpadd_u32(sum, sum), 0);
+}
+
+#else
+
+using Lanes = float;
+using Mask = bool;
+constexpr uint32_t LANE_COUNT = 1;
+
+inline Lanes load(const float* values) { return *values; }
+inline void store(float* values, Lanes lanes) { *values = lanes; }
+inline Lanes splat(float value) { return value; }
+inline Lanes add(Lanes a, Lanes b) { return a + b; }
+inline Lanes sub(Lanes a, Lanes b) { return a - b; }
+inline Lanes mul(Lanes a, Lanes b) { return a * b; }
+inline Lanes min(Lanes a, Lanes b) { return a < b ? a : b; }
+inline Lanes max(Lanes a, Lanes b) { return a > b ? a : b; }
+inline Mask less(Lanes a, Lanes b) { return a < b; }
+inline Mask greaterEqual(Lanes a, Lanes b) { return a >= b; }
+inline Mask either(Mask a, Mask b) { return a || b; }
+inline Mask both(Mask a, Mask b) { return a && b; }
+inline Lanes select(Mask mask, Lanes a, Lanes b) { return mask ? a : b; }
+inline uint32_t bits(Mask mask) { return mask; }
+
+#endif
+
+}
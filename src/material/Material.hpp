@@ -1,18 +1,44 @@
 #pragma once
 
+#include <glm/glm.hpp>
+#include <memory>
+#include <optional>
+
 #include "Pipeline.hpp"
+#include "Vertex.hpp"
+#include "resources/Image.hpp"
 
 struct DescriptorSet {
 	vk::DescriptorSet set = nullptr;
 	vk::DescriptorSetLayout layout = nullptr;
 };
+// Set of the InstanceData buffer, pushed by the passes drawing a material
+constexpr uint32_t INSTANCE_SET = 2;
+
 struct Material {
 	Pipeline pipeline;
+	// Position only pipeline of the depth prepass. When set, `pipeline`
+	// tests for equal depth without writing it, so the prepass has to run
+	// before it.
+	std::optional<Pipeline> depthPipeline;
+	// Writes the triangle and instance IDs of VisibilityPass, bindless
+	// materials only
+	std::optional<Pipeline> visibilityPipeline;
 
 	DescriptorSet globalSet;
 	DescriptorSet materialSet;
 	vk::DescriptorSetLayout instanceLayout;
 	std::vector<vk::DescriptorSet> instanceSets;
+	// Instances are entries of the material table in `materialSet`, draws
+	// select theirs through InstanceData::material instead of binding a set
+	bool bindless = false;
+};
+
+// Entry of the bindless material table, laid out as std430
+struct MaterialParameters {
+	uint32_t albedoTexture;
+	uint32_t padding[3];
+	glm::vec4 baseColor;
 };
 
 struct MaterialInstance {
@@ -25,10 +51,21 @@ struct MaterialDescription {
 		uint32_t count;
 		vk::DescriptorType type;
 		vk::ShaderStageFlags stage;
+		// Texture streamed in by the caller, see MaterialManager::setTexture
 		std::filesystem::path path;
 	};
 	std::filesystem::path vertex;
 	std::filesystem::path fragment;
+	VertexFormat vertexFormat = VertexFormat::Full;
+	bool bindless = false;
+	// Also builds Material::depthPipeline from `depthVertex`
+	bool depthPrepass = false;
+	std::filesystem::path depthVertex = "resources/shaders/depth.vert.spv";
+	// Also builds Material::visibilityPipeline, drawing `depthVertex` with
+	// `visibilityFragment`
+	bool visibility = false;
+	std::filesystem::path visibilityFragment =
+		"resources/shaders/visibility.frag.spv";
 	std::vector<Resource> materialResources;
 	std::vector<Resource> instanceResources;
 
@@ -36,9 +73,17 @@ struct MaterialDescription {
 		std::filesystem::path albedo;
 	};
 
-	static MaterialDescription Default(DefaultMaterialTextures definition) {
+	static MaterialDescription Default(
+		DefaultMaterialTextures definition,
+		VertexFormat vertexFormat = VertexFormat::Full,
+		bool bindless = false
+	) {
 		return { .vertex = "resources/shaders/main.vert.spv",
-			     .fragment = "resources/shaders/main.frag.spv",
+			     .fragment = bindless
+			                     ? "resources/shaders/main_bindless.frag.spv"
+			                     : "resources/shaders/main.frag.spv",
+			     .vertexFormat = vertexFormat,
+			     .bindless = bindless,
 			     .instanceResources = {
 					{ .binding = 0,
 			                    .count = 1,
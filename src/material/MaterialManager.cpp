@@ -1,8 +1,10 @@
 #include "MaterialManager.hpp"
 
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
@@ -17,6 +19,9 @@
 #include "resources/Buffer.hpp"
 #include "resources/ResourceManager.hpp"
 
+constexpr uint32_t MAX_BINDLESS_TEXTURES = 4096;
+constexpr uint32_t MAX_BINDLESS_MATERIALS = 1024;
+
 MaterialManager::MaterialManager(
 	Instance& instance, ResourceManager& resourceManager
 ) :
@@ -102,6 +107,27 @@ MaterialManager::MaterialManager(
 	};
 
 	m_linearSampler = m_device.createSampler(samplerInfo);
+
+	m_placeholderTexture = m_resourceManager.uploadImage(ImageData {
+		.x = 1,
+		.y = 1,
+		.channels = 4,
+		.data = std::vector<std::byte>(4, std::byte { 0xff }),
+	});
+	m_resourceManager.submitTransfers();
+	m_resourceManager.waitTransfers();
+
+	vk::DescriptorSetLayoutBinding instanceBinding {
+		.binding = 0,
+		.descriptorType = vk::DescriptorType::eStorageBuffer,
+		.descriptorCount = 1,
+		.stageFlags = vk::ShaderStageFlagBits::eVertex,
+	};
+	m_instanceDataLayout = m_device.createDescriptorSetLayout({
+		.flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+		.bindingCount = 1,
+		.pBindings = &instanceBinding,
+	});
 }
 void MaterialManager::updateDescriptorSets(uint8_t currentFrame) {
 	for (auto& material : m_materials) {
@@ -109,6 +135,33 @@ void MaterialManager::updateDescriptorSets(uint8_t currentFrame) {
 	}
 }
 
+// Same set layouts as the main pipeline, so the sets bound for one stay
+// valid for the other
+std::optional<Pipeline> createDepthPipeline(
+	PipelineBuilder::PipelineBuildInfo pipelineInfo,
+	const MaterialDescription& description
+) {
+	if (!description.depthPrepass) return std::nullopt;
+	pipelineInfo.vertex = description.depthVertex;
+	pipelineInfo.positionsOnly = true;
+	pipelineInfo.colorFormats = {};
+	pipelineInfo.depthEqual = false;
+	return PipelineBuilder::DefaultPipeline(pipelineInfo);
+}
+
+std::optional<Pipeline> createVisibilityPipeline(
+	PipelineBuilder::PipelineBuildInfo pipelineInfo,
+	const MaterialDescription& description
+) {
+	if (!description.visibility) return std::nullopt;
+	pipelineInfo.vertex = description.depthVertex;
+	pipelineInfo.fragment = description.visibilityFragment;
+	pipelineInfo.positionsOnly = true;
+	pipelineInfo.colorFormats = { vk::Format::eR32Uint };
+	pipelineInfo.depthEqual = false;
+	return PipelineBuilder::DefaultPipeline(pipelineInfo);
+}
+
 uint32_t MaterialManager::createMaterial(MaterialDescription& description) {
 	auto key = std::pair(description.vertex, description.fragment);
 
@@ -116,16 +169,36 @@ uint32_t MaterialManager::createMaterial(MaterialDescription& description) {
 
 	if (m_materials.size() > 0) return 0;
 
+	if (description.bindless) {
+		createBindlessSet();
+		PipelineBuilder::PipelineBuildInfo pipelineInfo {
+			.device = m_device,
+			.vertex = description.vertex,
+			.fragment = description.fragment,
+			.layouts = { m_globalSets[0].layout,
+			             m_bindlessSet.layout,
+			             m_instanceDataLayout },
+			.vertexFormat = description.vertexFormat,
+			.depthEqual = description.depthPrepass,
+		};
+		m_materials.push_back(std::make_shared<Material>(Material {
+			.pipeline = PipelineBuilder::DefaultPipeline(pipelineInfo),
+			.depthPipeline = createDepthPipeline(pipelineInfo, description),
+			.visibilityPipeline =
+				createVisibilityPipeline(pipelineInfo, description),
+			.globalSet = m_globalSets[0],
+			.materialSet = m_bindlessSet,
+			.bindless = true,
+		}));
+		return m_materials.size() - 1;
+	}
+
 	std::vector<vk::DescriptorSetLayoutBinding> resourcesLayouts;
-	std::vector<ImageHandle> textures;
 	for (const auto& resource : description.instanceResources) {
 		resourcesLayouts.push_back({ .binding = resource.binding,
 		                             .descriptorType = resource.type,
 		                             .descriptorCount = resource.count,
 		                             .stageFlags = resource.stage });
-		if (resource.type == vk::DescriptorType::eCombinedImageSampler) {
-			textures.push_back(m_resourceManager.loadImage(resource.path));
-		}
 	}
 	vk::DescriptorSetLayoutCreateInfo layoutInfo {
 
@@ -139,11 +212,16 @@ uint32_t MaterialManager::createMaterial(MaterialDescription& description) {
 		.device = m_device,
 		.vertex = description.vertex,
 		.fragment = description.fragment,
-		.layouts = { m_globalSets[0].layout, localLayout }
+		.layouts = { m_globalSets[0].layout,
+		             localLayout,
+		             m_instanceDataLayout },
+		.vertexFormat = description.vertexFormat,
+		.depthEqual = description.depthPrepass,
 	};
 	Pipeline pipeline = PipelineBuilder::DefaultPipeline(pipelineInfo);
 	m_materials.push_back(std::make_shared<Material>(Material {
 		.pipeline = pipeline,
+		.depthPipeline = createDepthPipeline(pipelineInfo, description),
 		.globalSet = m_globalSets[0],
 		.materialSet = {},
 		.instanceLayout = localLayout,
@@ -159,6 +237,22 @@ MaterialInstance MaterialManager::instantiateMaterial(
 	MaterialDescription& description
 ) {
 	Material& material = *m_materials[createMaterial(description)];
+	if (material.bindless) return instantiateBindless(description);
+
+	std::vector<ImageHandle> textures;
+	for (const auto& resource : description.instanceResources) {
+		if (resource.type == vk::DescriptorType::eCombinedImageSampler)
+			textures.push_back(m_placeholderTexture);
+	}
+
+	material.instanceSets.push_back(createInstanceSet(material, textures));
+	m_instanceTextures.push_back(textures);
+	return { (uint32_t)material.instanceSets.size() - 1 };
+}
+
+vk::DescriptorSet MaterialManager::createInstanceSet(
+	const Material& material, const std::vector<ImageHandle>& textures
+) {
 	vk::DescriptorSetAllocateInfo descriptorInfo {
 		.descriptorPool = m_pool,
 		.descriptorSetCount = 1,
@@ -167,38 +261,184 @@ MaterialInstance MaterialManager::instantiateMaterial(
 
 	vk::DescriptorSet set = m_device.allocateDescriptorSets(descriptorInfo)[0];
 
-	std::vector<vk::WriteDescriptorSet> writeInfos;
-
-	int binding = 0;
-	std::vector<ImageHandle> textures;
-	for (const auto& resource : description.instanceResources) {
-		if (resource.type == vk::DescriptorType::eCombinedImageSampler) {
-			textures.push_back(m_resourceManager.loadImage(resource.path));
-		}
-	}
+	std::vector<vk::DescriptorImageInfo> imageInfos;
 	for (const auto& texture : textures) {
-		Image& image = m_resourceManager.getImage(texture);
-		vk::DescriptorImageInfo imageInfo {
+		imageInfos.push_back({
 			.sampler = m_linearSampler,
-			.imageView = image.view,
-			.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal
-		};
+			.imageView = m_resourceManager.getImage(texture).view,
+			.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+		});
+	}
 
+	std::vector<vk::WriteDescriptorSet> writeInfos;
+	for (uint32_t binding = 0; binding < imageInfos.size(); binding++) {
 		writeInfos.push_back(vk::WriteDescriptorSet {
 			.dstSet = set,
-			.dstBinding = (uint32_t)(binding),
+			.dstBinding = binding,
 			.descriptorCount = 1,
 			.descriptorType = vk::DescriptorType::eCombinedImageSampler,
-			.pImageInfo = &imageInfo,
+			.pImageInfo = &imageInfos[binding],
 		});
-
-		binding++;
 	}
 
 	m_device.updateDescriptorSets(
 		writeInfos.size(), writeInfos.data(), 0, nullptr
 	);
+	return set;
+}
 
-	material.instanceSets.push_back(set);
-	return { (uint32_t)material.instanceSets.size() - 1 };
+void MaterialManager::setTexture(
+	MaterialInstance instance, uint32_t binding, ImageHandle texture
+) {
+	Material& material = *m_materials[0];
+	m_version++;
+
+	if (material.bindless) {
+		// The default material samples a single texture, its albedo
+		Buffer& table = m_resourceManager.getBuffer(m_materialTable);
+		reinterpret_cast<MaterialParameters*>(table.allocation.address
+		)[instance.instanceIndex]
+			.albedoTexture = addBindlessTexture(texture);
+		return;
+	}
+
+	// Frames in flight may still bind the current set, which is not update
+	// after bind, so the instance gets a new one. The old one stays
+	// allocated, each texture of an instance is only set once.
+	std::vector<ImageHandle>& textures =
+		m_instanceTextures[instance.instanceIndex];
+	textures[binding] = texture;
+	material.instanceSets[instance.instanceIndex] =
+		createInstanceSet(material, textures);
+}
+
+void MaterialManager::createBindlessSet() {
+	std::array<vk::DescriptorPoolSize, 2> sizes = {
+		vk::DescriptorPoolSize {
+			.type = vk::DescriptorType::eCombinedImageSampler,
+			.descriptorCount = MAX_BINDLESS_TEXTURES,
+		},
+		vk::DescriptorPoolSize {
+			.type = vk::DescriptorType::eStorageBuffer,
+			.descriptorCount = 1,
+		},
+	};
+	m_bindlessPool = m_device.createDescriptorPool({
+		.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+		.maxSets = 1,
+		.poolSizeCount = (uint32_t)sizes.size(),
+		.pPoolSizes = sizes.data(),
+	});
+
+	std::array<vk::DescriptorSetLayoutBinding, 2> bindings {
+		vk::DescriptorSetLayoutBinding {
+			.binding = 0,
+			.descriptorType = vk::DescriptorType::eCombinedImageSampler,
+			.descriptorCount = MAX_BINDLESS_TEXTURES,
+			.stageFlags = vk::ShaderStageFlagBits::eFragment |
+			              vk::ShaderStageFlagBits::eCompute,
+		},
+		vk::DescriptorSetLayoutBinding {
+			.binding = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.descriptorCount = 1,
+			.stageFlags = vk::ShaderStageFlagBits::eFragment |
+			              vk::ShaderStageFlagBits::eCompute,
+		},
+	};
+	// Textures are written as they become resident, while frames using the
+	// set are in flight, and slots past the last one stay empty
+	std::array<vk::DescriptorBindingFlags, 2> bindingFlags {
+		vk::DescriptorBindingFlagBits::ePartiallyBound |
+			vk::DescriptorBindingFlagBits::eUpdateAfterBind,
+		vk::DescriptorBindingFlags {},
+	};
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo flagsInfo {
+		.bindingCount = (uint32_t)bindingFlags.size(),
+		.pBindingFlags = bindingFlags.data(),
+	};
+	m_bindlessSet.layout = m_device.createDescriptorSetLayout({
+		.pNext = &flagsInfo,
+		.flags =
+			vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool,
+		.bindingCount = (uint32_t)bindings.size(),
+		.pBindings = bindings.data(),
+	});
+
+	m_bindlessSet.set = m_device.allocateDescriptorSets({
+		.descriptorPool = m_bindlessPool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &m_bindlessSet.layout,
+	})[0];
+
+	m_materialTable = m_resourceManager.createBuffer(
+		"material_table",
+		{
+			.size = MAX_BINDLESS_MATERIALS * sizeof(MaterialParameters),
+			.usage = vk::BufferUsageFlagBits::eStorageBuffer,
+			.location = AllocationLocation::Host,
+		}
+	);
+	Buffer& table = m_resourceManager.getBuffer(m_materialTable);
+	vk::DescriptorBufferInfo bufferInfo {
+		.buffer = table.buffer,
+		.offset = 0,
+		.range = table.size,
+	};
+	m_device.updateDescriptorSets(
+		vk::WriteDescriptorSet {
+			.dstSet = m_bindlessSet.set,
+			.dstBinding = 1,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &bufferInfo,
+		},
+		{}
+	);
+	addBindlessTexture(m_placeholderTexture);
+}
+
+uint32_t MaterialManager::addBindlessTexture(ImageHandle texture) {
+	if (m_bindlessTextures.contains(texture.value))
+		return m_bindlessTextures[texture.value];
+	assert(m_textureCount < MAX_BINDLESS_TEXTURES);
+
+	Image& image = m_resourceManager.getImage(texture);
+	vk::DescriptorImageInfo imageInfo {
+		.sampler = m_linearSampler,
+		.imageView = image.view,
+		.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal
+	};
+	m_device.updateDescriptorSets(
+		vk::WriteDescriptorSet {
+			.dstSet = m_bindlessSet.set,
+			.dstBinding = 0,
+			.dstArrayElement = m_textureCount,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eCombinedImageSampler,
+			.pImageInfo = &imageInfo,
+		},
+		{}
+	);
+
+	m_bindlessTextures[texture.value] = m_textureCount;
+	return m_textureCount++;
+}
+
+MaterialInstance MaterialManager::instantiateBindless(
+	const MaterialDescription& description
+) {
+	assert(m_materialCount < MAX_BINDLESS_MATERIALS);
+
+	MaterialParameters parameters {
+		.albedoTexture = addBindlessTexture(m_placeholderTexture),
+		.padding = {},
+		.baseColor = glm::vec4(1.f),
+	};
+
+	Buffer& table = m_resourceManager.getBuffer(m_materialTable);
+	reinterpret_cast<MaterialParameters*>(table.allocation.address
+	)[m_materialCount] = parameters;
+
+	return { m_materialCount++ };
 }
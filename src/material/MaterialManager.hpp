@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <glm/glm.hpp>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
@@ -31,6 +32,11 @@ private:
 	ResourceManager& m_resourceManager;
 
 	vk::Sampler m_linearSampler;
+	// 1x1 white image bound in place of textures until they are resident
+	ImageHandle m_placeholderTexture;
+	// Sampled images of each instance of a set based material, by binding
+	std::vector<std::vector<ImageHandle>> m_instanceTextures;
+	uint32_t m_version = 0;
 
 	// std::unordered_map<
 	// 	std::pair<std::filesystem::path, std::filesystem::path>,
@@ -39,14 +45,42 @@ private:
 
 	std::array<DescriptorSet, 3> m_globalSets;
 	BufferHandle m_cameraUBO;
+	// Push descriptor layout of INSTANCE_SET
+	vk::DescriptorSetLayout m_instanceDataLayout;
+
+	// Bindless mode: set 1 holds every texture in one array and the material
+	// table, allocated once from an update-after-bind pool
+	vk::DescriptorPool m_bindlessPool;
+	DescriptorSet m_bindlessSet;
+	BufferHandle m_materialTable;
+	uint32_t m_materialCount = 0;
+	uint32_t m_textureCount = 0;
+	// Slot of every image in the array, by ImageHandle::value, so shared
+	// textures take one slot
+	std::unordered_map<uint32_t, uint32_t> m_bindlessTextures;
 
 	uint32_t createMaterial(MaterialDescription& description);
+	vk::DescriptorSet createInstanceSet(
+		const Material& material, const std::vector<ImageHandle>& textures
+	);
+	void createBindlessSet();
+	uint32_t addBindlessTexture(ImageHandle texture);
+	MaterialInstance instantiateBindless(const MaterialDescription& description
+	);
 
 public:
 	MaterialManager(Instance& instance, ResourceManager& resourceManager);
 	void updateDescriptorSets(uint8_t currentFrame);
 
+	// Textures of the instance sample the placeholder until setTexture
 	MaterialInstance instantiateMaterial(MaterialDescription& description);
+	// Samples `texture`, whose copy must have completed, from the texture at
+	// `binding` of an instance
+	void setTexture(
+		MaterialInstance instance, uint32_t binding, ImageHandle texture
+	);
+	// Changes when the sets or textures bound by draws change
+	inline uint32_t getVersion() const { return m_version; }
 	inline std::shared_ptr<Material> getBaseMaterial() {
 		return m_materials[0];
 	}
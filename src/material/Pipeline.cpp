@@ -4,7 +4,10 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <glm/glm.hpp>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
@@ -12,6 +15,7 @@
 #include <vulkan/vulkan_structs.hpp>
 
 #include "Shader.hpp"
+#include "Vertex.hpp"
 
 struct PipelineStateCreateInfo {
 	inline vk::PipelineInputAssemblyStateCreateInfo inputAssembly() {
@@ -34,43 +38,88 @@ struct PipelineStateCreateInfo {
 	};
 	std::array<vk::VertexInputAttributeDescription, 3> vertexAttributes;
 	std::array<vk::VertexInputBindingDescription, 1> vertexBindings;
-	inline vk::PipelineVertexInputStateCreateInfo vertex() {
+	inline vk::PipelineVertexInputStateCreateInfo vertex(
+		VertexFormat format, bool positionsOnly
+	) {
+		uint32_t stride = positionsOnly ? getPositionStride(format)
+		                                : getVertexStride(format);
 		vertexBindings = {
 			vk::VertexInputBindingDescription {
 											   .binding = 0,
-											   .stride = 32,
+											   .stride = stride,
 											   .inputRate = vk::VertexInputRate::eVertex },
 		};
 
-		vertexAttributes = {
-			vk::VertexInputAttributeDescription {
-												 .location = 0,
-												 .binding = 0,
-												 .format = vk::Format::eR32G32B32Sfloat,
-												 .offset = 0  },
-			vk::VertexInputAttributeDescription {
-												 .location = 1,
-												 .binding = 0,
-												 .format = vk::Format::eR32G32B32Sfloat,
-												 .offset = 12 },
-
-			vk::VertexInputAttributeDescription { .location = 2,
-                                                 .binding = 0,
-                                                 .format =
-			                                          vk::Format::eR32G32Sfloat,
-                                                 .offset = 24 }
-		};
-
+		if (format == VertexFormat::Compact) {
+			vertexAttributes = {
+				vk::VertexInputAttributeDescription {
+													 .location = 0,
+													 .binding = 0,
+													 .format = vk::Format::eR16G16B16A16Unorm,
+													 .offset = offsetof(CompactVertex, position) },
+				vk::VertexInputAttributeDescription {
+													 .location = 1,
+													 .binding = 0,
+													 .format = vk::Format::eR16G16Snorm,
+													 .offset = offsetof(CompactVertex, normal)   },
+				vk::VertexInputAttributeDescription {
+													 .location = 2,
+													 .binding = 0,
+													 .format = vk::Format::eR16G16Sfloat,
+													 .offset = offsetof(CompactVertex, texcoord) }
+			};
+		} else {
+			vertexAttributes = {
+				vk::VertexInputAttributeDescription {
+													 .location = 0,
+													 .binding = 0,
+													 .format = vk::Format::eR32G32B32Sfloat,
+													 .offset = offsetof(Vertex, position) },
+				vk::VertexInputAttributeDescription {
+													 .location = 1,
+													 .binding = 0,
+													 .format = vk::Format::eR32G32B32Sfloat,
+													 .offset = offsetof(Vertex, normal)   },
+				vk::VertexInputAttributeDescription {
+													 .location = 2,
+													 .binding = 0,
+													 .format = vk::Format::eR32G32Sfloat,
+													 .offset = offsetof(Vertex, texcoord) }
+			};
+		}
+
+		// The position stream is tightly packed, position is at offset 0 in
+		// both layouts so its first attribute applies unchanged
 		vk::PipelineVertexInputStateCreateInfo info {
-			.vertexBindingDescriptionCount = 1,
+			.vertexBindingDescriptionCount = (uint32_t)vertexBindings.size(),
 			.pVertexBindingDescriptions = vertexBindings.data(),
-			.vertexAttributeDescriptionCount = 3,
+			.vertexAttributeDescriptionCount =
+				positionsOnly ? 1 : (uint32_t)vertexAttributes.size(),
 			.pVertexAttributeDescriptions = vertexAttributes.data()
 		};
 
 		return info;
 	};
 
+	// Vertex shader constant_id 0 selects the attribute decoding path.
+	vk::Bool32 compactVertices;
+	vk::SpecializationMapEntry vertexSpecializationEntry;
+	inline vk::SpecializationInfo vertexSpecialization(VertexFormat format) {
+		compactVertices = format == VertexFormat::Compact;
+		vertexSpecializationEntry = {
+			.constantID = 0,
+			.offset = 0,
+			.size = sizeof(vk::Bool32),
+		};
+
+		return {
+			.mapEntryCount = 1,
+			.pMapEntries = &vertexSpecializationEntry,
+			.dataSize = sizeof(vk::Bool32),
+			.pData = &compactVertices,
+		};
+	}
+
 	std::array<vk::DynamicState, 2> states;
 	inline vk::PipelineDynamicStateCreateInfo dynamicState() {
 		states[0] = vk::DynamicState::eViewport;
@@ -95,7 +144,9 @@ struct PipelineStateCreateInfo {
 	};
 
 	std::array<vk::PipelineColorBlendAttachmentState, 1> colorblendStates;
-	inline vk::PipelineColorBlendStateCreateInfo colorBlend() {
+	inline vk::PipelineColorBlendStateCreateInfo colorBlend(
+		uint32_t attachmentCount
+	) {
 		colorblendStates = {
 			vk::PipelineColorBlendAttachmentState {
 
@@ -105,7 +156,7 @@ struct PipelineStateCreateInfo {
 		};
 		return {
 
-			.attachmentCount = (uint32_t)colorblendStates.size(),
+			.attachmentCount = attachmentCount,
 			.pAttachments = colorblendStates.data(),
 		};
 	};
@@ -117,11 +168,12 @@ struct PipelineStateCreateInfo {
 		};
 	}
 
-	inline vk::PipelineDepthStencilStateCreateInfo depthStencil() {
+	inline vk::PipelineDepthStencilStateCreateInfo depthStencil(bool equal) {
 		return vk::PipelineDepthStencilStateCreateInfo {
 			.depthTestEnable = true,
-			.depthWriteEnable = true,
-			.depthCompareOp = vk::CompareOp::eLess,
+			.depthWriteEnable = !equal,
+			.depthCompareOp = equal ? vk::CompareOp::eEqual
+		                            : vk::CompareOp::eLess,
 			.depthBoundsTestEnable = false,
 			.stencilTestEnable = false,
 
@@ -130,30 +182,38 @@ struct PipelineStateCreateInfo {
 };
 
 vk::PipelineLayout getLayout(
-	vk::Device& device, std::vector<vk::DescriptorSetLayout> layouts
+	vk::Device& device,
+	std::vector<vk::DescriptorSetLayout> layouts,
+	std::vector<vk::PushConstantRange> ranges
 );
 
 Pipeline PipelineBuilder::DefaultPipeline(const PipelineBuildInfo& info) {
 	vk::GraphicsPipelineCreateInfo pipelineInfo;
 	PipelineStateCreateInfo helper;
 
+	auto specialization = helper.vertexSpecialization(info.vertexFormat);
+
 	// Shader Stages
 	std::vector<vk::PipelineShaderStageCreateInfo> shaderStages {
 		vk::PipelineShaderStageCreateInfo {
 										   .stage = vk::ShaderStageFlagBits::eVertex,
 										   .module = Shader::GetShader(info.device, info.vertex),
-										   .pName = "main" },
-		vk::PipelineShaderStageCreateInfo {
-										   .stage = vk::ShaderStageFlagBits::eFragment,
-										   .module = Shader::GetShader(info.device, info.fragment),
-										   .pName = "main" }
+										   .pName = "main",
+										   .pSpecializationInfo = &specialization },
 	};
+	if (!info.colorFormats.empty()) {
+		shaderStages.push_back({
+			.stage = vk::ShaderStageFlagBits::eFragment,
+			.module = Shader::GetShader(info.device, info.fragment),
+			.pName = "main",
+		});
+	}
 
 	pipelineInfo.flags = {};
 	pipelineInfo.stageCount = 1;
 	pipelineInfo.setStages(shaderStages);
 
-	auto vertex = helper.vertex();
+	auto vertex = helper.vertex(info.vertexFormat, info.positionsOnly);
 	pipelineInfo.pVertexInputState = &vertex;
 
 	auto assembly = helper.inputAssembly();
@@ -167,21 +227,21 @@ Pipeline PipelineBuilder::DefaultPipeline(const PipelineBuildInfo& info) {
 
 	auto multisampling = helper.multiSample();
 	pipelineInfo.pMultisampleState = &multisampling;
-	auto depthStencilState = helper.depthStencil();
+	auto depthStencilState = helper.depthStencil(info.depthEqual);
 	pipelineInfo.pDepthStencilState = &depthStencilState;
-	auto colorBlendState = helper.colorBlend();
+	assert(info.colorFormats.size() <= 1);
+	auto colorBlendState = helper.colorBlend(info.colorFormats.size());
 	pipelineInfo.pColorBlendState = &colorBlendState;
 
 	auto dynamicState = helper.dynamicState();
 	pipelineInfo.pDynamicState = &dynamicState;
 
-	pipelineInfo.layout = getLayout(info.device, info.layouts);
+	pipelineInfo.layout = getLayout(info.device, info.layouts, {});
 
 	pipelineInfo.renderPass = nullptr;
 	vk::PipelineRenderingCreateInfoKHR renderingInfo {
-		.colorAttachmentCount = 1,
-		.pColorAttachmentFormats =
-			std::array<vk::Format, 1> { vk::Format::eB8G8R8A8Unorm }.data(),
+		.colorAttachmentCount = (uint32_t)info.colorFormats.size(),
+		.pColorAttachmentFormats = info.colorFormats.data(),
 		.depthAttachmentFormat = vk::Format::eD16Unorm,
 
 	};
@@ -198,22 +258,44 @@ Pipeline PipelineBuilder::DefaultPipeline(const PipelineBuildInfo& info) {
 	return Pipeline(res.value, pipelineInfo.layout);
 }
 
-vk::PipelineLayout getLayout(
-	vk::Device& device, std::vector<vk::DescriptorSetLayout> layouts
+Pipeline PipelineBuilder::ComputePipeline(
+	const ComputePipelineBuildInfo& info
 ) {
-	std::array<vk::PushConstantRange, 1> ranges {
-		vk::PushConstantRange {
-							   .stageFlags = vk::ShaderStageFlagBits::eVertex,
-							   .offset = 0,
-							   .size = 64,
-							   }
+	std::vector<vk::PushConstantRange> ranges;
+	if (info.pushConstantSize > 0) {
+		ranges.push_back({
+			.stageFlags = vk::ShaderStageFlagBits::eCompute,
+			.offset = 0,
+			.size = info.pushConstantSize,
+		});
+	}
+
+	vk::ComputePipelineCreateInfo pipelineInfo {
+		.stage = {
+			.stage = vk::ShaderStageFlagBits::eCompute,
+			.module = Shader::GetShader(info.device, info.compute),
+			.pName = "main",
+			.pSpecializationInfo = info.specialization,
+		},
+		.layout = getLayout(info.device, info.layouts, ranges),
 	};
-	vk::PipelineLayoutCreateInfo info { .setLayoutCount =
-		                                    (uint32_t)layouts.size(),
-		                                .pSetLayouts = layouts.data(),
-		                                .pushConstantRangeCount = 1,
-		                                .pPushConstantRanges = ranges.data()
 
+	auto res =
+		info.device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+
+	return Pipeline(res.value, pipelineInfo.layout);
+}
+
+vk::PipelineLayout getLayout(
+	vk::Device& device,
+	std::vector<vk::DescriptorSetLayout> layouts,
+	std::vector<vk::PushConstantRange> ranges
+) {
+	vk::PipelineLayoutCreateInfo info {
+		.setLayoutCount = (uint32_t)layouts.size(),
+		.pSetLayouts = layouts.data(),
+		.pushConstantRangeCount = (uint32_t)ranges.size(),
+		.pPushConstantRanges = ranges.data(),
 	};
 	return device.createPipelineLayout(info);
 }
\ No newline at end of file
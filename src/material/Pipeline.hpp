@@ -8,6 +8,8 @@
 #include <vulkan/vulkan_handles.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#include "Vertex.hpp"
+
 struct Pipeline {
 	vk::Pipeline pipeline;
 	vk::PipelineLayout pipelineLayout;
@@ -25,7 +27,26 @@ public:
 		std::filesystem::path vertex;
 		std::filesystem::path fragment;
 		std::vector<vk::DescriptorSetLayout> layouts;
+		VertexFormat vertexFormat = VertexFormat::Full;
+		// Reads the position stream instead of whole vertices
+		bool positionsOnly = false;
+		// Depth only pipelines have no color attachment and no fragment
+		// stage
+		std::vector<vk::Format> colorFormats = { vk::Format::eB8G8R8A8Unorm };
+		// Depth was laid down by a depth only pipeline, test for equality
+		// without writing it again
+		bool depthEqual = false;
+	};
+
+	struct ComputePipelineBuildInfo {
+		vk::Device& device;
+
+		std::filesystem::path compute;
+		std::vector<vk::DescriptorSetLayout> layouts;
+		uint32_t pushConstantSize = 0;
+		const vk::SpecializationInfo* specialization = nullptr;
 	};
 
 	static Pipeline DefaultPipeline(const PipelineBuildInfo& info);
+	static Pipeline ComputePipeline(const ComputePipelineBuildInfo& info);
 };
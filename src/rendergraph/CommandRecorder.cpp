@@ -0,0 +1,158 @@
+#include "CommandRecorder.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
+
+CommandRecorder::CommandRecorder(Instance& instance, ThreadPool& threadPool) :
+	m_device(instance.device), m_threadPool(threadPool) {
+	uint32_t familyIndex = instance.queueFamiliesIndices.graphicsIndex;
+	for (auto& slots : m_slots) {
+		slots.resize(m_threadPool.size());
+		for (Slot& slot : slots) {
+			slot.pool = m_device.createCommandPool({
+				.flags = vk::CommandPoolCreateFlagBits::eTransient,
+				.queueFamilyIndex = familyIndex,
+			});
+		}
+	}
+	for (auto& pools : m_cachePools) {
+		for (uint32_t i = 0; i < m_threadPool.size(); i++) {
+			pools.push_back(m_device.createCommandPool({
+				.flags =
+					vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+				.queueFamilyIndex = familyIndex,
+			}));
+		}
+	}
+}
+
+CommandRecorder::~CommandRecorder() {
+	for (auto& slots : m_slots) {
+		for (Slot& slot : slots) m_device.destroyCommandPool(slot.pool);
+	}
+	for (auto& pools : m_cachePools) {
+		for (vk::CommandPool pool : pools) m_device.destroyCommandPool(pool);
+	}
+}
+
+void CommandRecorder::beginFrame(uint8_t frame) {
+	m_frame = frame;
+	for (Slot& slot : m_slots[frame]) {
+		m_device.resetCommandPool(slot.pool);
+		slot.used = 0;
+	}
+}
+
+uint32_t CommandRecorder::getChunkCount(
+	uint32_t count, uint32_t minChunkSize
+) const {
+	return std::clamp<uint32_t>(
+		count / std::max(minChunkSize, 1u), 1, m_threadPool.size()
+	);
+}
+
+void CommandRecorder::record(
+	const std::vector<vk::CommandBuffer>& buffers,
+	uint32_t count,
+	vk::CommandBufferUsageFlags flags,
+	const vk::CommandBufferInheritanceRenderingInfoKHR& rendering,
+	const ChunkJob& job
+) {
+	uint32_t chunkSize = (count + buffers.size() - 1) / buffers.size();
+	vk::CommandBufferInheritanceInfo inheritance {
+		.pNext = &rendering,
+	};
+	m_threadPool.parallelFor(buffers.size(), [&](uint32_t chunk) {
+		vk::CommandBuffer commandBuffer = buffers[chunk];
+		commandBuffer.begin({
+			.flags = flags |
+			         vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+			.pInheritanceInfo = &inheritance,
+		});
+
+		uint32_t first = std::min(chunk * chunkSize, count);
+		job(commandBuffer, first, std::min(first + chunkSize, count));
+
+		commandBuffer.end();
+	});
+}
+
+std::vector<vk::CommandBuffer> CommandRecorder::recordRendering(
+	uint32_t count,
+	uint32_t minChunkSize,
+	const vk::CommandBufferInheritanceRenderingInfoKHR& rendering,
+	const ChunkJob& job
+) {
+	std::vector<Slot>& slots = m_slots[m_frame];
+
+	// Allocated up front, pools are only touched by their chunk afterwards
+	std::vector<vk::CommandBuffer> buffers(getChunkCount(count, minChunkSize));
+	for (uint32_t i = 0; i < buffers.size(); i++) {
+		Slot& slot = slots[i];
+		if (slot.used == slot.buffers.size()) {
+			slot.buffers.push_back(m_device.allocateCommandBuffers({
+				.commandPool = slot.pool,
+				.level = vk::CommandBufferLevel::eSecondary,
+				.commandBufferCount = 1,
+			})[0]);
+		}
+		buffers[i] = slot.buffers[slot.used++];
+	}
+
+	record(
+		buffers,
+		count,
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		rendering,
+		job
+	);
+	return buffers;
+}
+
+CommandRecorder::CacheHandle CommandRecorder::createCache() {
+	m_caches.emplace_back();
+	return m_caches.size() - 1;
+}
+
+std::vector<vk::CommandBuffer> CommandRecorder::recordCached(
+	CacheHandle cache,
+	uint64_t version,
+	uint32_t count,
+	uint32_t minChunkSize,
+	const vk::CommandBufferInheritanceRenderingInfoKHR& rendering,
+	const ChunkJob& job
+) {
+	CachedCommands& commands = m_caches[cache][m_frame];
+	if (!commands.recorded || commands.version != version) {
+		commands.chunkCount = getChunkCount(count, minChunkSize);
+		while (commands.buffers.size() < commands.chunkCount) {
+			commands.buffers.push_back(m_device.allocateCommandBuffers({
+				.commandPool = m_cachePools[m_frame][commands.buffers.size()],
+				.level = vk::CommandBufferLevel::eSecondary,
+				.commandBufferCount = 1,
+			})[0]);
+		}
+
+		// The previous recording of this frame section completed with its
+		// frame, beginning the buffers again resets them
+		std::vector<vk::CommandBuffer> buffers(
+			commands.buffers.begin(),
+			commands.buffers.begin() + commands.chunkCount
+		);
+		record(buffers, count, {}, rendering, job);
+
+		commands.recorded = true;
+		commands.version = version;
+	}
+
+	return { commands.buffers.begin(),
+		     commands.buffers.begin() + commands.chunkCount };
+}
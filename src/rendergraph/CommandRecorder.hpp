@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Instance.hpp"
+#include "ThreadPool.hpp"
+
+// Records secondary command buffers on the threads of a ThreadPool. Each
+// frame in flight has one command pool per chunk slot, a chunk is recorded
+// by a single thread so its pool needs no locking.
+//
+// Cached recordings are kept per frame in flight and replayed until the
+// version given by their task changes.
+class CommandRecorder {
+public:
+	struct Slot;
+	struct CachedCommands;
+
+	// Receives the command buffer of a chunk and its [first, end) range
+	using ChunkJob =
+		std::function<void(vk::CommandBuffer&, uint32_t first, uint32_t end)>;
+	using CacheHandle = uint32_t;
+
+private:
+	vk::Device& m_device;
+	ThreadPool& m_threadPool;
+	std::array<std::vector<Slot>, 3> m_slots;
+	// Buffers of cached recordings are reset one by one when re-recorded,
+	// chunk i of every cache is allocated from pool i
+	std::array<std::vector<vk::CommandPool>, 3> m_cachePools;
+	std::vector<std::array<CachedCommands, 3>> m_caches;
+	uint8_t m_frame = 0;
+
+	uint32_t getChunkCount(uint32_t count, uint32_t minChunkSize) const;
+	void record(
+		const std::vector<vk::CommandBuffer>& buffers,
+		uint32_t count,
+		vk::CommandBufferUsageFlags flags,
+		const vk::CommandBufferInheritanceRenderingInfoKHR& rendering,
+		const ChunkJob& job
+	);
+
+public:
+	CommandRecorder(Instance& instance, ThreadPool& threadPool);
+	// Frees every recorded buffer, none may be pending execution
+	~CommandRecorder();
+
+	// Recycles the command buffers of `frame`, whose last submission must
+	// have completed
+	void beginFrame(uint8_t frame);
+
+	// Splits `count` items in chunks of at least `minChunkSize`, at most one
+	// per thread, and records each in a secondary command buffer continuing
+	// the rendering described by `rendering`. Buffers are returned in chunk
+	// order, ready for executeCommands.
+	std::vector<vk::CommandBuffer> recordRendering(
+		uint32_t count,
+		uint32_t minChunkSize,
+		const vk::CommandBufferInheritanceRenderingInfoKHR& rendering,
+		const ChunkJob& job
+	);
+
+	CacheHandle createCache();
+	// Same as recordRendering, but the buffers recorded in this frame
+	// section are replayed as long as `version` does not change
+	std::vector<vk::CommandBuffer> recordCached(
+		CacheHandle cache,
+		uint64_t version,
+		uint32_t count,
+		uint32_t minChunkSize,
+		const vk::CommandBufferInheritanceRenderingInfoKHR& rendering,
+		const ChunkJob& job
+	);
+};
+
+struct CommandRecorder::Slot {
+	vk::CommandPool pool;
+	std::vector<vk::CommandBuffer> buffers;
+	// Buffers handed out since the pool was reset
+	uint32_t used = 0;
+};
+
+struct CommandRecorder::CachedCommands {
+	bool recorded = false;
+	uint64_t version = 0;
+	uint32_t chunkCount = 0;
+	// One per chunk recorded so far, only the first chunkCount are current
+	std::vector<vk::CommandBuffer> buffers;
+};
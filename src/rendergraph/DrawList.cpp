@@ -0,0 +1,125 @@
+#include "DrawList.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+static_assert(
+	DrawList::PIPELINE_BITS + DrawList::MATERIAL_BITS +
+		DrawList::INDEX_TYPE_BITS + DrawList::MESH_BITS +
+		DrawList::DEPTH_BITS ==
+	64
+);
+
+constexpr uint32_t RADIX_BITS = 8;
+constexpr uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+
+// Above this share of changed keys a full sort is cheaper than moving them
+// one by one
+constexpr uint32_t INCREMENTAL_DIVISOR = 16;
+
+namespace {
+
+uint64_t packField(uint64_t key, uint32_t value, uint32_t bits) {
+	uint32_t maxValue = (1u << bits) - 1;
+	return key << bits | std::min(value, maxValue);
+}
+
+}  // namespace
+
+uint64_t DrawList::MakeKey(
+	uint32_t pipeline,
+	uint32_t material,
+	uint32_t indexType,
+	uint32_t mesh,
+	float depth
+) {
+	// Bits of positive floats sort like their values, the top ones keep
+	// the exponent and most of the mantissa
+	uint32_t depthBits =
+		std::bit_cast<uint32_t>(std::max(depth, 0.f)) >> (32 - DEPTH_BITS);
+
+	uint64_t key = 0;
+	key = packField(key, pipeline, PIPELINE_BITS);
+	key = packField(key, material, MATERIAL_BITS);
+	key = packField(key, indexType, INDEX_TYPE_BITS);
+	key = packField(key, mesh, MESH_BITS);
+	key = packField(key, depthBits, DEPTH_BITS);
+	return key;
+}
+
+void DrawList::radixSort() {
+	m_scratch.resize(m_draws.size());
+
+	// Least significant digit first, each pass is stable
+	for (uint32_t shift = 0; shift < 64; shift += RADIX_BITS) {
+		std::array<uint32_t, RADIX_SIZE> offsets {};
+		for (const Draw& draw : m_draws)
+			offsets[(draw.key >> shift) & (RADIX_SIZE - 1)]++;
+
+		// Digits shared by every key, typically the pipeline, leave the
+		// order unchanged
+		if (std::find(offsets.begin(), offsets.end(), m_draws.size()) !=
+		    offsets.end())
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t& count : offsets) {
+			uint32_t digitCount = count;
+			count = offset;
+			offset += digitCount;
+		}
+		for (const Draw& draw : m_draws)
+			m_scratch[offsets[(draw.key >> shift) & (RADIX_SIZE - 1)]++] = draw;
+		std::swap(m_draws, m_scratch);
+	}
+}
+
+void DrawList::insertionSort() {
+	for (uint32_t i = 1; i < m_draws.size(); i++) {
+		Draw draw = m_draws[i];
+		uint32_t j = i;
+		for (; j > 0 && m_draws[j - 1].key > draw.key; j--)
+			m_draws[j] = m_draws[j - 1];
+		m_draws[j] = draw;
+	}
+}
+
+bool DrawList::update(
+	const std::vector<uint32_t>& visible,
+	const std::function<uint64_t(uint32_t)>& getKey
+) {
+	if (visible == m_visible && !m_draws.empty()) {
+		uint32_t changed = 0;
+		for (Draw& draw : m_draws) {
+			uint64_t key = getKey(draw.primitive);
+			changed += key != draw.key;
+			draw.key = key;
+		}
+		if (changed == 0) return false;
+
+		if (changed <= m_draws.size() / INCREMENTAL_DIVISOR)
+			insertionSort();
+		else
+			radixSort();
+	} else {
+		m_visible = visible;
+		m_draws.clear();
+		for (uint32_t primitive : visible)
+			m_draws.push_back({ getKey(primitive), primitive });
+		radixSort();
+	}
+
+	// Keys also change when only the distances do, the order often
+	// survives it
+	bool orderChanged = m_primitives.size() != m_draws.size();
+	m_primitives.resize(m_draws.size());
+	for (uint32_t i = 0; i < m_draws.size(); i++) {
+		orderChanged |= m_primitives[i] != m_draws[i].primitive;
+		m_primitives[i] = m_draws[i].primitive;
+	}
+	return orderChanged;
+}
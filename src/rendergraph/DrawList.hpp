@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Visible primitives ordered by a packed 64 bit key. From the most to the
+// least significant bits the key holds the pipeline, material instance,
+// index type, mesh and quantized distance, so draws sharing state end up
+// next to each other and each mesh is drawn front to back.
+//
+// The list is radix sorted when the visible set changes. When it stays the
+// same and only a few keys moved, the previous order is repaired with an
+// insertion sort instead.
+class DrawList {
+public:
+	struct Draw;
+
+	static constexpr uint32_t PIPELINE_BITS = 4;
+	static constexpr uint32_t MATERIAL_BITS = 14;
+	static constexpr uint32_t INDEX_TYPE_BITS = 1;
+	static constexpr uint32_t MESH_BITS = 21;
+	static constexpr uint32_t DEPTH_BITS = 24;
+
+private:
+	std::vector<Draw> m_draws;
+	std::vector<Draw> m_scratch;
+	// Primitive indices in draw order
+	std::vector<uint32_t> m_primitives;
+	// Visible list the draws were built from
+	std::vector<uint32_t> m_visible;
+
+	void radixSort();
+	void insertionSort();
+
+public:
+	// Fields wider than their bits are clamped, depth is the distance to
+	// the camera
+	static uint64_t MakeKey(
+		uint32_t pipeline,
+		uint32_t material,
+		uint32_t indexType,
+		uint32_t mesh,
+		float depth
+	);
+
+	// Returns whether the primitives or their order changed, not only
+	// their keys
+	bool update(
+		const std::vector<uint32_t>& visible,
+		const std::function<uint64_t(uint32_t)>& getKey
+	);
+
+	inline const std::vector<uint32_t>& getPrimitives() const {
+		return m_primitives;
+	}
+	inline const std::vector<Draw>& getDraws() const { return m_draws; }
+};
+
+struct DrawList::Draw {
+	uint64_t key;
+	uint32_t primitive;
+};
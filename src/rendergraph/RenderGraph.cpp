@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <queue>
@@ -21,14 +22,38 @@
 #include "resources/ResourceManager.hpp"
 
 RenderGraph::RenderGraph(
-	Instance& instance, Swapchain& swapchain, ResourceManager& resourceManager
+	Instance& instance,
+	Swapchain& swapchain,
+	ResourceManager& resourceManager,
+	ThreadPool& threadPool
 ) :
 	m_instance(instance),
 	m_swapchain(swapchain),
-	m_resourceManager(resourceManager) {
+	m_resourceManager(resourceManager),
+	m_recorder(instance, threadPool) {
 	m_mainQueue = m_instance.device.getQueue(
 		m_instance.queueFamiliesIndices.graphicsIndex, 0
 	);
+	m_computeQueue = m_instance.device.getQueue(
+		m_instance.queueFamiliesIndices.computeIndex, 0
+	);
+	for (auto& pool : m_computePools) {
+		pool = m_instance.device.createCommandPool({
+			.flags = vk::CommandPoolCreateFlagBits::eTransient,
+			.queueFamilyIndex = m_instance.queueFamiliesIndices.computeIndex,
+		});
+	}
+	// Without them every task runs on the graphics queue, in one batch
+	vk::SemaphoreTypeCreateInfo timelineInfo {
+		.semaphoreType = vk::SemaphoreType::eTimeline,
+		.initialValue = 0,
+	};
+	for (auto& timeline : m_timelines) {
+		if (!m_instance.features.timelineSemaphore) break;
+		timeline = m_instance.device.createSemaphore({
+			.pNext = &timelineInfo,
+		});
+	}
 
 	m_swapchainImages = {
 		m_resourceManager.registerImage(m_swapchain.getImage(0)),
@@ -38,6 +63,16 @@ RenderGraph::RenderGraph(
 
 	m_resourceManager.setName("result", m_swapchainImages[0]);
 }
+
+RenderGraph::~RenderGraph() {
+	for (auto& events : m_events) {
+		for (vk::Event event : events) m_instance.device.destroyEvent(event);
+	}
+	for (vk::Semaphore timeline : m_timelines)
+		m_instance.device.destroySemaphore(timeline);
+	for (vk::CommandPool pool : m_computePools)
+		m_instance.device.destroyCommandPool(pool);
+}
 void RenderGraph::addImage(
 	std::string_view name, const ResourceManager::ImageDescription& description
 ) {
@@ -51,14 +86,32 @@ void RenderGraph::addBuffer(
 	m_internalResources.insert(name);
 	m_resourceManager.createBuffer(name, description);
 }
+constexpr vk::AccessFlags2 WRITE_ACCESSES =
+	vk::AccessFlagBits2::eShaderWrite |
+	vk::AccessFlagBits2::eColorAttachmentWrite |
+	vk::AccessFlagBits2::eDepthStencilAttachmentWrite |
+	vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eHostWrite |
+	vk::AccessFlagBits2::eMemoryWrite |
+	vk::AccessFlagBits2::eShaderStorageWrite;
+
 bool isWriteOperation(vk::AccessFlags2 flags) {
-	return flags & vk::AccessFlagBits2::eColorAttachmentWrite ||
-	       flags & vk::AccessFlagBits2::eDepthStencilAttachmentWrite ||
-	       flags & vk::AccessFlagBits2::eTransferWrite;
+	return bool(flags & WRITE_ACCESSES);
 }
 
+// Only reads following reads can overlap
 bool isBarrierNeeded(vk::AccessFlags2 current, vk::AccessFlags2 operation) {
-	return isWriteOperation(current) ^ isWriteOperation(operation);
+	return isWriteOperation(current) || isWriteOperation(operation);
+}
+
+vk::DependencyInfo getDependencyInfo(const Barriers& barriers) {
+	return vk::DependencyInfo {
+		.memoryBarrierCount = (uint32_t)barriers.memoryBarriers.size(),
+		.pMemoryBarriers = barriers.memoryBarriers.data(),
+		.bufferMemoryBarrierCount = (uint32_t)barriers.bufferBarriers.size(),
+		.pBufferMemoryBarriers = barriers.bufferBarriers.data(),
+		.imageMemoryBarrierCount = (uint32_t)barriers.imageBarriers.size(),
+		.pImageMemoryBarriers = barriers.imageBarriers.data(),
+	};
 }
 
 bool RenderGraph::addImageBarrier(
@@ -112,7 +165,13 @@ void RenderGraph::addMemoryBarriers(
 ) {
 	RegisteredTask& task = m_registeredTask[taskName];
 
-	std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+	auto& imageBarriers = m_barriers.imageBarriers;
+	auto& bufferBarriers = m_barriers.bufferBarriers;
+	auto& memoryBarriers = m_barriers.memoryBarriers;
+	imageBarriers.clear();
+	bufferBarriers.clear();
+	memoryBarriers.clear();
+
 	for (auto& imageReference : task.images) {
 		Image& image = m_resourceManager.getNamedImage(imageReference.name);
 		uint8_t accessIndex = image.transient ? m_currentFrame : 0;
@@ -137,16 +196,17 @@ void RenderGraph::addMemoryBarriers(
 				image.accesses[accessIndex].layout
 			);
 	}
-	std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
 
 	for (auto& bufferReference : task.buffers) {
 		Buffer& buffer = m_resourceManager.getNamedBuffer(bufferReference.name);
 		uint8_t accessIndex = buffer.transient ? m_currentFrame : 0;
 
-		buffer.bufferAccess[accessIndex].accessStage =
-			bufferReference.usage.stage;
+		vk::PipelineStageFlags2 currentStage =
+			buffer.bufferAccess[accessIndex].accessStage;
 		vk::AccessFlags2 currentAccess =
 			buffer.bufferAccess[accessIndex].accessType;
+		buffer.bufferAccess[accessIndex].accessStage =
+			bufferReference.usage.stage;
 		buffer.bufferAccess[accessIndex].accessType =
 			bufferReference.usage.access;
 
@@ -155,8 +215,8 @@ void RenderGraph::addMemoryBarriers(
 			continue;
 
 		bufferBarriers.push_back(vk::BufferMemoryBarrier2 {
-			.srcStageMask = buffer.bufferAccess[accessIndex].accessStage,
-			.srcAccessMask = buffer.bufferAccess[accessIndex].accessType,
+			.srcStageMask = currentStage,
+			.srcAccessMask = currentAccess,
 			.dstStageMask = bufferReference.usage.stage,
 			.dstAccessMask = bufferReference.usage.access,
 			.buffer = buffer.buffer,
@@ -165,38 +225,110 @@ void RenderGraph::addMemoryBarriers(
 		});
 	}
 	if (task.barriers.has_value()) {
-		auto& localImageBarriers =
-			task.barriers.value()[m_currentFrame].imageBarriers;
+		const Barriers& localBarriers = task.barriers.value()[m_currentFrame];
 		imageBarriers.insert(
 			imageBarriers.end(),
-			localImageBarriers.begin(),
-			localImageBarriers.end()
+			localBarriers.imageBarriers.begin(),
+			localBarriers.imageBarriers.end()
 		);
-
-		auto& localBufferBarriers =
-			task.barriers.value()[m_currentFrame].bufferBarriers;
 		bufferBarriers.insert(
 			bufferBarriers.end(),
-			localBufferBarriers.begin(),
-			localBufferBarriers.end()
+			localBarriers.bufferBarriers.begin(),
+			localBarriers.bufferBarriers.end()
+		);
+		memoryBarriers.insert(
+			memoryBarriers.end(),
+			localBarriers.memoryBarriers.begin(),
+			localBarriers.memoryBarriers.end()
 		);
 	}
-	if (imageBarriers.size() == 0 && bufferBarriers.size() == 0) return;
 
-	commandBuffer.pipelineBarrier2(vk::DependencyInfo {
-		.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size(),
-		.pBufferMemoryBarriers = bufferBarriers.data(),
-		.imageMemoryBarrierCount = (uint32_t)imageBarriers.size(),
-		.pImageMemoryBarriers = imageBarriers.data(),
+	collapseBufferBarriers(m_barriers);
+	recordBarrier(commandBuffer, m_barriers);
+}
+
+void RenderGraph::recordBarrier(
+	vk::CommandBuffer& commandBuffer, const Barriers& barriers
+) {
+	if (barriers.imageBarriers.empty() && barriers.bufferBarriers.empty() &&
+	    barriers.memoryBarriers.empty())
+		return;
+
+	commandBuffer.pipelineBarrier2(getDependencyInfo(barriers));
+
+	m_barrierStatistics.pipelineBarriers++;
+	m_barrierStatistics.imageBarriers += barriers.imageBarriers.size();
+	m_barrierStatistics.bufferBarriers += barriers.bufferBarriers.size();
+	m_barrierStatistics.memoryBarriers += barriers.memoryBarriers.size();
+}
+
+void RenderGraph::waitEvents(
+	vk::CommandBuffer& commandBuffer, std::string_view taskName
+) {
+	RegisteredTask& task = m_registeredTask[taskName];
+	if (task.waits.empty()) return;
+
+	m_waitedEvents.clear();
+	m_waitedDependencies.clear();
+	for (uint32_t index : task.waits) {
+		const Barriers& barriers =
+			m_splitBarriers[index].barriers[m_currentFrame];
+		m_waitedEvents.push_back(m_events[m_currentFrame][index]);
+		m_waitedDependencies.push_back(getDependencyInfo(barriers));
+
+		m_barrierStatistics.imageBarriers += barriers.imageBarriers.size();
+		m_barrierStatistics.bufferBarriers += barriers.bufferBarriers.size();
+		m_barrierStatistics.memoryBarriers += barriers.memoryBarriers.size();
+	}
+	commandBuffer.waitEvents2(m_waitedEvents, m_waitedDependencies);
+	m_barrierStatistics.splitBarriers += task.waits.size();
+}
 
-	});
+// The dependency has to match the one waited on exactly
+void RenderGraph::setEvents(
+	vk::CommandBuffer& commandBuffer, std::string_view taskName
+) {
+	for (uint32_t index : m_registeredTask[taskName].signals) {
+		commandBuffer.setEvent2(
+			m_events[m_currentFrame][index],
+			getDependencyInfo(m_splitBarriers[index].barriers[m_currentFrame])
+		);
+	}
 }
 
-void RenderGraph::submit(const std::vector<Primitive>& primitives) {
+void RenderGraph::submit(
+	const std::vector<Primitive>& primitives,
+	const std::vector<uint32_t>& visible,
+	const std::vector<glm::mat4>& transforms,
+	const GlobalResources::Camera& camera,
+	uint64_t drawVersion
+) {
 	const Frame& frame = m_swapchain.getNextFrame();
 
-	auto _ = m_instance.device.waitForFences({ frame.fence }, vk::True, 1000);
+	// Command pools of the frame are reset, its last submission must be done
+	auto _ = m_instance.device.waitForFences(
+		{ frame.fence }, vk::True, std::numeric_limits<uint64_t>::max()
+	);
 	m_instance.device.resetFences(frame.fence);
+	m_instance.device.resetCommandPool(frame.commandPool);
+	if (m_frameComputeValues[m_currentFrame] > 0) {
+		auto _ = m_instance.device.waitSemaphores(
+			vk::SemaphoreWaitInfo {
+				.semaphoreCount = 1,
+				.pSemaphores = &m_timelines[1],
+				.pValues = &m_frameComputeValues[m_currentFrame],
+			},
+			std::numeric_limits<uint64_t>::max()
+		);
+		m_instance.device.resetCommandPool(m_computePools[m_currentFrame]);
+	}
+	// Cached graphs make toggling tasks cheap, only new task sets compile
+	if (m_rebuildNeeded) build(m_asyncCompute);
+	// Set by the last submissions of the frame, which are done
+	for (auto& event : m_events[m_currentFrame])
+		m_instance.device.resetEvent(event);
+	m_barrierStatistics = {};
+	m_recorder.beginFrame(m_currentFrame);
 
 	vk::AcquireNextImageInfoKHR acquireInfo;
 	acquireInfo.swapchain = m_swapchain.getSwapchain();
@@ -212,72 +344,91 @@ void RenderGraph::submit(const std::vector<Primitive>& primitives) {
 
 	m_resourceManager.setName("result", m_swapchainImages[imageIndex]);
 
-	vk::CommandBufferAllocateInfo commandInfo;
-
-	commandInfo.commandBufferCount = 1;
-	commandInfo.commandPool = frame.commandPool;
-	commandInfo.level = vk::CommandBufferLevel::ePrimary;
-
-	auto commandBuffer =
-		m_instance.device.allocateCommandBuffers(commandInfo)[0];
-	commandBuffer.begin(vk::CommandBufferBeginInfo {
-		.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
-	});
-
-	if (m_initializationBarriers.size() > 0) {
-		if (!m_initialized) {
-			commandBuffer.pipelineBarrier2(vk::DependencyInfo {
-				.imageMemoryBarrierCount =
-					(uint32_t)m_initializationBarriers.size(),
-				.pImageMemoryBarriers = m_initializationBarriers.data(),
-			});
-			m_initialized = true;
-		} else
-			m_uninitializedResources.clear();
-	}
-
 	const Resources resources {
 		.resourceManager = m_resourceManager,
 		.primitives = primitives,
+		.visible = visible,
+		.transforms = transforms,
+		.camera = camera,
+		.drawVersion = drawVersion,
 		.currentFrame = m_currentFrame,
+		.recorder = m_recorder,
 	};
 
-	for (auto& node : m_nodes) {
-		RegisteredTask& task = m_registeredTask[node];
+	std::swap(m_batchValues, m_previousBatchValues);
+	m_batchValues.resize(m_batches.size());
+	for (uint32_t index = 0; index < m_batches.size(); index++) {
+		const QueueBatch& batch = m_batches[index];
+		bool graphics = batch.queue == QueueAffinity::GRAPHICS;
+
+		auto commandBuffer =
+			m_instance.device.allocateCommandBuffers({
+				.commandPool = graphics ? frame.commandPool
+			                            : m_computePools[m_currentFrame],
+				.level = vk::CommandBufferLevel::ePrimary,
+				.commandBufferCount = 1,
+			})[0];
+		commandBuffer.begin(vk::CommandBufferBeginInfo {
+			.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		});
 
-		addMemoryBarriers(commandBuffer, node);
-		task.task->execute(commandBuffer, resources);
-	}
+		if (index == m_firstGraphicsBatch &&
+		    m_initializationBarriers.size() > 0) {
+			if (!m_initialized) {
+				commandBuffer.pipelineBarrier2(vk::DependencyInfo {
+					.imageMemoryBarrierCount =
+						(uint32_t)m_initializationBarriers.size(),
+					.pImageMemoryBarriers = m_initializationBarriers.data(),
+				});
+				m_barrierStatistics.pipelineBarriers++;
+				m_barrierStatistics.imageBarriers +=
+					m_initializationBarriers.size();
+				m_initialized = true;
+			} else
+				m_uninitializedResources.clear();
+		}
 
-	vk::ImageMemoryBarrier2 presentBarrier;
-	ImageDependencyInfo presentDependency {
-		.name = "result",
-		.usage = {
-			.type = ResourceUsage::Type::READ,
-			.access = vk::AccessFlagBits2::eNone,
-			.stage = vk::PipelineStageFlagBits2::eNone,
-		},
-		.requiredLayout = vk::ImageLayout::ePresentSrcKHR,
-	};
-	addImageBarrier(presentDependency, presentBarrier);
-
-	commandBuffer.pipelineBarrier2(vk::DependencyInfo {
-		.imageMemoryBarrierCount = 1,
-		.pImageMemoryBarriers = &presentBarrier,
-	});
-
-	commandBuffer.end();
-	vk::SubmitInfo submitInfo;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = { &frame.imageAvailable };
-	auto stage = vk::Flags(vk::PipelineStageFlagBits::eColorAttachmentOutput);
-	submitInfo.pWaitDstStageMask = { &stage };
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = { &commandBuffer };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = { &frame.renderFinished };
-
-	m_mainQueue.submit({ submitInfo }, { frame.fence });
+		for (uint32_t node = batch.firstTask;
+		     node < batch.firstTask + batch.taskCount;
+		     node++) {
+			RegisteredTask& task = m_registeredTask[m_nodes[node]];
+
+			waitEvents(commandBuffer, m_nodes[node]);
+			addMemoryBarriers(commandBuffer, m_nodes[node]);
+			task.task->execute(commandBuffer, resources);
+			setEvents(commandBuffer, m_nodes[node]);
+			if (task.releases.has_value()) {
+				recordBarrier(
+					commandBuffer, task.releases.value()[m_currentFrame]
+				);
+			}
+		}
+
+		if (index == m_lastGraphicsBatch) {
+			vk::ImageMemoryBarrier2 presentBarrier;
+			ImageDependencyInfo presentDependency {
+				.name = "result",
+				.usage = {
+					.type = ResourceUsage::Type::READ,
+					.access = vk::AccessFlagBits2::eNone,
+					.stage = vk::PipelineStageFlagBits2::eNone,
+				},
+				.requiredLayout = vk::ImageLayout::ePresentSrcKHR,
+			};
+			addImageBarrier(presentDependency, presentBarrier);
+
+			commandBuffer.pipelineBarrier2(vk::DependencyInfo {
+				.imageMemoryBarrierCount = 1,
+				.pImageMemoryBarriers = &presentBarrier,
+			});
+			m_barrierStatistics.pipelineBarriers++;
+			m_barrierStatistics.imageBarriers++;
+		}
+
+		commandBuffer.end();
+		submitBatch(index, commandBuffer, frame);
+	}
+	m_frameComputeValues[m_currentFrame] = m_timelineValues[1];
 
 	vk::PresentInfoKHR presentInfo {};
 	presentInfo.waitSemaphoreCount = 1;
@@ -293,6 +444,76 @@ void RenderGraph::submit(const std::vector<Primitive>& primitives) {
 	m_currentFrame = (m_currentFrame + 1) % 3;
 }
 
+void RenderGraph::submitBatch(
+	uint32_t index, vk::CommandBuffer& commandBuffer, const Frame& frame
+) {
+	const QueueBatch& batch = m_batches[index];
+	uint8_t queue = (uint8_t)batch.queue;
+
+	std::array<vk::SemaphoreSubmitInfo, 2> waits;
+	uint32_t waitCount = 0;
+	if (index == m_firstGraphicsBatch) {
+		waits[waitCount++] = {
+			.semaphore = frame.imageAvailable,
+			.stageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+		};
+	}
+	// Values of a timeline only grow, waiting on a batch of this frame
+	// covers the ones of the previous frame
+	std::optional<uint64_t> waitValue;
+	if (batch.wait.has_value())
+		waitValue = m_batchValues[batch.wait.value()];
+	else if (batch.previousFrameWait.has_value()) {
+		// The batches of the previous frame differ after a rebuild, all the
+		// work of the other queue is waited on
+		waitValue = m_previousBatchValues.size() == m_batches.size()
+		                ? m_previousBatchValues[batch.previousFrameWait.value()]
+		                : m_timelineValues[1 - queue];
+	}
+	if (waitValue.has_value()) {
+		waits[waitCount++] = {
+			.semaphore = m_timelines[1 - queue],
+			.value = waitValue.value(),
+			.stageMask = batch.waitStage,
+		};
+	}
+
+	std::array<vk::SemaphoreSubmitInfo, 2> signals;
+	uint32_t signalCount = 0;
+	if (m_instance.features.timelineSemaphore) {
+		m_batchValues[index] = ++m_timelineValues[queue];
+		signals[signalCount++] = {
+			.semaphore = m_timelines[queue],
+			.value = m_batchValues[index],
+			.stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+		};
+	}
+	bool last = index == m_lastGraphicsBatch;
+	if (last) {
+		signals[signalCount++] = {
+			.semaphore = frame.renderFinished,
+			.stageMask = vk::PipelineStageFlagBits2::eAllCommands,
+		};
+	}
+
+	vk::CommandBufferSubmitInfo commandInfo {
+		.commandBuffer = commandBuffer,
+	};
+	vk::Queue& submitQueue =
+		batch.queue == QueueAffinity::GRAPHICS ? m_mainQueue : m_computeQueue;
+	submitQueue.submit2(
+		vk::SubmitInfo2 {
+			.waitSemaphoreInfoCount = waitCount,
+			.pWaitSemaphoreInfos = waits.data(),
+			.commandBufferInfoCount = 1,
+			.pCommandBufferInfos = &commandInfo,
+			.signalSemaphoreInfoCount = signalCount,
+			.pSignalSemaphoreInfos = signals.data(),
+		},
+		last ? frame.fence : nullptr
+	);
+}
+
 void RenderGraph::addTask(std::string_view name, std::unique_ptr<Task> task) {
 	m_registeredTask[name] = RegisteredTask {
 		.task = std::move(task),
@@ -300,16 +521,51 @@ void RenderGraph::addTask(std::string_view name, std::unique_ptr<Task> task) {
 	m_builder.addTask(name, *m_registeredTask[name].task);
 }
 
-void RenderGraph::build() {
-	auto res = m_builder.build(m_internalResources, m_resourceManager);
+void RenderGraph::setTaskEnabled(std::string_view name, bool enabled) {
+	m_builder.setEnabled(name, enabled);
+	m_rebuildNeeded = true;
+}
+
+void RenderGraph::build(bool asyncCompute) {
+	// Submissions of the two queues are ordered with timeline semaphores
+	assert(!asyncCompute || m_instance.features.timelineSemaphore);
+	m_asyncCompute = asyncCompute;
+	m_rebuildNeeded = false;
+
+	const auto& families = m_instance.queueFamiliesIndices;
+	const GraphData& res = m_builder.build(
+		m_internalResources,
+		m_resourceManager,
+		{ families.graphicsIndex,
+	      asyncCompute ? families.computeIndex : families.graphicsIndex }
+	);
 	m_nodes.clear();
 	for (auto& taskData : res.tasks) {
 		m_nodes.push_back(taskData.name);
 		m_registeredTask[taskData.name].barriers = taskData.barrier;
+		m_registeredTask[taskData.name].signals = taskData.signals;
+		m_registeredTask[taskData.name].waits = taskData.waits;
+		m_registeredTask[taskData.name].releases = taskData.releases;
 		m_registeredTask[taskData.name].images = taskData.requiredImages;
 		m_registeredTask[taskData.name].buffers = taskData.requiredBuffers;
 	}
 
+	m_batches = res.batches;
+	m_firstGraphicsBatch = res.firstGraphicsBatch;
+	m_lastGraphicsBatch = res.lastGraphicsBatch;
+	m_batchValues.clear();
+	m_previousBatchValues.clear();
+
+	m_splitBarriers = res.splitBarriers;
+	for (auto& events : m_events) {
+		while (events.size() < m_splitBarriers.size())
+			events.push_back(m_instance.device.createEvent({}));
+	}
+
+	// Moves every section from its current layout to the one the graph
+	// leaves it in, which its first access expects
+	m_initializationBarriers.clear();
+	uint8_t currentFrame = m_currentFrame;
 	for (auto& [image, imageDependency] : res.requiredLayouts) {
 		vk::ImageMemoryBarrier2 barrier;
 
@@ -319,8 +575,7 @@ void RenderGraph::build() {
 				m_initializationBarriers.push_back(barrier);
 			}
 		}
-
-		m_currentFrame = 0;
 	}
+	m_currentFrame = currentFrame;
 	m_initialized = false;
 }
\ No newline at end of file
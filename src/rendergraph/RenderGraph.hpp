@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstdint>
+#include <glm/glm.hpp>
 #include <map>
 #include <set>
 #include <string_view>
@@ -12,8 +13,11 @@
 #include <vulkan/vulkan_handles.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#include "CommandRecorder.hpp"
 #include "RenderGraphBuilder.hpp"
 #include "Swapchain.hpp"
+#include "ThreadPool.hpp"
+#include "material/MaterialManager.hpp"
 #include "resources/ResourceManager.hpp"
 #include "tasks/Task.hpp"
 
@@ -21,7 +25,32 @@ struct Primitive;
 struct Resources {
 	ResourceManager& resourceManager;
 	const std::vector<Primitive>& primitives;
+	// Primitives surviving CPU culling, in draw order. Per draw data such as
+	// instances is indexed by the position in this list.
+	const std::vector<uint32_t>& visible;
+	// World transforms indexed by Primitive::transform
+	const std::vector<glm::mat4>& transforms;
+	const GlobalResources::Camera& camera;
+	// Changes when the primitives, their transforms, the visible list or
+	// the resources they use change. Camera movement alone keeps it, so
+	// passes also check what they derive from the camera, such as selected
+	// levels, before replaying draws recorded for a version.
+	uint64_t drawVersion;
 	uint8_t currentFrame;
+	// Records secondary command buffers of the current frame on worker
+	// threads
+	CommandRecorder& recorder;
+};
+
+// Synchronization recorded during a frame
+struct BarrierStatistics {
+	// pipelineBarrier2 calls
+	uint32_t pipelineBarriers = 0;
+	uint32_t imageBarriers = 0;
+	uint32_t bufferBarriers = 0;
+	uint32_t memoryBarriers = 0;
+	// Dependencies waited on through events
+	uint32_t splitBarriers = 0;
 };
 
 class RenderGraph {
@@ -36,6 +65,14 @@ private:
 	std::set<std::string_view> m_uninitializedResources;
 
 	std::vector<vk::ImageMemoryBarrier2> m_initializationBarriers;
+	std::vector<SplitBarrier> m_splitBarriers;
+	// One event per split barrier and frame
+	std::array<std::vector<vk::Event>, 3> m_events;
+	// Reused every task
+	Barriers m_barriers;
+	std::vector<vk::Event> m_waitedEvents;
+	std::vector<vk::DependencyInfo> m_waitedDependencies;
+	BarrierStatistics m_barrierStatistics;
 	bool m_initialized = false;
 
 	std::array<ImageHandle, 3> m_swapchainImages;
@@ -44,8 +81,26 @@ private:
 	Swapchain& m_swapchain;
 	ResourceManager& m_resourceManager;
 	vk::Queue m_mainQueue;
+	vk::Queue m_computeQueue;
+	// One per frame, on the async compute family
+	std::array<vk::CommandPool, 3> m_computePools;
+
+	// Consecutive tasks of a queue are submitted together. Every submission
+	// signals the timeline semaphore of its queue, which the other one waits
+	// on. Devices without timeline semaphores have none and a single batch.
+	std::vector<QueueBatch> m_batches;
+	uint32_t m_firstGraphicsBatch = 0;
+	uint32_t m_lastGraphicsBatch = 0;
+	std::array<vk::Semaphore, 2> m_timelines;
+	std::array<uint64_t, 2> m_timelineValues = { 0, 0 };
+	// Values signaled by the batches of this frame and of the previous one
+	std::vector<uint64_t> m_batchValues;
+	std::vector<uint64_t> m_previousBatchValues;
+	// Compute work of each frame, its fence only covers the graphics queue
+	std::array<uint64_t, 3> m_frameComputeValues = { 0, 0, 0 };
 
 	RenderGraphBuilder m_builder;
+	CommandRecorder m_recorder;
 
 	bool addImageBarrier(
 		ImageDependencyInfo& image, vk::ImageMemoryBarrier2& buffer
@@ -53,17 +108,31 @@ private:
 	void addMemoryBarriers(
 		vk::CommandBuffer& commandBuffer, std::string_view task
 	);
+	void recordBarrier(
+		vk::CommandBuffer& commandBuffer, const Barriers& barriers
+	);
+	void waitEvents(vk::CommandBuffer& commandBuffer, std::string_view task);
+	void setEvents(vk::CommandBuffer& commandBuffer, std::string_view task);
+	void submitBatch(
+		uint32_t batch, vk::CommandBuffer& commandBuffer, const Frame& frame
+	);
 
 	void buildGraph();
 
 	uint8_t m_currentFrame = 0;
+	// Arguments of the last build, a toggled task rebuilds with them
+	bool m_asyncCompute = false;
+	bool m_rebuildNeeded = false;
 
 public:
 	RenderGraph(
 		Instance& instance,
 		Swapchain& swapchain,
-		ResourceManager& resourceManager
+		ResourceManager& resourceManager,
+		ThreadPool& threadPool
 	);
+	// The device must be idle, scene reloads replace the graph
+	~RenderGraph();
 
 	void addImage(
 		std::string_view name,
@@ -76,13 +145,33 @@ public:
 	);
 
 	void addTask(std::string_view name, std::unique_ptr<Task> task);
-	void submit(const std::vector<Primitive>& primitives);
-	void build();
+	// Leaves a task out of the frames submitted next, the tasks only feeding
+	// it are culled with it
+	void setTaskEnabled(std::string_view name, bool enabled);
+	void submit(
+		const std::vector<Primitive>& primitives,
+		const std::vector<uint32_t>& visible,
+		const std::vector<glm::mat4>& transforms,
+		const GlobalResources::Camera& camera,
+		uint64_t drawVersion
+	);
+	// Tasks asking for it run on the async compute queue when the device
+	// has a separate compute family
+	void build(bool asyncCompute = false);
+
+	// Barriers of the last submitted frame
+	inline const BarrierStatistics& getBarrierStatistics() const {
+		return m_barrierStatistics;
+	}
 };
 
 struct RenderGraph::RegisteredTask {
 	std::unique_ptr<Task> task;
 	std::optional<std::array<Barriers, 3>> barriers;
+	// Indices in m_splitBarriers
+	std::vector<uint32_t> signals;
+	std::vector<uint32_t> waits;
+	std::optional<std::array<Barriers, 3>> releases;
 	std::vector<ImageDependencyInfo> images;
 	std::vector<BufferDependencyInfo> buffers;
-};
\ No newline at end of file
+};
@@ -3,9 +3,12 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <map>
 #include <optional>
 #include <queue>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_structs.hpp>
@@ -20,56 +23,254 @@ void RenderGraphBuilder::addTask(std::string_view name, Task& task) {
 
 	assert(!m_tasks.contains(name));
 
-	m_tasks[name] = { .name = name, .images = images, .buffers = buffers };
+	m_tasks[name] = {
+		.name = name,
+		.order = (uint32_t)m_tasks.size(),
+		.enabled = true,
+		.affinity = task.getQueueAffinity(),
+		.images = images,
+		.buffers = buffers,
+	};
+}
 
-	for (auto& image : images) {
-		if (!m_imageReferences.contains(image.name))
-			m_imageReferences[image.name] = std::vector<ResourceReference>();
+void RenderGraphBuilder::setEnabled(std::string_view name, bool enabled) {
+	assert(m_tasks.contains(name));
+	m_tasks[name].enabled = enabled;
+}
 
-		m_imageReferences[image.name].push_back({
-			.task = name,
-			.usage = image.usage,
-			.requiredLayout = image.requiredLayout,
-		});
+std::vector<const RenderGraphBuilder::RegisteredTask*>
+RenderGraphBuilder::getEnabledTasks() const {
+	std::vector<const RegisteredTask*> tasks;
+	for (auto& [name, task] : m_tasks)
+		if (task.enabled) tasks.push_back(&task);
+	std::sort(tasks.begin(), tasks.end(), [](auto* a, auto* b) {
+		return a->order < b->order;
+	});
+	return tasks;
+}
+
+// Only fed values without padding
+template <typename T>
+void appendValue(std::string& key, const T& value) {
+	key.append((const char*)&value, sizeof(T));
+}
+void appendString(std::string& key, std::string_view string) {
+	appendValue(key, string.size());
+	key.append(string);
+}
+
+// Accesses reading what the previous writer left. Writes without any of
+// them, like clears and copy destinations, do not depend on its contents.
+constexpr vk::AccessFlags2 READ_ACCESSES =
+	vk::AccessFlagBits2::eIndirectCommandRead |
+	vk::AccessFlagBits2::eIndexRead |
+	vk::AccessFlagBits2::eVertexAttributeRead |
+	vk::AccessFlagBits2::eUniformRead |
+	vk::AccessFlagBits2::eInputAttachmentRead |
+	vk::AccessFlagBits2::eShaderRead |
+	vk::AccessFlagBits2::eColorAttachmentRead |
+	vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+	vk::AccessFlagBits2::eTransferRead | vk::AccessFlagBits2::eHostRead |
+	vk::AccessFlagBits2::eMemoryRead |
+	vk::AccessFlagBits2::eShaderSampledRead |
+	vk::AccessFlagBits2::eShaderStorageRead;
+
+bool readsContents(const ResourceUsage& usage) {
+	return usage.type != ResourceUsage::Type::WRITE ||
+	       (usage.access & READ_ACCESSES);
+}
+
+// Covers what compile reads: which resources the tasks access and whether
+// they read or write them
+std::string RenderGraphBuilder::getOrderKey() const {
+	std::string key;
+	for (auto* task : getEnabledTasks()) {
+		appendString(key, task->name);
+		// Images and buffers live in separate namespaces
+		appendValue(key, task->images.size());
+		for (auto& image : task->images) {
+			appendString(key, image.name);
+			appendValue(key, image.usage.type);
+			appendValue(key, readsContents(image.usage));
+		}
+		appendValue(key, task->buffers.size());
+		for (auto& buffer : task->buffers) {
+			appendString(key, buffer.name);
+			appendValue(key, buffer.usage.type);
+			appendValue(key, readsContents(buffer.usage));
+		}
 	}
+	return key;
+}
 
-	for (auto& buffer : buffers) {
-		if (!m_bufferReferences.contains(buffer.name))
-			m_bufferReferences[buffer.name] = std::vector<ResourceReference>();
+// Adds what the barriers are built from: accesses, layouts, queues and the
+// internal resources they are recorded for
+std::string RenderGraphBuilder::getGraphKey(
+	const std::string& orderKey,
+	const std::set<std::string_view>& internalResources,
+	ResourceManager& resourceManager,
+	const std::array<uint32_t, 2>& queueFamilies
+) const {
+	std::string key = orderKey;
+	appendValue(key, queueFamilies);
+	for (auto* task : getEnabledTasks()) {
+		appendValue(key, task->affinity);
+		for (auto& image : task->images) {
+			appendValue(key, VkAccessFlags2(image.usage.access));
+			appendValue(key, VkPipelineStageFlags2(image.usage.stage));
+			appendValue(key, image.requiredLayout.has_value());
+			if (image.requiredLayout.has_value())
+				appendValue(key, image.requiredLayout.value());
+
+			bool internal = internalResources.contains(image.name);
+			appendValue(key, internal);
+			if (!internal) continue;
+			const Image& resource = resourceManager.getNamedImage(image.name);
+			appendValue(key, VkImage(resource.image));
+			appendValue(key, resource.transient);
+		}
+		for (auto& buffer : task->buffers) {
+			appendValue(key, VkAccessFlags2(buffer.usage.access));
+			appendValue(key, VkPipelineStageFlags2(buffer.usage.stage));
+
+			bool internal = internalResources.contains(buffer.name);
+			appendValue(key, internal);
+			if (!internal) continue;
+			const Buffer& resource =
+				resourceManager.getNamedBuffer(buffer.name);
+			appendValue(key, VkBuffer(resource.buffer));
+			appendValue(key, resource.transient);
+			appendValue(key, resource.bufferAccess.size());
+			for (auto& access : resource.bufferAccess) {
+				appendValue(key, VkDeviceSize(access.offset));
+				appendValue(key, VkDeviceSize(access.length));
+			}
+		}
+	}
+	return key;
+}
 
-		m_bufferReferences[buffer.name].push_back({
-			.task = name,
-			.usage = buffer.usage,
-		});
+std::vector<std::string_view> RenderGraphBuilder::compile() const {
+	// Nodes are numbered in registration order
+	std::vector<const RegisteredTask*> nodes = getEnabledTasks();
+
+	// Writers of the versions each node reads
+	std::vector<std::vector<uint32_t>> producers(nodes.size());
+
+	struct ResourceVersion {
+		// None until the first write of the frame
+		std::optional<uint32_t> writer;
+		// Read the last version of the previous frame
+		std::vector<uint32_t> previousFrameReaders;
+	};
+	std::unordered_map<std::string_view, ResourceVersion> images;
+	std::unordered_map<std::string_view, ResourceVersion> buffers;
+
+	// A task declaring a resource twice, once read and once written, reads
+	// the version before its own write
+	auto addAccess = [&](ResourceVersion& version,
+	                     uint32_t node,
+	                     const ResourceUsage& usage) {
+		if (readsContents(usage)) {
+			if (version.writer.has_value() && *version.writer != node)
+				producers[node].push_back(*version.writer);
+			else if (!version.writer.has_value())
+				version.previousFrameReaders.push_back(node);
+		}
+		if (usage.type != ResourceUsage::Type::READ) version.writer = node;
+	};
+
+	std::vector<uint32_t> outputWriters;
+	for (uint32_t node = 0; node < nodes.size(); node++) {
+		for (auto& image : nodes[node]->images) {
+			addAccess(images[image.name], node, image.usage);
+			if (image.name == OUTPUT_IMAGE) outputWriters.push_back(node);
+		}
+		for (auto& buffer : nodes[node]->buffers)
+			addAccess(buffers[buffer.name], node, buffer.usage);
+	}
+	// Reads before the first write of a frame depend on the last writer of
+	// the previous one
+	for (auto* versions : { &images, &buffers }) {
+		for (auto& [name, version] : *versions) {
+			if (!version.writer.has_value()) continue;
+			for (uint32_t reader : version.previousFrameReaders)
+				producers[reader].push_back(*version.writer);
+		}
 	}
+
+	std::vector<bool> live(nodes.size(), false);
+	std::vector<uint32_t> toVisit = outputWriters;
+	while (!toVisit.empty()) {
+		uint32_t node = toVisit.back();
+		toVisit.pop_back();
+		if (live[node]) continue;
+
+		live[node] = true;
+		toVisit.insert(
+			toVisit.end(), producers[node].begin(), producers[node].end()
+		);
+	}
+
+	std::vector<std::string_view> order;
+	for (uint32_t node = 0; node < nodes.size(); node++)
+		if (live[node]) order.push_back(nodes[node]->name);
+	return order;
 }
 
+// Only consecutive reads can overlap, writes wait for every earlier access
 bool isBarrierNeeded(
 	const ResourceUsage& previousUsage, const ResourceUsage& currentUsage
 ) {
-	if (currentUsage.type == ResourceUsage::Type::WRITE) return false;
-	if (currentUsage.type == ResourceUsage::Type::READ &&
-	    previousUsage.type == ResourceUsage::Type::READ)
-		return false;
+	return currentUsage.type != ResourceUsage::Type::READ ||
+	       previousUsage.type != ResourceUsage::Type::READ;
+}
+// A read following another one is only synchronized with the last write
+// through the barriers of the reads in between. Returns the usage to wait on
+// when `current` reads at a stage or through an access none of them covered,
+// the stages of those reads chain it to the write on any queue.
+std::optional<ResourceUsage> getReadDependency(
+	const std::vector<ResourceReference>& references,
+	const ResourceReference& current
+) {
+	uint32_t index = &current - references.data();
+	vk::PipelineStageFlags2 stages;
+	vk::AccessFlags2 accesses;
+	for (uint32_t step = 1; step < references.size(); step++) {
+		const ResourceReference& reference =
+			references[(index + references.size() - step) % references.size()];
+		if (reference.usage.type == ResourceUsage::Type::READ) {
+			stages |= reference.usage.stage;
+			accesses |= reference.usage.access;
+			continue;
+		}
 
-	return true;
+		if (!(current.usage.stage & ~stages) &&
+		    !(current.usage.access & ~accesses))
+			return std::nullopt;
+		return ResourceUsage {
+			.type = reference.usage.type,
+			.access = reference.usage.access,
+			.stage = reference.usage.stage | stages,
+		};
+	}
+	return std::nullopt;
 }
+
+// Barriers are filled even when not needed, queue ownership transfers are
+// recorded regardless
 bool buildBufferBarrier(
 	const ResourceUsage& previousUsage,
 	const ResourceUsage& currentUsage,
 	vk::BufferMemoryBarrier2& barrier
 ) {
-	bool barrierNeeded = isBarrierNeeded(previousUsage, currentUsage);
-
-	if (!barrierNeeded) return false;
-
 	barrier = {
 		.srcStageMask = previousUsage.stage,
 		.srcAccessMask = previousUsage.access,
 		.dstStageMask = currentUsage.stage,
 		.dstAccessMask = currentUsage.access,
 	};
-	return true;
+	return isBarrierNeeded(previousUsage, currentUsage);
 }
 bool buildImageBarrier(
 	const ResourceUsage& previousUsage,
@@ -78,12 +279,6 @@ bool buildImageBarrier(
 	const std::optional<vk::ImageLayout> currentLayout,
 	vk::ImageMemoryBarrier2& barrier
 ) {
-	bool barrierNeeded = isBarrierNeeded(previousUsage, currentUsage);
-
-	if (!barrierNeeded &&
-	    (previousLayout == currentLayout || !currentLayout.has_value()))
-		return false;
-
 	barrier = {
 		.srcStageMask = previousUsage.stage,
 		.srcAccessMask = previousUsage.access,
@@ -92,18 +287,102 @@ bool buildImageBarrier(
 		.oldLayout = previousLayout.value_or(vk::ImageLayout::eUndefined),
 		.newLayout = currentLayout.value_or(vk::ImageLayout::eUndefined)
 	};
-	return true;
+	return isBarrierNeeded(previousUsage, currentUsage) ||
+	       (previousLayout != currentLayout && currentLayout.has_value());
+}
+
+// Release and acquire halves of a barrier moving a resource between queue
+// families. The acquire starts at the stages the semaphore wait of the
+// consumer blocks.
+template <typename Barrier>
+std::pair<Barrier, Barrier> splitOwnershipTransfer(
+	const Barrier& barrier, uint32_t sourceFamily, uint32_t destinationFamily
+) {
+	Barrier release = barrier;
+	release.dstStageMask = vk::PipelineStageFlagBits2::eNone;
+	release.dstAccessMask = vk::AccessFlagBits2::eNone;
+	release.srcQueueFamilyIndex = sourceFamily;
+	release.dstQueueFamilyIndex = destinationFamily;
+
+	Barrier acquire = barrier;
+	acquire.srcStageMask = barrier.dstStageMask;
+	acquire.srcAccessMask = vk::AccessFlagBits2::eNone;
+	acquire.srcQueueFamilyIndex = sourceFamily;
+	acquire.dstQueueFamilyIndex = destinationFamily;
+	return { release, acquire };
+}
+
+void collapseBufferBarriers(Barriers& barriers) {
+	auto& bufferBarriers = barriers.bufferBarriers;
+	auto& memoryBarriers = barriers.memoryBarriers;
+	if (bufferBarriers.size() < 2 && memoryBarriers.empty()) return;
+
+	// Ownership transfers name their buffer
+	auto isTransfer = [](const vk::BufferMemoryBarrier2& barrier) {
+		return barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+	};
+	auto findMemoryBarrier = [&](const vk::BufferMemoryBarrier2& barrier) {
+		return std::find_if(
+			memoryBarriers.begin(),
+			memoryBarriers.end(),
+			[&](const vk::MemoryBarrier2& memoryBarrier) {
+				return memoryBarrier.srcStageMask == barrier.srcStageMask &&
+				       memoryBarrier.dstStageMask == barrier.dstStageMask;
+			}
+		);
+	};
+
+	// Buffer barriers are only collapsed with others sharing their stages,
+	// so no execution dependency is added
+	for (auto& barrier : bufferBarriers) {
+		if (isTransfer(barrier) ||
+		    findMemoryBarrier(barrier) != memoryBarriers.end())
+			continue;
+		auto sharingStages = std::count_if(
+			bufferBarriers.begin(),
+			bufferBarriers.end(),
+			[&](const vk::BufferMemoryBarrier2& other) {
+				return !isTransfer(other) &&
+				       other.srcStageMask == barrier.srcStageMask &&
+				       other.dstStageMask == barrier.dstStageMask;
+			}
+		);
+		if (sharingStages < 2) continue;
+
+		memoryBarriers.push_back({
+			.srcStageMask = barrier.srcStageMask,
+			.dstStageMask = barrier.dstStageMask,
+		});
+	}
+
+	std::erase_if(bufferBarriers, [&](const vk::BufferMemoryBarrier2& barrier) {
+		if (isTransfer(barrier)) return false;
+		auto memoryBarrier = findMemoryBarrier(barrier);
+		if (memoryBarrier == memoryBarriers.end()) return false;
+
+		memoryBarrier->srcAccessMask |= barrier.srcAccessMask;
+		memoryBarrier->dstAccessMask |= barrier.dstAccessMask;
+		return true;
+	});
 }
 
+// Barriers recorded at the same point, by resource
+struct PendingBarriers {
+	std::unordered_map<std::string_view, vk::ImageMemoryBarrier2> images;
+	std::unordered_map<std::string_view, vk::BufferMemoryBarrier2> buffers;
+
+	bool empty() const { return images.empty() && buffers.empty(); }
+	void merge(PendingBarriers& other) {
+		images.merge(other.images);
+		buffers.merge(other.buffers);
+		assert(other.empty());
+	}
+};
+
 std::optional<std::array<Barriers, 3>> buildBarrier(
-	const std::unordered_map<std::string_view, vk::ImageMemoryBarrier2>&
-		imageBarriers,
-	const std::unordered_map<std::string_view, vk::BufferMemoryBarrier2>&
-		bufferBarriers,
-	ResourceManager& resourceManager
+	const PendingBarriers& pending, ResourceManager& resourceManager
 ) {
-	if (imageBarriers.size() == 0 && bufferBarriers.size() == 0)
-		return std::nullopt;
+	if (pending.empty()) return std::nullopt;
 
 	std::array<Barriers, 3> barriers;
 	for (int i = 0; i < 3; i++) {
@@ -111,7 +390,7 @@ std::optional<std::array<Barriers, 3>> buildBarrier(
 
 		std::vector<vk::ImageMemoryBarrier2> compiledImageBarriers;
 
-		for (auto& [name, imageBarrier] : imageBarriers) {
+		for (auto& [name, imageBarrier] : pending.images) {
 			auto compiledBarrier = imageBarrier;
 			const auto& image = resourceManager.getNamedImage(name);
 			compiledBarrier.image = image.image;
@@ -129,7 +408,7 @@ std::optional<std::array<Barriers, 3>> buildBarrier(
 		}
 
 		std::vector<vk::BufferMemoryBarrier2> compiledBufferBarriers;
-		for (auto& [name, bufferBarrier] : bufferBarriers) {
+		for (auto& [name, bufferBarrier] : pending.buffers) {
 			auto compiledBarrier = bufferBarrier;
 			const auto& buffer = resourceManager.getNamedBuffer(name);
 			compiledBarrier.buffer = buffer.buffer;
@@ -143,137 +422,323 @@ std::optional<std::array<Barriers, 3>> buildBarrier(
 
 		barrier.imageBarriers = compiledImageBarriers;
 		barrier.bufferBarriers = compiledBufferBarriers;
+		collapseBufferBarriers(barrier);
 	}
 	return barriers;
 }
-GraphData RenderGraphBuilder::build(
+const GraphData& RenderGraphBuilder::build(
 	const std::set<std::string_view>& internalResources,
-	ResourceManager& resourceManager
+	ResourceManager& resourceManager,
+	const std::array<uint32_t, 2>& queueFamilies
 ) {
-	const auto sort = [](const ResourceReference& r1,
-	                     const ResourceReference& r2) {
-		return r1.usage.type < r2.usage.type;
+	std::string orderKey = getOrderKey();
+	std::string graphKey = getGraphKey(
+		orderKey, internalResources, resourceManager, queueFamilies
+	);
+	auto cached = m_graphs.find(graphKey);
+	if (cached != m_graphs.end()) return cached->second;
+
+	auto compiled = m_orders.find(orderKey);
+	if (compiled == m_orders.end())
+		compiled = m_orders.emplace(orderKey, compile()).first;
+	const std::vector<std::string_view>& order = compiled->second;
+
+	// Resources outside the graph are synchronized while recording from the
+	// last access of the frame, which could be on the other queue
+	auto isInternal = [&](const RegisteredTask& task) {
+		for (auto& image : task.images)
+			if (!internalResources.contains(image.name)) return false;
+		for (auto& buffer : task.buffers)
+			if (!internalResources.contains(buffer.name)) return false;
+		return true;
 	};
-
-	for (auto& [name, accesses] : m_imageReferences) {
-		std::sort(accesses.begin(), accesses.end(), sort);
+	bool asyncCompute = queueFamilies[0] != queueFamilies[1];
+	std::vector<QueueAffinity> queues(order.size(), QueueAffinity::GRAPHICS);
+	for (uint32_t position = 0; position < order.size(); position++) {
+		RegisteredTask& task = m_tasks[order[position]];
+		if (asyncCompute && task.affinity == QueueAffinity::ASYNC_COMPUTE &&
+		    isInternal(task))
+			queues[position] = QueueAffinity::ASYNC_COMPUTE;
 	}
 
-	for (auto& [name, accesses] : m_bufferReferences) {
-		std::sort(accesses.begin(), accesses.end(), sort);
+	// Accesses of the scheduled tasks in execution order. Each synchronizes
+	// with the one before it, the first with the last of the previous frame.
+	std::unordered_map<std::string_view, std::vector<ResourceReference>>
+		imageReferences;
+	std::unordered_map<std::string_view, std::vector<ResourceReference>>
+		bufferReferences;
+	// A task declaring a resource several times, like a read and a write of
+	// the same buffer, accesses it once with all of its usages
+	auto addReference = [](std::vector<ResourceReference>& references,
+	                       const ResourceReference& reference) {
+		if (references.empty() || references.back().task != reference.task) {
+			references.push_back(reference);
+			return;
+		}
+		ResourceReference& merged = references.back();
+		assert(
+			!merged.requiredLayout.has_value() ||
+			!reference.requiredLayout.has_value() ||
+			merged.requiredLayout == reference.requiredLayout
+		);
+		if (merged.usage.type != reference.usage.type)
+			merged.usage.type = ResourceUsage::Type::READ_WRITE;
+		merged.usage.access |= reference.usage.access;
+		merged.usage.stage |= reference.usage.stage;
+		if (!merged.requiredLayout.has_value())
+			merged.requiredLayout = reference.requiredLayout;
+	};
+	for (auto name : order) {
+		RegisteredTask& task = m_tasks[name];
+		for (auto& image : task.images) {
+			addReference(
+				imageReferences[image.name],
+				{
+					.task = name,
+					.usage = image.usage,
+					.requiredLayout = image.requiredLayout,
+				}
+			);
+		}
+		for (auto& buffer : task.buffers) {
+			addReference(
+				bufferReferences[buffer.name],
+				{
+					.task = name,
+					.usage = buffer.usage,
+				}
+			);
+		}
 	}
 
-	std::vector<TaskData> tasks;
-	std::set<std::string_view> visitedTasks;
-	std::queue<std::string_view> tasksToVisit;
-
-	for (auto reference : m_imageReferences["result"])
-		tasksToVisit.push(reference.task);
+	// First access of `task` and the one preceding it
+	auto getAccesses = [](const std::vector<ResourceReference>& references,
+	                      std::string_view task) {
+		uint32_t index = 0;
+		while (references[index].task != task) index++;
+		uint32_t previous =
+			index > 0 ? index - 1 : (uint32_t)references.size() - 1;
+		return std::pair(&references[previous], &references[index]);
+	};
 
-	while (!tasksToVisit.empty()) {
-		std::string_view taskName = tasksToVisit.front();
-		RegisteredTask& task = m_tasks[taskName];
-		tasksToVisit.pop();
-		if (visitedTasks.contains(taskName)) continue;
+	std::unordered_map<std::string_view, uint32_t> positions;
+	for (uint32_t i = 0; i < order.size(); i++) positions[order[i]] = i;
+
+	// Barriers whose producer ran right before the task or in the previous
+	// frame, and the ones whose producer ran earlier in the frame by its
+	// position
+	std::vector<PendingBarriers> localBarriers(order.size());
+	std::vector<std::map<uint32_t, PendingBarriers>> distantBarriers(
+		order.size()
+	);
+	std::vector<bool> previousFrameOnly(order.size(), true);
+	auto getPending = [&](uint32_t position,
+	                      uint32_t producer) -> PendingBarriers& {
+		if (producer >= position) return localBarriers[position];
+
+		previousFrameOnly[position] = false;
+		// Tasks of the other queue in between do not delay the barrier
+		for (uint32_t between = producer + 1; between < position; between++) {
+			if (queues[between] == queues[position])
+				return distantBarriers[position][producer];
+		}
+		return localBarriers[position];
+	};
 
-		std::unordered_map<std::string_view, vk::ImageMemoryBarrier2>
-			imageBarriers;
-		std::unordered_map<std::string_view, vk::BufferMemoryBarrier2>
-			bufferBarriers;
+	std::vector<PendingBarriers> releaseBarriers(order.size());
+	std::vector<std::vector<QueueDependency>> queueWaits(order.size());
+	// The acquire half of an ownership transfer cannot be merged before the
+	// semaphore wait of its task
+	auto addQueueWait = [&](uint32_t position,
+	                        uint32_t producer,
+	                        bool transient,
+	                        vk::PipelineStageFlags2 stage) {
+		previousFrameOnly[position] = false;
+		bool previousFrame = producer >= position;
+		// Sections of transient resources were last used three frames ago,
+		// whose submissions are waited on before recording
+		if (previousFrame && transient) return;
+
+		queueWaits[position].push_back({
+			.producer = producer,
+			.previousFrame = previousFrame,
+			.stage = stage,
+		});
+	};
 
-		std::vector<ImageDependencyInfo> images;
-		std::vector<BufferDependencyInfo> externalBuffers;
+	for (uint32_t position = 0; position < order.size(); position++) {
+		std::string_view name = order[position];
+		RegisteredTask& task = m_tasks[name];
 
-		visitedTasks.insert(taskName);
 		for (auto& image : task.images) {
-			auto& taskResourceAccesses = m_imageReferences[image.name];
-
-			int accessIndex = 0;
-			for (int i = 0; i < taskResourceAccesses.size(); i++) {
-				accessIndex = i;
-				auto& taskAccess = taskResourceAccesses[i];
-				tasksToVisit.push(taskAccess.task);
-				if (taskAccess.task == taskName) {
-					break;
-				}
-			}
-
-			images.push_back(image);
 			if (!internalResources.contains(image.name)) continue;
 
+			auto [previous, current] =
+				getAccesses(imageReferences[image.name], name);
+			uint32_t producer = positions[previous->task];
+			std::optional<ResourceUsage> readDependency;
+			if (!isBarrierNeeded(previous->usage, current->usage)) {
+				readDependency =
+					getReadDependency(imageReferences[image.name], *current);
+			}
 			vk::ImageMemoryBarrier2 barrier;
-			if (accessIndex > 0) {
-				if (buildImageBarrier(
-						taskResourceAccesses[accessIndex - 1].usage,
-						taskResourceAccesses[accessIndex].usage,
-						taskResourceAccesses[accessIndex - 1].requiredLayout,
-						taskResourceAccesses[accessIndex].requiredLayout,
-						barrier
-					)) {
-					imageBarriers[image.name] = barrier;
-				}
-			} else {
-				if (buildImageBarrier(
-						taskResourceAccesses.back().usage,
-						taskResourceAccesses[0].usage,
-						taskResourceAccesses.back().requiredLayout,
-						taskResourceAccesses[0].requiredLayout,
-						barrier
-					)) {
-					imageBarriers[image.name] = barrier;
-				}
+			bool barrierNeeded = buildImageBarrier(
+				readDependency.value_or(previous->usage),
+				current->usage,
+				previous->requiredLayout,
+				current->requiredLayout,
+				barrier
+			);
+
+			if (queues[producer] != queues[position]) {
+				auto [release, acquire] = splitOwnershipTransfer(
+					barrier,
+					queueFamilies[(uint8_t)queues[producer]],
+					queueFamilies[(uint8_t)queues[position]]
+				);
+				releaseBarriers[producer].images[image.name] = release;
+				localBarriers[position].images[image.name] = acquire;
+				addQueueWait(
+					position,
+					producer,
+					resourceManager.getNamedImage(image.name).transient,
+					current->usage.stage
+				);
+			} else if (barrierNeeded) {
+				getPending(position, producer).images[image.name] = barrier;
 			}
 		}
 		for (auto& buffer : task.buffers) {
-			auto& taskResourceAccesses = m_bufferReferences[buffer.name];
-
-			int accessIndex = 0;
-			for (int i = 0; i < taskResourceAccesses.size(); i++) {
-				accessIndex = i;
-				auto& taskAccess = taskResourceAccesses[i];
-				tasksToVisit.push(taskAccess.task);
-				if (taskAccess.task == taskName) {
-					break;
-				}
-			}
-
-			externalBuffers.push_back(buffer);
-
 			if (!internalResources.contains(buffer.name)) continue;
 
+			auto [previous, current] =
+				getAccesses(bufferReferences[buffer.name], name);
+			uint32_t producer = positions[previous->task];
+			std::optional<ResourceUsage> readDependency;
+			if (!isBarrierNeeded(previous->usage, current->usage)) {
+				readDependency =
+					getReadDependency(bufferReferences[buffer.name], *current);
+			}
 			vk::BufferMemoryBarrier2 barrier;
+			bool barrierNeeded = buildBufferBarrier(
+				readDependency.value_or(previous->usage),
+				current->usage,
+				barrier
+			);
+
+			if (queues[producer] != queues[position]) {
+				auto [release, acquire] = splitOwnershipTransfer(
+					barrier,
+					queueFamilies[(uint8_t)queues[producer]],
+					queueFamilies[(uint8_t)queues[position]]
+				);
+				releaseBarriers[producer].buffers[buffer.name] = release;
+				localBarriers[position].buffers[buffer.name] = acquire;
+				addQueueWait(
+					position,
+					producer,
+					resourceManager.getNamedBuffer(buffer.name).transient,
+					current->usage.stage
+				);
+			} else if (barrierNeeded) {
+				getPending(position, producer).buffers[buffer.name] = barrier;
+			}
+		}
+	}
 
-			if (accessIndex > 0) {
-				if (buildBufferBarrier(
-						taskResourceAccesses[accessIndex - 1].usage,
-						taskResourceAccesses[accessIndex].usage,
-						barrier
-					)) {
-					bufferBarriers[buffer.name] = barrier;
-				}
-			} else {
-				if (buildBufferBarrier(
-						taskResourceAccesses.back().usage,
-						taskResourceAccesses[0].usage,
-						barrier
-					)) {
-					bufferBarriers[buffer.name] = barrier;
-				}
+	GraphData graph;
+	std::vector<std::vector<uint32_t>> signals(order.size());
+	std::vector<std::vector<uint32_t>> waits(order.size());
+	// Position whose barrier the barriers of each task were merged into
+	std::vector<uint32_t> barrierPositions(order.size());
+	for (uint32_t position = 0; position < order.size(); position++) {
+		barrierPositions[position] = position;
+		PendingBarriers& pending = localBarriers[position];
+
+		// Distant producers only pay for an event when the task has no
+		// barrier to join
+		if (pending.empty()) {
+			for (auto& [producer, barriers] : distantBarriers[position]) {
+				signals[producer].push_back(graph.splitBarriers.size());
+				waits[position].push_back(graph.splitBarriers.size());
+				graph.splitBarriers.push_back({
+					.producer = order[producer],
+					.consumer = order[position],
+					.barriers =
+						buildBarrier(barriers, resourceManager).value(),
+				});
 			}
+			continue;
 		}
+		for (auto& [producer, barriers] : distantBarriers[position])
+			pending.merge(barriers);
+
+		// No task of this frame touched the resources yet, the barrier can
+		// join the one of the previous task on the same queue
+		if (position == 0 || !previousFrameOnly[position] ||
+		    queues[position - 1] != queues[position])
+			continue;
+		uint32_t previousPosition = barrierPositions[position - 1];
+		if (localBarriers[previousPosition].empty()) continue;
+
+		localBarriers[previousPosition].merge(pending);
+		barrierPositions[position] = previousPosition;
+	}
 
-		tasks.push_back({
-			.name = taskName,
+	for (uint32_t position = 0; position < order.size(); position++) {
+		RegisteredTask& task = m_tasks[order[position]];
+		graph.tasks.push_back({
+			.name = task.name,
+			.queue = queues[position],
 			.barrier =
-				buildBarrier(imageBarriers, bufferBarriers, resourceManager),
-			.requiredImages = images,
-			.requiredBuffers = externalBuffers,
+				buildBarrier(localBarriers[position], resourceManager),
+			.signals = signals[position],
+			.waits = waits[position],
+			.releases =
+				buildBarrier(releaseBarriers[position], resourceManager),
+			.queueWaits = queueWaits[position],
+			.requiredImages = task.images,
+			.requiredBuffers = task.buffers,
 		});
 	}
-	std::reverse(tasks.begin(), tasks.end());
-	std::unordered_map<std::string_view, ImageDependencyInfo> requiredLayouts;
 
-	for (auto& [name, references] : m_imageReferences) {
+	std::vector<uint32_t> taskBatches;
+	for (uint32_t position = 0; position < order.size(); position++) {
+		auto& batches = graph.batches;
+		if (batches.empty() || batches.back().queue != queues[position]) {
+			batches.push_back({
+				.queue = queues[position],
+				.firstTask = position,
+				.taskCount = 0,
+			});
+		}
+		batches.back().taskCount++;
+		taskBatches.push_back(batches.size() - 1);
+	}
+	for (uint32_t position = 0; position < order.size(); position++) {
+		QueueBatch& batch = graph.batches[taskBatches[position]];
+		for (auto& dependency : queueWaits[position]) {
+			uint32_t producer = taskBatches[dependency.producer];
+			auto& wait =
+				dependency.previousFrame ? batch.previousFrameWait : batch.wait;
+			wait = std::max(wait.value_or(0), producer);
+			batch.waitStage |= dependency.stage;
+		}
+	}
+	auto isGraphics = [](const QueueBatch& batch) {
+		return batch.queue == QueueAffinity::GRAPHICS;
+	};
+	auto firstGraphics = std::find_if(
+		graph.batches.begin(), graph.batches.end(), isGraphics
+	);
+	auto lastGraphics = std::find_if(
+		graph.batches.rbegin(), graph.batches.rend(), isGraphics
+	);
+	assert(firstGraphics != graph.batches.end());
+	graph.firstGraphicsBatch = firstGraphics - graph.batches.begin();
+	graph.lastGraphicsBatch = graph.batches.rend() - lastGraphics - 1;
+
+	for (auto& [name, references] : imageReferences) {
 		if (!internalResources.contains(name)) continue;
 		auto it = std::find_if(
 			references.rbegin(),
@@ -284,11 +749,11 @@ GraphData RenderGraphBuilder::build(
 		);
 		if (it == references.rend()) continue;
 
-		requiredLayouts[name] = {
+		graph.requiredLayouts[name] = {
 			.name = name,
 			.usage = it->usage,
 			.requiredLayout = it->requiredLayout,
 		};
 	}
-	return { tasks, requiredLayouts };
+	return m_graphs[graphKey] = std::move(graph);
 }
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <optional>
 #include <set>
+#include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
@@ -29,6 +30,13 @@ struct ResourceUsage {
 		       (type == Type::WRITE && b.type == ResourceUsage::Type::WRITE);
 	}
 };
+// Queue a task asks to run on, indexes the queue families given to the
+// builder
+enum class QueueAffinity : uint8_t {
+	GRAPHICS = 0,
+	ASYNC_COMPUTE = 1,
+};
+
 struct ResourceReference {
 	std::string_view task;
 	ResourceUsage usage;
@@ -49,41 +57,128 @@ struct BufferDependencyInfo {
 struct Barriers {
 	std::vector<vk::ImageMemoryBarrier2> imageBarriers;
 	std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+	std::vector<vk::MemoryBarrier2> memoryBarriers;
+};
+
+// Replaces buffer barriers sharing their stage masks with one global memory
+// barrier, which drivers handle without tracking every range
+void collapseBufferBarriers(Barriers& barriers);
+
+// Dependency whose producer ran earlier in the frame with independent tasks
+// after it. An event is set after the producer and waited on before the
+// consumer, so the tasks in between are not synchronized with either.
+struct SplitBarrier {
+	std::string_view producer;
+	std::string_view consumer;
+	std::array<Barriers, 3> barriers;
+};
+
+// Work of the other queue a task waits on through its timeline semaphore
+struct QueueDependency {
+	// Position of the producer in GraphData::tasks
+	uint32_t producer;
+	// The producer ran in the previous frame
+	bool previousFrame;
+	vk::PipelineStageFlags2 stage;
 };
 
 struct TaskData {
 	std::string_view name;
+	QueueAffinity queue;
+	// Recorded before the task, barriers of the following tasks may have been
+	// merged into it
 	std::optional<std::array<Barriers, 3>> barrier;
+	// Indices in GraphData::splitBarriers set after and waited on before the
+	// task
+	std::vector<uint32_t> signals;
+	std::vector<uint32_t> waits;
+	// Releases the resources the other queue uses next, recorded after the
+	// task. Their acquires are part of the barrier of the consumer.
+	std::optional<std::array<Barriers, 3>> releases;
+	std::vector<QueueDependency> queueWaits;
 	std::vector<ImageDependencyInfo> requiredImages;
 	std::vector<BufferDependencyInfo> requiredBuffers;
 };
 
+// Consecutive tasks of a queue, submitted together
+struct QueueBatch {
+	QueueAffinity queue;
+	// Range of GraphData::tasks
+	uint32_t firstTask;
+	uint32_t taskCount;
+	// Latest batches of the other queue waited on, in this frame and in the
+	// previous one
+	std::optional<uint32_t> wait;
+	std::optional<uint32_t> previousFrameWait;
+	vk::PipelineStageFlags2 waitStage;
+};
+
 struct GraphData {
 	std::vector<TaskData> tasks;
+	std::vector<QueueBatch> batches;
+	// Presentation waits on the first graphics batch and signals from the
+	// last, which records the copy to the swapchain image
+	uint32_t firstGraphicsBatch;
+	uint32_t lastGraphicsBatch;
 	std::unordered_map<std::string_view, ImageDependencyInfo> requiredLayouts;
+	std::vector<SplitBarrier> splitBarriers;
 };
 
+// Image the graph renders to, tasks not contributing to it are culled
+constexpr std::string_view OUTPUT_IMAGE = "result";
+
 class Task;
 class RenderGraphBuilder {
 private:
 	struct RegisteredTask;
 
-	std::unordered_map<std::string_view, std::vector<ResourceReference>>
-		m_imageReferences;
-	std::unordered_map<std::string_view, std::vector<ResourceReference>>
-		m_bufferReferences;
 	std::unordered_map<std::string_view, RegisteredTask> m_tasks;
+	// Built graphs, with their barriers and batches, keyed by everything
+	// build reads. Toggling tasks back and forth reuses the graph built for
+	// each set, a set seen for the first time is built in full.
+	std::unordered_map<std::string, GraphData> m_graphs;
+	// Execution orders keyed by the declarations compile reads, a graph only
+	// changing how resources are accessed skips compile but builds its
+	// barriers again
+	std::unordered_map<std::string, std::vector<std::string_view>> m_orders;
+
+	// Enabled tasks in registration order
+	std::vector<const RegisteredTask*> getEnabledTasks() const;
+	// Keys are the bytes of the values they cover, so lookups compare them
+	// in full and different graphs never share an entry
+	std::string getOrderKey() const;
+	std::string getGraphKey(
+		const std::string& orderKey,
+		const std::set<std::string_view>& internalResources,
+		ResourceManager& resourceManager,
+		const std::array<uint32_t, 2>& queueFamilies
+	) const;
 
 public:
 	void addTask(std::string_view name, Task& task);
-	GraphData build(
+	// Versions every resource in registration order, each write creating a
+	// new one read by the accesses after it, and culls the tasks the output
+	// does not depend on. Reads only see earlier versions, or the last one
+	// of the previous frame, so the live tasks keep their registration
+	// order and no cycle can form.
+	std::vector<std::string_view> compile() const;
+	// Disabled tasks are left out of the graphs built next
+	void setEnabled(std::string_view name, bool enabled);
+	// Tasks asking for async compute run on the compute family when it
+	// differs from the graphics one and they only use internal resources
+	const GraphData& build(
 		const std::set<std::string_view>& internalResources,
-		ResourceManager& resourceManager
+		ResourceManager& resourceManager,
+		const std::array<uint32_t, 2>& queueFamilies
 	);
 };
 
 struct RenderGraphBuilder::RegisteredTask {
 	std::string_view name;
+	// Tasks execute in the order they were added
+	uint32_t order;
+	bool enabled;
+	QueueAffinity affinity;
 	std::vector<ImageDependencyInfo> images;
 	std::vector<BufferDependencyInfo> buffers;
 };
\ No newline at end of file
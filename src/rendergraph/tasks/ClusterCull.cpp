@@ -0,0 +1,174 @@
+#include "ClusterCull.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "Primitive.hpp"
+#include "culling/Frustum.hpp"
+#include "material/Pipeline.hpp"
+#include "rendergraph/RenderGraph.hpp"
+
+struct CullConstants {
+	// World space planes, normals pointing inside
+	std::array<glm::vec4, 6> frustum;
+	glm::vec4 cameraPosition;
+};
+
+ClusterCull::ClusterCull(vk::Device& device, float lodThreshold) :
+	m_lodThreshold(lodThreshold) {
+	std::array<vk::DescriptorSetLayoutBinding, 5> bindings;
+	for (uint32_t i = 0; i < bindings.size(); i++) {
+		bindings[i] = {
+			.binding = i,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.descriptorCount = 1,
+			.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		};
+	}
+
+	m_layout = device.createDescriptorSetLayout({
+		.flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+		.bindingCount = (uint32_t)bindings.size(),
+		.pBindings = bindings.data(),
+	});
+
+	m_pipeline = PipelineBuilder::ComputePipeline({
+		.device = device,
+		.compute = "resources/shaders/cluster_cull.comp.spv",
+		.layouts = { m_layout },
+		.pushConstantSize = sizeof(CullConstants),
+	});
+}
+
+void ClusterCull::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	for (auto name : { "cluster_draws", "meshlet_buffer", "index_buffer" }) {
+		requiredBuffers.push_back({
+			.name = name,
+			.usage = {
+				.type = ResourceUsage::Type::READ,
+				.access = vk::AccessFlagBits2::eShaderStorageRead,
+				.stage = vk::PipelineStageFlagBits2::eComputeShader,
+			},
+		});
+	}
+
+	for (auto name : { "cluster_indices", "cluster_commands" }) {
+		requiredBuffers.push_back({
+			.name = name,
+			.usage = {
+				.type = ResourceUsage::Type::WRITE,
+				.access = vk::AccessFlagBits2::eShaderStorageWrite,
+				.stage = vk::PipelineStageFlagBits2::eComputeShader,
+			},
+		});
+	}
+}
+
+void ClusterCull::execute(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	if (resources.visible.empty()) return;
+
+	ResourceManager& resourceManager = resources.resourceManager;
+	uint8_t frame = resources.currentFrame;
+
+	Buffer& draws = resourceManager.getNamedBuffer("cluster_draws");
+	Buffer& clusterIndices = resourceManager.getNamedBuffer("cluster_indices");
+	Buffer& commands = resourceManager.getNamedBuffer("cluster_commands");
+
+	assert(
+		resources.visible.size() * sizeof(ClusterDraw) <=
+		draws.bufferAccess[frame].length
+	);
+
+	auto drawData = reinterpret_cast<ClusterDraw*>(
+		(std::byte*)draws.allocation.address + draws.bufferAccess[frame].offset
+	);
+	float viewportHeight =
+		resourceManager.getNamedImage("main_color").size.height;
+
+	// Each primitive owns a range large enough for its selected level
+	uint32_t outputOffset = 0;
+	for (uint32_t i = 0; i < resources.visible.size(); i++) {
+		const Primitive& primitive =
+			resources.primitives[resources.visible[i]];
+		const glm::mat4& model = resources.transforms[primitive.transform];
+		const PrimitiveLod& lod = primitive.lods[selectLod(
+			primitive, model, resources.camera, viewportHeight, m_lodThreshold
+		)];
+
+		drawData[i] = {
+			.model = model,
+			.meshletOffset = lod.meshletOffset,
+			.meshletCount = lod.meshletCount,
+			.outputOffset = outputOffset,
+			.baseVertex = (int32_t)primitive.baseVertex,
+			.shortIndices = primitive.indexType == vk::IndexType::eUint16,
+			.scale = getMaxScale(model),
+			.padding = {},
+		};
+		outputOffset += lod.indexCount;
+	}
+	assert(
+		outputOffset * sizeof(uint32_t) <=
+		clusterIndices.bufferAccess[frame].length
+	);
+
+	CullConstants constants {
+		.frustum = getFrustumPlanes(
+			resources.camera.projection * resources.camera.view
+		),
+		.cameraPosition = glm::inverse(resources.camera.view)[3],
+	};
+
+	auto bufferInfo = [&](Buffer& buffer) {
+		uint8_t accessIndex = buffer.transient ? frame : 0;
+		return vk::DescriptorBufferInfo {
+			.buffer = buffer.buffer,
+			.offset = buffer.bufferAccess[accessIndex].offset,
+			.range = buffer.bufferAccess[accessIndex].length,
+		};
+	};
+	std::array<vk::DescriptorBufferInfo, 5> bufferInfos {
+		bufferInfo(resourceManager.getNamedBuffer("meshlet_buffer")),
+		bufferInfo(draws),
+		bufferInfo(resourceManager.getNamedBuffer("index_buffer")),
+		bufferInfo(clusterIndices),
+		bufferInfo(commands),
+	};
+
+	std::array<vk::WriteDescriptorSet, 5> writes;
+	for (uint32_t i = 0; i < writes.size(); i++) {
+		writes[i] = {
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &bufferInfos[i],
+		};
+	}
+
+	commandBuffer.bindPipeline(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipeline
+	);
+	commandBuffer.pushDescriptorSetKHR(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipelineLayout, 0, writes
+	);
+	commandBuffer.pushConstants(
+		m_pipeline.pipelineLayout,
+		vk::ShaderStageFlagBits::eCompute,
+		0,
+		sizeof(CullConstants),
+		&constants
+	);
+	commandBuffer.dispatch(resources.visible.size(), 1, 1);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Task.hpp"
+#include "material/Pipeline.hpp"
+
+// Compute prepass rejecting meshlets outside the frustum or facing away from
+// the camera. Surviving triangles of each primitive are compacted in
+// "cluster_indices" and drawn with the matching command in
+// "cluster_commands", both indexed like Resources::visible.
+class ClusterCull : public Task {
+public:
+	struct ClusterDraw;
+
+private:
+	vk::DescriptorSetLayout m_layout;
+	Pipeline m_pipeline;
+	float m_lodThreshold;
+
+public:
+	ClusterCull(vk::Device& device, float lodThreshold = 1.f);
+
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+	void execute(vk::CommandBuffer& commandBuffer, const Resources& resources)
+		override;
+};
+
+// std430 layout shared with cluster_cull.comp, one per visible primitive in
+// "cluster_draws"
+struct ClusterCull::ClusterDraw {
+	glm::mat4 model;
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	uint32_t outputOffset;
+	int32_t baseVertex;
+	uint32_t shortIndices;
+	float scale;
+	uint32_t padding[2];
+};
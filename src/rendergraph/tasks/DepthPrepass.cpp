@@ -0,0 +1,38 @@
+#include "DepthPrepass.hpp"
+
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+
+#include "RenderPass.hpp"
+
+void DepthPrepass::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	requiredImages.push_back({
+		.name = "main_depth",
+		.usage =
+		{
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+			          vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+			.stage = vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+			         vk::PipelineStageFlagBits2::eLateFragmentTests,
+		},
+		.requiredLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+	});
+
+	RenderPass::setAttachments({
+		.depth = Attachment { "main_depth", true },
+	});
+
+	requiredBuffers.push_back({
+		.name = "position_buffer",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eVertexAttributeRead,
+			.stage = vk::PipelineStageFlagBits2::eVertexAttributeInput,
+		},
+	});
+	setupDraws(requiredBuffers);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "OpaquePass.hpp"
+#include "Task.hpp"
+#include "material/MaterialManager.hpp"
+
+// Draws the same primitives as the OpaquePass following it into
+// "main_depth", reading only the position stream. The material must have a
+// depth pipeline, the opaque pass then tests for equal depth.
+class DepthPrepass : public OpaquePass {
+public:
+	DepthPrepass(
+		std::shared_ptr<Material> material,
+		DrawMode drawMode = DrawMode::Instanced,
+		bool cacheCommands = false,
+		float lodThreshold = 1.f
+	) :
+		OpaquePass(material, true, drawMode, cacheCommands, lodThreshold) {
+		m_variant = Variant::DepthOnly;
+	}
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+};
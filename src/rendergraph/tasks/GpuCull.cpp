@@ -0,0 +1,389 @@
+#include "GpuCull.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <map>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "Primitive.hpp"
+#include "culling/Frustum.hpp"
+#include "material/Pipeline.hpp"
+#include "rendergraph/RenderGraph.hpp"
+
+constexpr uint32_t CULL_GROUP_SIZE = 64;
+
+struct DrawCullConstants {
+	// World space planes, normals pointing inside
+	std::array<glm::vec4, 6> frustum;
+	glm::vec4 cameraPosition;
+	// Pixels per world unit at distance 1
+	float pixelsPerUnit;
+	float lodThreshold;
+	uint32_t primitiveCount;
+	uint32_t previousTransformCount;
+};
+
+// Specialization constants of draw_cull.comp
+struct DrawCullSpecialization {
+	GpuCull::Phase phase;
+	uint32_t depthWidth;
+	uint32_t depthHeight;
+};
+
+constexpr uint32_t CAMERA_BINDING = 5;
+constexpr uint32_t BINDING_COUNT = 9;
+
+GpuCull::GpuCull(
+	vk::Device& device,
+	Phase phase,
+	vk::Extent2D depthSize,
+	float lodThreshold
+) :
+	m_phase(phase), m_lodThreshold(lodThreshold) {
+	std::array<vk::DescriptorSetLayoutBinding, BINDING_COUNT> bindings;
+	for (uint32_t i = 0; i < bindings.size(); i++) {
+		bindings[i] = {
+			.binding = i,
+			.descriptorType = i == CAMERA_BINDING
+			                      ? vk::DescriptorType::eUniformBuffer
+			                      : vk::DescriptorType::eStorageBuffer,
+			.descriptorCount = 1,
+			.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		};
+	}
+
+	m_layout = device.createDescriptorSetLayout({
+		.flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+		.bindingCount = (uint32_t)bindings.size(),
+		.pBindings = bindings.data(),
+	});
+
+	DrawCullSpecialization constants {
+		.phase = phase,
+		.depthWidth = depthSize.width,
+		.depthHeight = depthSize.height,
+	};
+	std::array<vk::SpecializationMapEntry, 3> entries;
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		entries[i] = {
+			.constantID = i,
+			.offset = i * (uint32_t)sizeof(uint32_t),
+			.size = sizeof(uint32_t),
+		};
+	}
+	vk::SpecializationInfo specialization {
+		.mapEntryCount = (uint32_t)entries.size(),
+		.pMapEntries = entries.data(),
+		.dataSize = sizeof(DrawCullSpecialization),
+		.pData = &constants,
+	};
+
+	m_pipeline = PipelineBuilder::ComputePipeline({
+		.device = device,
+		.compute = "resources/shaders/draw_cull.comp.spv",
+		.layouts = { m_layout },
+		.pushConstantSize = sizeof(DrawCullConstants),
+		.specialization = &specialization,
+	});
+}
+
+void GpuCull::GetBuckets(
+	const std::vector<Primitive>& primitives,
+	std::vector<DrawBucket>& buckets,
+	std::vector<uint32_t>& primitiveBuckets
+) {
+	std::map<std::pair<uint32_t, vk::IndexType>, uint32_t> bucketIndices;
+	buckets.clear();
+	primitiveBuckets.resize(primitives.size());
+
+	for (uint32_t i = 0; i < primitives.size(); i++) {
+		const Primitive& primitive = primitives[i];
+		auto key = std::make_pair(
+			primitive.material.instanceIndex, primitive.indexType
+		);
+
+		auto [bucket, inserted] =
+			bucketIndices.try_emplace(key, buckets.size());
+		if (inserted) {
+			buckets.push_back({
+				.materialIndex = primitive.material.instanceIndex,
+				.indexType = primitive.indexType,
+				.firstCommand = 0,
+				.capacity = 0,
+			});
+		}
+		buckets[bucket->second].capacity++;
+		primitiveBuckets[i] = bucket->second;
+	}
+
+	uint32_t firstCommand = 0;
+	for (DrawBucket& bucket : buckets) {
+		bucket.firstCommand = firstCommand;
+		firstCommand += bucket.capacity;
+	}
+}
+
+void GpuCull::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	for (auto name :
+	     { "gpu_primitives", "gpu_transforms", "gpu_previous_transforms" }) {
+		requiredBuffers.push_back({
+			.name = name,
+			.usage = {
+				.type = ResourceUsage::Type::READ,
+				.access = vk::AccessFlagBits2::eShaderStorageRead,
+				.stage = vk::PipelineStageFlagBits2::eComputeShader,
+			},
+		});
+	}
+
+	requiredBuffers.push_back({
+		.name = "gset_buffer",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eUniformRead,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	});
+
+	// Counts are cleared before the dispatch increments them
+	requiredBuffers.push_back({
+		.name = "draw_counts",
+		.usage = {
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eTransferWrite |
+			          vk::AccessFlagBits2::eShaderStorageRead |
+			          vk::AccessFlagBits2::eShaderStorageWrite,
+			.stage = vk::PipelineStageFlagBits2::eTransfer |
+			         vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	});
+	for (auto name : { "draw_commands", "gpu_instances" }) {
+		requiredBuffers.push_back({
+			.name = name,
+			.usage = {
+				.type = ResourceUsage::Type::WRITE,
+				.access = vk::AccessFlagBits2::eShaderStorageWrite,
+				.stage = vk::PipelineStageFlagBits2::eComputeShader,
+			},
+		});
+	}
+
+	if (m_phase == Phase::Single) return;
+
+	// The early phase resets the visibility when primitives are added, the
+	// late one updates it
+	requiredBuffers.push_back({
+		.name = "draw_visibility",
+		.usage = {
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eTransferWrite |
+			          vk::AccessFlagBits2::eShaderStorageRead |
+			          vk::AccessFlagBits2::eShaderStorageWrite,
+			.stage = vk::PipelineStageFlagBits2::eTransfer |
+			         vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	});
+	if (m_phase == Phase::Late) {
+		requiredBuffers.push_back({
+			.name = "depth_pyramid",
+			.usage = {
+				.type = ResourceUsage::Type::READ,
+				.access = vk::AccessFlagBits2::eShaderStorageRead,
+				.stage = vk::PipelineStageFlagBits2::eComputeShader,
+			},
+		});
+	}
+}
+
+void GpuCull::writePrimitives(const Resources& resources) {
+	ResourceManager& resourceManager = resources.resourceManager;
+	Buffer& records = resourceManager.getNamedBuffer("gpu_primitives");
+	const BufferAccess& access = records.bufferAccess[resources.currentFrame];
+	assert(
+		resources.primitives.size() * sizeof(GpuPrimitive) <= access.length
+	);
+
+	std::vector<uint32_t> primitiveBuckets;
+	GetBuckets(resources.primitives, m_buckets, primitiveBuckets);
+
+	auto data = reinterpret_cast<GpuPrimitive*>(
+		(std::byte*)records.allocation.address + access.offset
+	);
+	for (uint32_t i = 0; i < resources.primitives.size(); i++) {
+		const Primitive& primitive = resources.primitives[i];
+		const DrawBucket& bucket = m_buckets[primitiveBuckets[i]];
+
+		GpuPrimitive record {
+			.dequantization = primitive.dequantization,
+			.boundingSphere = glm::vec4(
+				primitive.boundingSphere.center,
+				primitive.boundingSphere.radius
+			),
+			.lods = {},
+			.lodCount = primitive.lodCount,
+			.transform = primitive.transform,
+			.baseVertex = (int32_t)primitive.baseVertex,
+			.bucket = primitiveBuckets[i],
+			.firstCommand = bucket.firstCommand,
+			.material = primitive.material.instanceIndex,
+			.indexSize = getIndexSize(primitive.indexType),
+			.padding = 0,
+		};
+		for (uint32_t lod = 0; lod < primitive.lodCount; lod++) {
+			record.lods[lod] = {
+				.baseIndex = primitive.lods[lod].baseIndex,
+				.indexCount = primitive.lods[lod].indexCount,
+				.error = primitive.lods[lod].error,
+				.padding = 0,
+			};
+		}
+		data[i] = record;
+	}
+	m_writtenPrimitives[resources.currentFrame] = resources.primitives.size();
+}
+
+void GpuCull::execute(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	if (resources.primitives.empty()) return;
+
+	ResourceManager& resourceManager = resources.resourceManager;
+	uint8_t frame = resources.currentFrame;
+
+	// The late phase reuses the records and transforms of the early one.
+	// Records only change while the scene streams in, so each frame section
+	// is rewritten once per change.
+	if (m_phase != Phase::Late) {
+		if (m_writtenPrimitives[frame] != resources.primitives.size())
+			writePrimitives(resources);
+
+		// The previous models get their own section instead of reading the
+		// one of the last frame, which the next frame rewrites while this
+		// one can still be running
+		auto write = [&](std::string_view name,
+		                 const std::vector<glm::mat4>& transforms) {
+			Buffer& buffer = resourceManager.getNamedBuffer(name);
+			assert(
+				transforms.size() * sizeof(glm::mat4) <=
+				buffer.bufferAccess[frame].length
+			);
+			std::memcpy(
+				(std::byte*)buffer.allocation.address +
+					buffer.bufferAccess[frame].offset,
+				transforms.data(),
+				transforms.size() * sizeof(glm::mat4)
+			);
+		};
+		write("gpu_transforms", resources.transforms);
+		write("gpu_previous_transforms", m_previousTransforms);
+	}
+
+	std::vector<vk::BufferMemoryBarrier2> clearBarriers;
+	auto clear = [&](Buffer& buffer, uint8_t accessIndex) {
+		const BufferAccess& access = buffer.bufferAccess[accessIndex];
+		commandBuffer.fillBuffer(
+			buffer.buffer, access.offset, access.length, 0
+		);
+		clearBarriers.push_back({
+			.srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+			.srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+			.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+			.dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead |
+			                 vk::AccessFlagBits2::eShaderStorageWrite,
+			.buffer = buffer.buffer,
+			.offset = access.offset,
+			.size = access.length,
+		});
+	};
+
+	clear(resourceManager.getNamedBuffer("draw_counts"), frame);
+	// New primitives have no visibility yet, they are all tested again by
+	// the late phase
+	if (m_phase == Phase::Early &&
+	    m_visibilityPrimitives != resources.primitives.size()) {
+		clear(resourceManager.getNamedBuffer("draw_visibility"), 0);
+		m_visibilityPrimitives = resources.primitives.size();
+	}
+	commandBuffer.pipelineBarrier2(vk::DependencyInfo {
+		.bufferMemoryBarrierCount = (uint32_t)clearBarriers.size(),
+		.pBufferMemoryBarriers = clearBarriers.data(),
+	});
+
+	float viewportHeight =
+		resourceManager.getNamedImage("main_color").size.height;
+	DrawCullConstants constants {
+		.frustum = getFrustumPlanes(
+			resources.camera.projection * resources.camera.view
+		),
+		.cameraPosition = glm::inverse(resources.camera.view)[3],
+		.pixelsPerUnit =
+			viewportHeight * glm::abs(resources.camera.projection[1][1]) / 2,
+		.lodThreshold = m_lodThreshold,
+		.primitiveCount = (uint32_t)resources.primitives.size(),
+		.previousTransformCount = m_previousTransformCount,
+	};
+
+	auto bufferInfo = [&](std::string_view name) {
+		Buffer& buffer = resourceManager.getNamedBuffer(name);
+		uint8_t accessIndex = buffer.transient ? frame : 0;
+		return vk::DescriptorBufferInfo {
+			.buffer = buffer.buffer,
+			.offset = buffer.bufferAccess[accessIndex].offset,
+			.range = buffer.bufferAccess[accessIndex].length,
+		};
+	};
+	// The visibility and the pyramid are bound in every phase, but only
+	// accessed by the ones using them
+	std::array<vk::DescriptorBufferInfo, BINDING_COUNT> bufferInfos {
+		bufferInfo("gpu_primitives"),  bufferInfo("gpu_transforms"),
+		bufferInfo("draw_commands"),   bufferInfo("draw_counts"),
+		bufferInfo("gpu_instances"),   bufferInfo("gset_buffer"),
+		bufferInfo("draw_visibility"), bufferInfo("depth_pyramid"),
+		bufferInfo("gpu_previous_transforms"),
+	};
+
+	std::array<vk::WriteDescriptorSet, BINDING_COUNT> writes;
+	for (uint32_t i = 0; i < writes.size(); i++) {
+		writes[i] = {
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = i == CAMERA_BINDING
+			                      ? vk::DescriptorType::eUniformBuffer
+			                      : vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &bufferInfos[i],
+		};
+	}
+
+	commandBuffer.bindPipeline(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipeline
+	);
+	commandBuffer.pushDescriptorSetKHR(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipelineLayout, 0, writes
+	);
+	commandBuffer.pushConstants(
+		m_pipeline.pipelineLayout,
+		vk::ShaderStageFlagBits::eCompute,
+		0,
+		sizeof(DrawCullConstants),
+		&constants
+	);
+	commandBuffer.dispatch(
+		(resources.primitives.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE,
+		1,
+		1
+	);
+	m_previousTransformCount = resources.transforms.size();
+	if (m_phase != Phase::Late) m_previousTransforms = resources.transforms;
+}
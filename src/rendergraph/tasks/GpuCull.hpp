@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Primitive.hpp"
+#include "Task.hpp"
+#include "material/Pipeline.hpp"
+
+// Compute pass culling every primitive against the frustum and selecting
+// its level on the GPU. Surviving draws are compacted per bucket in
+// "draw_commands", with their count in "draw_counts" and their InstanceData
+// in "gpu_instances", so each bucket is drawn with a single
+// drawIndexedIndirectCount.
+//
+// Occlusion culling splits the pass in two phases around a HiZBuild. The
+// early phase draws the primitives that were visible last frame, the late
+// phase tests every primitive against the pyramid of their depth, draws the
+// newly visible ones and records the visibility in "draw_visibility" for
+// the next frame.
+class GpuCull : public Task {
+public:
+	struct DrawBucket;
+	struct GpuPrimitive;
+
+	enum class Phase : uint32_t {
+		// Frustum culling only
+		Single,
+		Early,
+		Late,
+	};
+
+private:
+	vk::DescriptorSetLayout m_layout;
+	Pipeline m_pipeline;
+	Phase m_phase;
+	float m_lodThreshold;
+
+	std::vector<DrawBucket> m_buckets;
+	// Primitive count the records of each frame section were written for
+	std::array<uint32_t, 3> m_writtenPrimitives {};
+	// Primitive count of the last frame, visibility is reset when it changes
+	uint32_t m_visibilityPrimitives = 0;
+	// Node transforms of the last frame, copied to the frame section of
+	// "gpu_previous_transforms" next to the current ones
+	std::vector<glm::mat4> m_previousTransforms;
+	// Nodes having a previous model, the late phase reads the transforms
+	// the early one copied
+	uint32_t m_previousTransformCount = 0;
+
+	void writePrimitives(const Resources& resources);
+
+public:
+	// `depthSize` is the size of "main_depth", used by the late phase to
+	// address the depth pyramid
+	GpuCull(
+		vk::Device& device,
+		Phase phase = Phase::Single,
+		vk::Extent2D depthSize = { 1, 1 },
+		float lodThreshold = 1.f
+	);
+
+	// Groups primitives by material and index type. Buckets own consecutive
+	// ranges of draw commands, placed with an exclusive prefix sum of their
+	// sizes. `primitiveBuckets` receives the bucket of every primitive.
+	static void GetBuckets(
+		const std::vector<Primitive>& primitives,
+		std::vector<DrawBucket>& buckets,
+		std::vector<uint32_t>& primitiveBuckets
+	);
+
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+	void execute(vk::CommandBuffer& commandBuffer, const Resources& resources)
+		override;
+	inline QueueAffinity getQueueAffinity() const override {
+		return QueueAffinity::ASYNC_COMPUTE;
+	}
+};
+
+struct GpuCull::DrawBucket {
+	uint32_t materialIndex;
+	vk::IndexType indexType;
+	// First draw command of the bucket and the number it can hold
+	uint32_t firstCommand;
+	uint32_t capacity;
+};
+
+// std430 layout shared with draw_cull.comp, one per primitive in
+// "gpu_primitives"
+struct GpuCull::GpuPrimitive {
+	struct Lod {
+		uint32_t baseIndex;
+		uint32_t indexCount;
+		float error;
+		uint32_t padding;
+	};
+
+	glm::mat4 dequantization;
+	glm::vec4 boundingSphere;
+	std::array<Lod, MAX_LODS> lods;
+	uint32_t lodCount;
+	uint32_t transform;
+	int32_t baseVertex;
+	uint32_t bucket;
+	uint32_t firstCommand;
+	uint32_t material;
+	uint32_t indexSize;
+	uint32_t padding;
+};
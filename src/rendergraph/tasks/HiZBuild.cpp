@@ -0,0 +1,196 @@
+#include "HiZBuild.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "material/Pipeline.hpp"
+#include "rendergraph/RenderGraph.hpp"
+
+constexpr uint32_t HIZ_GROUP_SIZE = 8;
+
+struct HiZConstants {
+	vk::Extent2D sourceSize;
+	uint32_t sourceOffset;
+	// Level 0 reads the depth image instead of the pyramid
+	uint32_t firstLevel;
+	vk::Extent2D destinationSize;
+	uint32_t destinationOffset;
+	uint32_t padding;
+};
+
+vk::Extent2D getNextLevel(vk::Extent2D size) {
+	return { (size.width + 1) / 2, (size.height + 1) / 2 };
+}
+
+HiZBuild::HiZBuild(vk::Device& device) {
+	std::array<vk::DescriptorSetLayoutBinding, 2> bindings {
+		vk::DescriptorSetLayoutBinding {
+			.binding = 0,
+			.descriptorType = vk::DescriptorType::eCombinedImageSampler,
+			.descriptorCount = 1,
+			.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		},
+		vk::DescriptorSetLayoutBinding {
+			.binding = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.descriptorCount = 1,
+			.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		},
+	};
+
+	m_layout = device.createDescriptorSetLayout({
+		.flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+		.bindingCount = (uint32_t)bindings.size(),
+		.pBindings = bindings.data(),
+	});
+
+	// Depth is only read with texelFetch
+	m_sampler = device.createSampler({
+		.magFilter = vk::Filter::eNearest,
+		.minFilter = vk::Filter::eNearest,
+		.mipmapMode = vk::SamplerMipmapMode::eNearest,
+		.addressModeU = vk::SamplerAddressMode::eClampToEdge,
+		.addressModeV = vk::SamplerAddressMode::eClampToEdge,
+		.addressModeW = vk::SamplerAddressMode::eClampToEdge,
+	});
+
+	m_pipeline = PipelineBuilder::ComputePipeline({
+		.device = device,
+		.compute = "resources/shaders/hiz_build.comp.spv",
+		.layouts = { m_layout },
+		.pushConstantSize = sizeof(HiZConstants),
+	});
+}
+
+uint32_t HiZBuild::GetPyramidSize(vk::Extent2D depthSize) {
+	uint32_t texelCount = 0;
+	vk::Extent2D size = depthSize;
+	do {
+		size = getNextLevel(size);
+		texelCount += size.width * size.height;
+	} while (size.width > 1 || size.height > 1);
+	return texelCount;
+}
+
+void HiZBuild::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	requiredImages.push_back({
+		.name = "main_depth",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eShaderSampledRead,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+		.requiredLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+	});
+	requiredBuffers.push_back({
+		.name = "depth_pyramid",
+		.usage = {
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eShaderStorageRead |
+			          vk::AccessFlagBits2::eShaderStorageWrite,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	});
+}
+
+void HiZBuild::execute(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	uint8_t frame = resources.currentFrame;
+	Image& depth = resources.resourceManager.getNamedImage("main_depth");
+	Buffer& pyramid = resources.resourceManager.getNamedBuffer("depth_pyramid");
+	const BufferAccess& pyramidAccess = pyramid.bufferAccess[frame];
+
+	vk::DescriptorImageInfo imageInfo {
+		.sampler = m_sampler,
+		.imageView = depth.accesses[frame].view,
+		.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+	};
+	vk::DescriptorBufferInfo bufferInfo {
+		.buffer = pyramid.buffer,
+		.offset = pyramidAccess.offset,
+		.range = pyramidAccess.length,
+	};
+	std::array<vk::WriteDescriptorSet, 2> writes {
+		vk::WriteDescriptorSet {
+			.dstBinding = 0,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eCombinedImageSampler,
+			.pImageInfo = &imageInfo,
+		},
+		vk::WriteDescriptorSet {
+			.dstBinding = 1,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &bufferInfo,
+		},
+	};
+
+	commandBuffer.bindPipeline(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipeline
+	);
+	commandBuffer.pushDescriptorSetKHR(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipelineLayout, 0, writes
+	);
+
+	// Each level reads the one written by the previous dispatch
+	vk::BufferMemoryBarrier2 levelBarrier {
+		.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+		.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+		.dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead,
+		.buffer = pyramid.buffer,
+		.offset = pyramidAccess.offset,
+		.size = pyramidAccess.length,
+	};
+
+	vk::Extent2D depthSize { depth.size.width, depth.size.height };
+	HiZConstants constants {
+		.sourceSize = depthSize,
+		.sourceOffset = 0,
+		.firstLevel = 1,
+		.destinationSize = getNextLevel(depthSize),
+		.destinationOffset = 0,
+		.padding = 0,
+	};
+	while (true) {
+		commandBuffer.pushConstants(
+			m_pipeline.pipelineLayout,
+			vk::ShaderStageFlagBits::eCompute,
+			0,
+			sizeof(HiZConstants),
+			&constants
+		);
+		commandBuffer.dispatch(
+			(constants.destinationSize.width + HIZ_GROUP_SIZE - 1) /
+				HIZ_GROUP_SIZE,
+			(constants.destinationSize.height + HIZ_GROUP_SIZE - 1) /
+				HIZ_GROUP_SIZE,
+			1
+		);
+
+		vk::Extent2D size = constants.destinationSize;
+		if (size.width == 1 && size.height == 1) break;
+
+		commandBuffer.pipelineBarrier2(vk::DependencyInfo {
+			.bufferMemoryBarrierCount = 1,
+			.pBufferMemoryBarriers = &levelBarrier,
+		});
+		constants = {
+			.sourceSize = size,
+			.sourceOffset = constants.destinationOffset,
+			.firstLevel = 0,
+			.destinationSize = getNextLevel(size),
+			.destinationOffset =
+				constants.destinationOffset + size.width * size.height,
+			.padding = 0,
+		};
+	}
+}
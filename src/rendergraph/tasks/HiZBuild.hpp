@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Task.hpp"
+#include "material/Pipeline.hpp"
+
+// Builds a max depth pyramid of "main_depth" in "depth_pyramid". Level 0 is
+// half the depth resolution and every level halves the previous one, rounding
+// up, down to a single texel. Levels are stored one after the other as
+// floats.
+class HiZBuild : public Task {
+private:
+	vk::DescriptorSetLayout m_layout;
+	vk::Sampler m_sampler;
+	Pipeline m_pipeline;
+
+public:
+	HiZBuild(vk::Device& device);
+
+	// Texel count of the pyramid of a depth buffer
+	static uint32_t GetPyramidSize(vk::Extent2D depthSize);
+
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+	void execute(vk::CommandBuffer& commandBuffer, const Resources& resources)
+		override;
+	inline QueueAffinity getQueueAffinity() const override {
+		return QueueAffinity::ASYNC_COMPUTE;
+	}
+};
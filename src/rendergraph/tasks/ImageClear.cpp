@@ -0,0 +1,42 @@
+#include "ImageClear.hpp"
+
+#include <cstdint>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "rendergraph/RenderGraph.hpp"
+
+void ImageClear::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	requiredImages.push_back({
+		.name = m_image,
+		.usage = {
+				  .type = ResourceUsage::Type::WRITE,
+				  .access = vk::AccessFlagBits2::eTransferWrite,
+				  .stage = vk::PipelineStageFlagBits2::eTransfer,
+				  },
+		.requiredLayout = vk::ImageLayout::eTransferDstOptimal
+	});
+};
+
+void ImageClear::execute(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	Image& image = resources.resourceManager.getNamedImage(m_image);
+	uint8_t accessIndex = image.transient ? resources.currentFrame : 0;
+
+	commandBuffer.clearColorImage(
+		image.image,
+		image.accesses[accessIndex].layout,
+		m_color,
+		vk::ImageSubresourceRange {
+			.aspectMask = vk::ImageAspectFlagBits::eColor,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = accessIndex,
+			.layerCount = 1,
+		}
+	);
+}
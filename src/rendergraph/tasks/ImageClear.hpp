@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string_view>
+
+#include "../RenderGraph.hpp"
+#include "../RenderGraphBuilder.hpp"
+#include "Task.hpp"
+
+class ImageClear : public Task {
+public:
+private:
+	std::string_view m_image;
+	vk::ClearColorValue m_color;
+
+public:
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+	void execute(vk::CommandBuffer& commandBuffer, const Resources& resources)
+		override;
+
+	ImageClear(std::string_view image, vk::ClearColorValue color = {}) :
+		m_image(image), m_color(color) {}
+};
\ No newline at end of file
@@ -1,45 +1,79 @@
 #include "OpaquePass.hpp"
 
+#include <cassert>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <optional>
 #include <vector>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
 #include "../RenderGraph.hpp"
+#include "GpuCull.hpp"
 #include "Primitive.hpp"
 #include "RenderPass.hpp"
 
+// Draws recorded per worker thread, shorter lists are recorded serially
+constexpr uint32_t PARALLEL_CHUNK_DRAWS = 2048;
+
 void OpaquePass::setup(
 	std::vector<ImageDependencyInfo>& requiredImages,
 	std::vector<BufferDependencyInfo>& requiredBuffers
 ) {
+	// Passes that do not clear load the attachments written before them
+	vk::AccessFlags2 loadAccess = {};
+	if (!m_clear) loadAccess = vk::AccessFlagBits2::eColorAttachmentRead;
 	requiredImages.push_back({
 		.name = "main_color",
 		.usage =
 		{
 			.type = ResourceUsage::Type::WRITE,
-			.access = vk::AccessFlagBits2::eColorAttachmentWrite,
+			.access = vk::AccessFlagBits2::eColorAttachmentWrite | loadAccess,
 			.stage = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
 		},
 		.requiredLayout = vk::ImageLayout::eColorAttachmentOptimal,
 		
 	});
+	// After a prepass depth is only tested, the builder orders this read
+	// after the prepass write
+	bool depthWrite = !followsPrepass();
+	vk::AccessFlags2 depthAccess =
+		vk::AccessFlagBits2::eDepthStencilAttachmentRead;
+	if (depthWrite)
+		depthAccess |= vk::AccessFlagBits2::eDepthStencilAttachmentWrite;
 	requiredImages.push_back({
 		.name = "main_depth",
 		.usage =
 		{
-			.type = ResourceUsage::Type::WRITE,
-			.access = vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-			.stage = vk::PipelineStageFlagBits2::eLateFragmentTests,
+			.type = depthWrite ? ResourceUsage::Type::WRITE
+			                   : ResourceUsage::Type::READ,
+			.access = depthAccess,
+			.stage = vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+			         vk::PipelineStageFlagBits2::eLateFragmentTests,
 		},
 		.requiredLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
 	});
 
 	RenderPass::setAttachments({
 		.color = Attachment { "main_color", m_clear },
-		.depth = Attachment { "main_depth", m_clear },
+		.depth = Attachment { "main_depth", m_clear && depthWrite },
 	});
 
+	setupDraws(requiredBuffers);
+}
+
+void OpaquePass::setupDraws(std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	requiredBuffers.push_back({
+		.name = m_drawMode == DrawMode::GpuDriven ? "gpu_instances"
+		                                          : "instance_buffer",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eShaderStorageRead,
+			.stage = vk::PipelineStageFlagBits2::eVertexShader,
+		},
+	});
 	requiredBuffers.push_back({
 		.name = "gset_buffer",
 		.usage =  
@@ -49,37 +83,358 @@ void OpaquePass::setup(
 			.stage = vk::PipelineStageFlagBits2::eVertexShader,
 		},
 	});
+
+	if (m_drawMode == DrawMode::GpuDriven) {
+		for (auto name : { "draw_commands", "draw_counts" }) {
+			requiredBuffers.push_back({
+				.name = name,
+				.usage = {
+					.type = ResourceUsage::Type::READ,
+					.access = vk::AccessFlagBits2::eIndirectCommandRead,
+					.stage = vk::PipelineStageFlagBits2::eDrawIndirect,
+				},
+			});
+		}
+		return;
+	}
+	if (m_drawMode != DrawMode::Clusters) return;
+
+	requiredBuffers.push_back({
+		.name = "cluster_indices",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eIndexRead,
+			.stage = vk::PipelineStageFlagBits2::eIndexInput,
+		},
+	});
+	requiredBuffers.push_back({
+		.name = "cluster_commands",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eIndirectCommandRead,
+			.stage = vk::PipelineStageFlagBits2::eDrawIndirect,
+		},
+	});
 }
 
 void OpaquePass::execute(
 	vk::CommandBuffer& commandBuffer, const Resources& resources
 ) {
-	RenderPass::execute(commandBuffer, resources);
-
-	for (auto primitive : resources.primitives) {
-		commandBuffer.pushConstants(
-			m_material->pipeline.pipelineLayout,
-			vk::ShaderStageFlagBits::eVertex,
-			0,
-			64,
-			&primitive.modelMatrix
+	bool gpuDriven = m_drawMode == DrawMode::GpuDriven;
+	// Indirect commands address the instances written next to them by
+	// GpuCull
+	if (!gpuDriven && !followsPrepass()) writeInstances(resources);
+
+	Buffer& instances = resources.resourceManager.getNamedBuffer(
+		gpuDriven ? "gpu_instances" : "instance_buffer"
+	);
+	auto record = [&](vk::CommandBuffer& buffer, uint32_t begin, uint32_t end) {
+		pushInstances(buffer, instances, resources.currentFrame);
+		switch (m_drawMode) {
+			case DrawMode::Instanced:
+				drawInstances(buffer, resources, begin, end);
+				break;
+			case DrawMode::Clusters:
+				drawClusters(buffer, resources, begin, end);
+				break;
+			case DrawMode::GpuDriven:
+				drawBuckets(buffer, resources);
+				break;
+		}
+	};
+	// Indirect draws are a single chunk, their count is only known on the
+	// GPU
+	uint32_t drawCount = gpuDriven ? 1 : resources.visible.size();
+
+	if (!m_cacheCommands && drawCount < 2 * PARALLEL_CHUNK_DRAWS) {
+		RenderPass::execute(commandBuffer, resources);
+		record(commandBuffer, 0, drawCount);
+		commandBuffer.endRendering();
+		return;
+	}
+
+	// Long draw lists are split in chunks recorded on the worker threads,
+	// each in a secondary command buffer setting up its own state
+	beginRendering(
+		commandBuffer,
+		resources,
+		vk::RenderingFlagBits::eContentsSecondaryCommandBuffersKHR
+	);
+	auto recordChunk =
+		[&](vk::CommandBuffer& buffer, uint32_t begin, uint32_t end) {
+			bindState(buffer, resources);
+			record(buffer, begin, end);
+		};
+
+	std::vector<vk::CommandBuffer> chunks;
+	if (m_cacheCommands) {
+		if (!m_cache) m_cache = resources.recorder.createCache();
+		chunks = resources.recorder.recordCached(
+			*m_cache,
+			getCacheVersion(resources),
+			drawCount,
+			PARALLEL_CHUNK_DRAWS,
+			getInheritance(),
+			recordChunk
+		);
+	} else {
+		chunks = resources.recorder.recordRendering(
+			drawCount, PARALLEL_CHUNK_DRAWS, getInheritance(), recordChunk
 		);
+	}
+	commandBuffer.executeCommands(chunks);
+
+	commandBuffer.endRendering();
+}
+
+uint32_t OpaquePass::getLod(
+	const Primitive& primitive,
+	const Resources& resources,
+	float viewportHeight
+) const {
+	return selectLod(
+		primitive,
+		resources.transforms[primitive.transform],
+		resources.camera,
+		viewportHeight,
+		m_lodThreshold
+	);
+}
+
+uint64_t OpaquePass::getCacheVersion(const Resources& resources) {
+	// Cluster and indirect commands are written on the GPU every frame
+	if (m_drawMode != DrawMode::Instanced)
+		return resources.drawVersion;
+
+	float viewportHeight =
+		resources.resourceManager.getNamedImage("main_color").size.height;
+	bool changed = m_selectedLods.size() != resources.visible.size();
+	m_selectedLods.resize(resources.visible.size());
+	for (uint32_t i = 0; i < resources.visible.size(); i++) {
+		const Primitive& primitive =
+			resources.primitives[resources.visible[i]];
+		uint32_t lod = getLod(primitive, resources, viewportHeight);
+		changed |= lod != m_selectedLods[i];
+		m_selectedLods[i] = lod;
+	}
+	if (changed) m_lodChanges++;
+	// Both only grow, so the sum changes whenever one of them does
+	return resources.drawVersion + m_lodChanges;
+}
+
+void OpaquePass::bindMaterial(
+	vk::CommandBuffer& commandBuffer, uint32_t instanceIndex
+) {
+	// Bindless draws read their material from the instance data
+	if (m_material->bindless || m_variant != Variant::Shaded) return;
+	commandBuffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eGraphics,
+		getPipeline().pipelineLayout,
+		1,
+		{ m_material->instanceSets[instanceIndex] },
+		nullptr
+	);
+}
 
-		commandBuffer.bindDescriptorSets(
-			vk::PipelineBindPoint::eGraphics,
-			m_material->pipeline.pipelineLayout,
+void OpaquePass::pushInstances(
+	vk::CommandBuffer& commandBuffer, Buffer& instances, uint8_t frame
+) {
+	vk::DescriptorBufferInfo bufferInfo {
+		.buffer = instances.buffer,
+		.offset = instances.bufferAccess[frame].offset,
+		.range = instances.bufferAccess[frame].length,
+	};
+	commandBuffer.pushDescriptorSetKHR(
+		vk::PipelineBindPoint::eGraphics,
+		getPipeline().pipelineLayout,
+		INSTANCE_SET,
+		vk::WriteDescriptorSet {
+			.dstBinding = 0,
+			.descriptorCount = 1,
+			.descriptorType = vk::DescriptorType::eStorageBuffer,
+			.pBufferInfo = &bufferInfo,
+		}
+	);
+}
+
+void OpaquePass::writeInstances(const Resources& resources) {
+	// Instance i holds the data of the i-th visible primitive, instanced
+	// draws and cluster commands address it through firstInstance
+	Buffer& instanceBuffer =
+		resources.resourceManager.getNamedBuffer("instance_buffer");
+	const BufferAccess& instanceAccess =
+		instanceBuffer.bufferAccess[resources.currentFrame];
+	assert(
+		resources.visible.size() * sizeof(InstanceData) <=
+		instanceAccess.length
+	);
+
+	// Nodes added since the last frame have no previous transform
+	auto getPreviousTransform = [&](uint32_t transform) {
+		return transform < m_previousTransforms.size()
+		           ? m_previousTransforms[transform]
+		           : resources.transforms[transform];
+	};
+
+	float viewportHeight =
+		resources.resourceManager.getNamedImage("main_color").size.height;
+	auto instances = reinterpret_cast<InstanceData*>(
+		(std::byte*)instanceBuffer.allocation.address + instanceAccess.offset
+	);
+	for (uint32_t i = 0; i < resources.visible.size(); i++) {
+		const Primitive& primitive =
+			resources.primitives[resources.visible[i]];
+		const glm::mat4& transform = resources.transforms[primitive.transform];
+		const PrimitiveLod& lod =
+			primitive.lods[getLod(primitive, resources, viewportHeight)];
+
+		instances[i] = {
+			.model = transform * primitive.dequantization,
+			.previousModel = getPreviousTransform(primitive.transform) *
+			                 primitive.dequantization,
+			.normal = glm::mat3x4(
+				glm::transpose(glm::inverse(glm::mat3(transform)))
+			),
+			.material = primitive.material.instanceIndex,
+			.firstIndex = lod.baseIndex,
+			.baseVertex = (int32_t)primitive.baseVertex,
+			.indexSize = getIndexSize(primitive.indexType),
+		};
+	}
+	m_previousTransforms = resources.transforms;
+}
+
+void OpaquePass::drawClusters(
+	vk::CommandBuffer& commandBuffer,
+	const Resources& resources,
+	uint32_t begin,
+	uint32_t end
+) {
+	Buffer& clusterIndices =
+		resources.resourceManager.getNamedBuffer("cluster_indices");
+	Buffer& commands =
+		resources.resourceManager.getNamedBuffer("cluster_commands");
+
+	commandBuffer.bindIndexBuffer(
+		clusterIndices.buffer,
+		clusterIndices.bufferAccess[resources.currentFrame].offset,
+		vk::IndexType::eUint32
+	);
+
+	std::optional<uint32_t> boundMaterial;
+	for (uint32_t i = begin; i < end; i++) {
+		const Primitive& primitive =
+			resources.primitives[resources.visible[i]];
+
+		if (primitive.material.instanceIndex != boundMaterial) {
+			bindMaterial(commandBuffer, primitive.material.instanceIndex);
+			boundMaterial = primitive.material.instanceIndex;
+		}
+
+		commandBuffer.drawIndexedIndirect(
+			commands.buffer,
+			commands.bufferAccess[resources.currentFrame].offset +
+				i * sizeof(vk::DrawIndexedIndirectCommand),
 			1,
-			{ m_material->instanceSets[primitive.material.instanceIndex] },
-			nullptr
+			sizeof(vk::DrawIndexedIndirectCommand)
 		);
+	}
+}
+
+void OpaquePass::drawInstances(
+	vk::CommandBuffer& commandBuffer,
+	const Resources& resources,
+	uint32_t begin,
+	uint32_t end
+) {
+	Buffer& indexBuffer =
+		resources.resourceManager.getNamedBuffer("index_buffer");
+	vk::IndexType boundIndexType = vk::IndexType::eUint32;
+	std::optional<uint32_t> boundMaterial;
+	float viewportHeight =
+		resources.resourceManager.getNamedImage("main_color").size.height;
+
+	const auto& visible = resources.visible;
+
+	// Primitives are sorted by material and mesh, consecutive visible ones
+	// sharing both and the selected level are drawn as one instanced call
+	for (uint32_t first = begin; first < end;) {
+		const Primitive& primitive = resources.primitives[visible[first]];
+		uint32_t lodIndex = getLod(primitive, resources, viewportHeight);
 
+		uint32_t instanceCount = 1;
+		for (; first + instanceCount < end; instanceCount++) {
+			const Primitive& next =
+				resources.primitives[visible[first + instanceCount]];
+			if (next.mesh != primitive.mesh ||
+			    next.material.instanceIndex !=
+			        primitive.material.instanceIndex ||
+			    getLod(next, resources, viewportHeight) != lodIndex)
+				break;
+		}
+
+		if (primitive.indexType != boundIndexType) {
+			commandBuffer.bindIndexBuffer(
+				indexBuffer.buffer, 0, primitive.indexType
+			);
+			boundIndexType = primitive.indexType;
+		}
+
+		if (primitive.material.instanceIndex != boundMaterial) {
+			bindMaterial(commandBuffer, primitive.material.instanceIndex);
+			boundMaterial = primitive.material.instanceIndex;
+		}
+
+		const PrimitiveLod& lod = primitive.lods[lodIndex];
 		commandBuffer.drawIndexed(
-			primitive.indexCount,
-			1,
-			primitive.baseIndex,
+			lod.indexCount,
+			instanceCount,
+			lod.baseIndex,
 			primitive.baseVertex,
-			0
+			first
 		);
+		first += instanceCount;
 	}
-	commandBuffer.endRendering();
-}
\ No newline at end of file
+}
+
+void OpaquePass::drawBuckets(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	if (resources.primitives.empty()) return;
+
+	if (m_bucketPrimitives != resources.primitives.size()) {
+		std::vector<uint32_t> primitiveBuckets;
+		GpuCull::GetBuckets(resources.primitives, m_buckets, primitiveBuckets);
+		m_bucketPrimitives = resources.primitives.size();
+	}
+
+	ResourceManager& resourceManager = resources.resourceManager;
+	uint8_t frame = resources.currentFrame;
+	Buffer& indexBuffer = resourceManager.getNamedBuffer("index_buffer");
+	Buffer& commands = resourceManager.getNamedBuffer("draw_commands");
+	Buffer& counts = resourceManager.getNamedBuffer("draw_counts");
+
+	std::optional<vk::IndexType> boundIndexType;
+	for (uint32_t i = 0; i < m_buckets.size(); i++) {
+		const GpuCull::DrawBucket& bucket = m_buckets[i];
+
+		if (bucket.indexType != boundIndexType) {
+			commandBuffer.bindIndexBuffer(
+				indexBuffer.buffer, 0, bucket.indexType
+			);
+			boundIndexType = bucket.indexType;
+		}
+
+		bindMaterial(commandBuffer, bucket.materialIndex);
+
+		commandBuffer.drawIndexedIndirectCountKHR(
+			commands.buffer,
+			commands.bufferAccess[frame].offset +
+				bucket.firstCommand * sizeof(vk::DrawIndexedIndirectCommand),
+			counts.buffer,
+			counts.bufferAccess[frame].offset + i * sizeof(uint32_t),
+			bucket.capacity,
+			sizeof(vk::DrawIndexedIndirectCommand)
+		);
+	}
+}
@@ -1,19 +1,106 @@
 #pragma once
+#include <glm/glm.hpp>
 #include <memory>
+#include <optional>
 #include <vector>
 
+#include "GpuCull.hpp"
 #include "Primitive.hpp"
 #include "RenderPass.hpp"
 #include "Task.hpp"
+#include "rendergraph/CommandRecorder.hpp"
 #include "material/MaterialManager.hpp"
 
 class OpaquePass : public RenderPass {
-private:
+public:
+	enum class DrawMode {
+		// Whole index ranges of the visible primitives, instanced when
+		// consecutive ones share a mesh
+		Instanced,
+		// Output of ClusterCull
+		Clusters,
+		// Output of GpuCull, one indirect count draw per bucket
+		GpuDriven,
+	};
+
+protected:
 	bool m_clear;
 
+	// Buffers read by the draws of `m_drawMode`
+	void setupDraws(std::vector<BufferDependencyInfo>& requiredBuffers);
+
+private:
+	DrawMode m_drawMode;
+	// Replays the draws recorded in earlier frames while
+	// Resources::drawVersion stays the same
+	bool m_cacheCommands;
+	std::optional<CommandRecorder::CacheHandle> m_cache;
+	// Levels selected for the visible primitives by the last instanced
+	// recording, and how many times they changed
+	std::vector<uint32_t> m_selectedLods;
+	uint64_t m_lodChanges = 0;
+	// Largest projected simplification error, in pixels, a LOD may have to
+	// be selected
+	float m_lodThreshold;
+
+	// Buckets of GpuCull, recomputed when the primitive count changes
+	std::vector<GpuCull::DrawBucket> m_buckets;
+	uint32_t m_bucketPrimitives = 0;
+
+	// Node transforms of the last frame, for InstanceData::previousModel
+	std::vector<glm::mat4> m_previousTransforms;
+
+	// Depth and the instances were already written by the prepass
+	inline bool followsPrepass() const {
+		return m_material->depthPipeline.has_value() &&
+		       m_variant == Variant::Shaded;
+	}
+
+	uint32_t getLod(
+		const Primitive& primitive,
+		const Resources& resources,
+		float viewportHeight
+	) const;
+	// Resources::drawVersion, bumped as well when instanced draws would
+	// select other levels
+	uint64_t getCacheVersion(const Resources& resources);
+	void bindMaterial(vk::CommandBuffer& commandBuffer, uint32_t instanceIndex);
+	void pushInstances(
+		vk::CommandBuffer& commandBuffer, Buffer& instances, uint8_t frame
+	);
+	// Fills "instance_buffer" with the InstanceData of the visible
+	// primitives
+	void writeInstances(const Resources& resources);
+	// Draw the visible primitives in [begin, end)
+	void drawClusters(
+		vk::CommandBuffer& commandBuffer,
+		const Resources& resources,
+		uint32_t begin,
+		uint32_t end
+	);
+	void drawInstances(
+		vk::CommandBuffer& commandBuffer,
+		const Resources& resources,
+		uint32_t begin,
+		uint32_t end
+	);
+	void drawBuckets(
+		vk::CommandBuffer& commandBuffer, const Resources& resources
+	);
+
 public:
-	OpaquePass(std::shared_ptr<Material> material, bool clear) :
-		RenderPass(material), m_clear(clear) {}
+	OpaquePass(
+		std::shared_ptr<Material> material,
+		bool clear,
+		DrawMode drawMode = DrawMode::Instanced,
+		bool cacheCommands = false,
+		float lodThreshold = 1.f
+	) :
+		RenderPass(material),
+		m_clear(clear),
+		m_drawMode(drawMode),
+		m_cacheCommands(cacheCommands),
+		m_lodThreshold(lodThreshold) {}
 	void setup(
 		std::vector<ImageDependencyInfo>& requiredImages,
 		std::vector<BufferDependencyInfo>& requiredBuffers
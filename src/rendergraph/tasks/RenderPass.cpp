@@ -36,10 +36,20 @@ void RenderPass::setup(
 
 void RenderPass::execute(
 	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	beginRendering(commandBuffer, resources);
+	bindState(commandBuffer, resources);
+}
+
+void RenderPass::beginRendering(
+	vk::CommandBuffer& commandBuffer,
+	const Resources& resources,
+	vk::RenderingFlags flags
 ) {
 	assert(m_attachments.color.has_value() || m_attachments.depth.has_value());
 
 	vk::RenderingInfoKHR renderingInfo {
+		.flags = flags,
 		.renderArea = vk::Rect2D({ 0, 0 }, { 800, 600 }),
 		.layerCount = 1,
 		.viewMask = 0,
@@ -48,6 +58,8 @@ void RenderPass::execute(
 	};
 	vk::RenderingAttachmentInfo colorAttachment;
 	uint32_t width, height;
+	m_colorFormat = vk::Format::eUndefined;
+	m_depthFormat = vk::Format::eUndefined;
 	if (m_attachments.color.has_value()) {
 		Image& color = resources.resourceManager.getNamedImage(
 			m_attachments.color.value().name
@@ -57,19 +69,17 @@ void RenderPass::execute(
 			.imageView = color.accesses[resources.currentFrame].view,
 			.imageLayout = color.accesses[resources.currentFrame].layout,
 	
-			.loadOp = vk::AttachmentLoadOp::eClear,
+			.loadOp = m_attachments.color->clear ? vk::AttachmentLoadOp::eClear
+			                                     : vk::AttachmentLoadOp::eLoad,
 			.storeOp = vk::AttachmentStoreOp::eStore,
-			.clearValue = { .color =
-								vk::ClearColorValue {
-									.float32 =
-										std::array<float, 4> {
-											0.f, 0.f, 0.f, 0.f }, }, },
+			.clearValue = { .color = m_attachments.color->clearColor },
 		};
 
 		renderingInfo.colorAttachmentCount = 1;
 		renderingInfo.pColorAttachments = &colorAttachment;
 		width = color.size.width;
 		height = color.size.height;
+		m_colorFormat = color.format;
 	}
 
 	vk::RenderingAttachmentInfo depthAttachment;
@@ -79,7 +89,8 @@ void RenderPass::execute(
 		depthAttachment = {
 			.imageView = depth.accesses[resources.currentFrame].view,
 			.imageLayout = depth.accesses[resources.currentFrame].layout,
-			.loadOp = vk::AttachmentLoadOp::eClear,
+			.loadOp = m_attachments.depth->clear ? vk::AttachmentLoadOp::eClear
+			                                     : vk::AttachmentLoadOp::eLoad,
 			.storeOp = vk::AttachmentStoreOp::eStore,
 			.clearValue = { .depthStencil = { 1, 1 } },
 		};
@@ -87,28 +98,38 @@ void RenderPass::execute(
 		renderingInfo.pDepthAttachment = &depthAttachment;
 		width = depth.size.width;
 		height = depth.size.height;
+		m_depthFormat = depth.format;
 	}
+	m_extent = vk::Extent2D { width, height };
 
 	commandBuffer.beginRendering(renderingInfo);
+}
+
+void RenderPass::bindState(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
 	commandBuffer.setScissor(
 		0,
 		{
-			vk::Rect2D { { 0, 0 }, { width, height } }
+			vk::Rect2D { { 0, 0 }, m_extent }
     }
 	);
 
 	commandBuffer.setViewport(
 		0,
 		{
-			vk::Viewport { 0, 0, (float)width, (float)height, 0, 1 }
+			vk::Viewport {
+				0, 0, (float)m_extent.width, (float)m_extent.height, 0, 1 }
     }
 	);
+	const Pipeline& pipeline = getPipeline();
 	commandBuffer.bindPipeline(
-		vk::PipelineBindPoint::eGraphics, m_material->pipeline.pipeline
+		vk::PipelineBindPoint::eGraphics, pipeline.pipeline
 	);
 
-	Buffer& vertexBuffer =
-		resources.resourceManager.getNamedBuffer("vertex_buffer");
+	Buffer& vertexBuffer = resources.resourceManager.getNamedBuffer(
+		m_variant == Variant::Shaded ? "vertex_buffer" : "position_buffer"
+	);
 	Buffer& indexBuffer =
 		resources.resourceManager.getNamedBuffer("index_buffer");
 
@@ -119,9 +140,30 @@ void RenderPass::execute(
 
 	commandBuffer.bindDescriptorSets(
 		vk::PipelineBindPoint::eGraphics,
-		m_material->pipeline.pipelineLayout,
+		pipeline.pipelineLayout,
 		0,
 		{ m_material->globalSet.set },
 		{}
 	);
-}
\ No newline at end of file
+	// Bound once, draws only select their entry of the material table
+	if (m_material->bindless && m_variant == Variant::Shaded) {
+		commandBuffer.bindDescriptorSets(
+			vk::PipelineBindPoint::eGraphics,
+			pipeline.pipelineLayout,
+			1,
+			{ m_material->materialSet.set },
+			{}
+		);
+	}
+}
+
+vk::CommandBufferInheritanceRenderingInfoKHR RenderPass::getInheritance(
+) const {
+	return {
+		.colorAttachmentCount =
+			m_colorFormat == vk::Format::eUndefined ? 0u : 1u,
+		.pColorAttachmentFormats = &m_colorFormat,
+		.depthAttachmentFormat = m_depthFormat,
+		.rasterizationSamples = vk::SampleCountFlagBits::e1,
+	};
+}
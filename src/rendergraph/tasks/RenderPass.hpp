@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <vulkan/vulkan.hpp>
@@ -13,6 +14,7 @@ public:
 	struct Attachment {
 		std::string_view name;
 		bool clear;
+		vk::ClearColorValue clearColor = {};
 	};
 	struct Attachments {
 		std::optional<Attachment> color;
@@ -21,9 +23,43 @@ public:
 
 private:
 	Attachments m_attachments;
+	// Of the rendering begun last
+	vk::Extent2D m_extent;
+	vk::Format m_colorFormat = vk::Format::eUndefined;
+	vk::Format m_depthFormat = vk::Format::eUndefined;
 
 protected:
+	enum class Variant : uint8_t {
+		Shaded,
+		// Material::depthPipeline, reading the position stream
+		DepthOnly,
+		// Material::visibilityPipeline, reading the position stream
+		Visibility,
+	};
+
 	std::shared_ptr<Material> m_material;
+	Variant m_variant = Variant::Shaded;
+
+	inline const Pipeline& getPipeline() const {
+		switch (m_variant) {
+			case Variant::DepthOnly: return *m_material->depthPipeline;
+			case Variant::Visibility: return *m_material->visibilityPipeline;
+			default: return m_material->pipeline;
+		}
+	}
+
+	// With eContentsSecondaryCommandBuffers, draws are recorded in secondary
+	// command buffers inheriting getInheritance, each calling bindState
+	void beginRendering(
+		vk::CommandBuffer& commandBuffer,
+		const Resources& resources,
+		vk::RenderingFlags flags = {}
+	);
+	// Viewport, pipeline, geometry and the sets shared by every draw
+	void bindState(
+		vk::CommandBuffer& commandBuffer, const Resources& resources
+	);
+	vk::CommandBufferInheritanceRenderingInfoKHR getInheritance() const;
 
 public:
 	RenderPass(std::shared_ptr<Material> material) : m_material(material) {}
@@ -14,4 +14,9 @@ public:
 	virtual void execute(
 		vk::CommandBuffer& buffer, const Resources& resources
 	) = 0;
+	// Compute tasks recording no graphics commands may ask for the async
+	// compute queue
+	virtual QueueAffinity getQueueAffinity() const {
+		return QueueAffinity::GRAPHICS;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "VisibilityPass.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+
+#include "RenderPass.hpp"
+
+void VisibilityPass::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	// Passes that do not clear load the IDs and depth written before them
+	vk::AccessFlags2 loadAccess = {};
+	if (!m_clear) loadAccess = vk::AccessFlagBits2::eColorAttachmentRead;
+	requiredImages.push_back({
+		.name = "visibility_buffer",
+		.usage =
+		{
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eColorAttachmentWrite | loadAccess,
+			.stage = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+		},
+		.requiredLayout = vk::ImageLayout::eColorAttachmentOptimal,
+	});
+	requiredImages.push_back({
+		.name = "main_depth",
+		.usage =
+		{
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+			          vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+			.stage = vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+			         vk::PipelineStageFlagBits2::eLateFragmentTests,
+		},
+		.requiredLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal,
+	});
+
+	RenderPass::setAttachments({
+		.color =
+			Attachment {
+				"visibility_buffer",
+				m_clear,
+				{ .uint32 = std::array<uint32_t, 4> {
+					  VISIBILITY_EMPTY,
+					  VISIBILITY_EMPTY,
+					  VISIBILITY_EMPTY,
+					  VISIBILITY_EMPTY,
+				  } },
+			},
+		.depth = Attachment { "main_depth", m_clear },
+	});
+
+	requiredBuffers.push_back({
+		.name = "position_buffer",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eVertexAttributeRead,
+			.stage = vk::PipelineStageFlagBits2::eVertexAttributeInput,
+		},
+	});
+	setupDraws(requiredBuffers);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "OpaquePass.hpp"
+#include "Task.hpp"
+#include "material/MaterialManager.hpp"
+
+// Pixels of "visibility_buffer" hold the draw instance in the high bits and
+// the triangle within the draw in the low ones, see visibility.frag. Cleared
+// to VISIBILITY_EMPTY.
+constexpr uint32_t VISIBILITY_TRIANGLE_BITS = 18;
+constexpr uint32_t VISIBILITY_MAX_INSTANCES =
+	(1u << (32 - VISIBILITY_TRIANGLE_BITS)) - 1;
+constexpr uint32_t VISIBILITY_MAX_TRIANGLES = 1u << VISIBILITY_TRIANGLE_BITS;
+constexpr uint32_t VISIBILITY_EMPTY = ~0u;
+
+// Draws the same primitives as an OpaquePass, writing only their IDs and
+// depth. VisibilityResolve then shades every covered pixel once. The
+// material must be bindless with a visibility pipeline.
+class VisibilityPass : public OpaquePass {
+public:
+	VisibilityPass(
+		std::shared_ptr<Material> material,
+		bool clear,
+		DrawMode drawMode = DrawMode::Instanced,
+		bool cacheCommands = false,
+		float lodThreshold = 1.f
+	) :
+		OpaquePass(material, clear, drawMode, cacheCommands, lodThreshold) {
+		m_variant = Variant::Visibility;
+	}
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+};
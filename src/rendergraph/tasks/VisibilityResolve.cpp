@@ -0,0 +1,194 @@
+#include "VisibilityResolve.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "material/Pipeline.hpp"
+#include "rendergraph/RenderGraph.hpp"
+
+constexpr uint32_t RESOLVE_GROUP_SIZE = 8;
+
+enum ResolveBinding : uint32_t {
+	VISIBILITY_BINDING,
+	COLOR_BINDING,
+	INSTANCES_BINDING,
+	INDICES_BINDING,
+	VERTICES_BINDING,
+	CAMERA_BINDING,
+	RESOLVE_BINDING_COUNT,
+};
+
+vk::DescriptorType getDescriptorType(uint32_t binding) {
+	switch (binding) {
+		case VISIBILITY_BINDING:
+		case COLOR_BINDING: return vk::DescriptorType::eStorageImage;
+		case CAMERA_BINDING: return vk::DescriptorType::eUniformBuffer;
+		default: return vk::DescriptorType::eStorageBuffer;
+	}
+}
+
+VisibilityResolve::VisibilityResolve(
+	vk::Device& device,
+	std::shared_ptr<Material> material,
+	VertexFormat vertexFormat,
+	std::string_view instances
+) :
+	m_material(material), m_instances(instances) {
+	assert(m_material->bindless);
+
+	std::array<vk::DescriptorSetLayoutBinding, RESOLVE_BINDING_COUNT>
+		bindings;
+	for (uint32_t i = 0; i < bindings.size(); i++) {
+		bindings[i] = {
+			.binding = i,
+			.descriptorType = getDescriptorType(i),
+			.descriptorCount = 1,
+			.stageFlags = vk::ShaderStageFlagBits::eCompute,
+		};
+	}
+
+	m_layout = device.createDescriptorSetLayout({
+		.flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+		.bindingCount = (uint32_t)bindings.size(),
+		.pBindings = bindings.data(),
+	});
+
+	// Same vertex decoding switch as main.vert
+	vk::Bool32 compactVertices = vertexFormat == VertexFormat::Compact;
+	vk::SpecializationMapEntry entry {
+		.constantID = 0,
+		.offset = 0,
+		.size = sizeof(vk::Bool32),
+	};
+	vk::SpecializationInfo specialization {
+		.mapEntryCount = 1,
+		.pMapEntries = &entry,
+		.dataSize = sizeof(vk::Bool32),
+		.pData = &compactVertices,
+	};
+
+	// Set 1 is the bindless material set, bound as is
+	m_pipeline = PipelineBuilder::ComputePipeline({
+		.device = device,
+		.compute = "resources/shaders/visibility_resolve.comp.spv",
+		.layouts = { m_layout, m_material->materialSet.layout },
+		.specialization = &specialization,
+	});
+}
+
+void VisibilityResolve::setup(
+	std::vector<ImageDependencyInfo>& requiredImages,
+	std::vector<BufferDependencyInfo>& requiredBuffers
+) {
+	requiredImages.push_back({
+		.name = "visibility_buffer",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eShaderStorageRead,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+		.requiredLayout = vk::ImageLayout::eGeneral,
+	});
+	requiredImages.push_back({
+		.name = "main_color",
+		.usage = {
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eShaderStorageWrite,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+		.requiredLayout = vk::ImageLayout::eGeneral,
+	});
+
+	for (auto name : { m_instances, std::string_view("index_buffer"),
+	                   std::string_view("vertex_buffer") }) {
+		requiredBuffers.push_back({
+			.name = name,
+			.usage = {
+				.type = ResourceUsage::Type::READ,
+				.access = vk::AccessFlagBits2::eShaderStorageRead,
+				.stage = vk::PipelineStageFlagBits2::eComputeShader,
+			},
+		});
+	}
+	requiredBuffers.push_back({
+		.name = "gset_buffer",
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eUniformRead,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	});
+}
+
+void VisibilityResolve::execute(
+	vk::CommandBuffer& commandBuffer, const Resources& resources
+) {
+	ResourceManager& resourceManager = resources.resourceManager;
+	uint8_t frame = resources.currentFrame;
+
+	Image& visibility = resourceManager.getNamedImage("visibility_buffer");
+	Image& color = resourceManager.getNamedImage("main_color");
+	std::array<vk::DescriptorImageInfo, 2> imageInfos {
+		vk::DescriptorImageInfo {
+			.imageView = visibility.accesses[frame].view,
+			.imageLayout = vk::ImageLayout::eGeneral,
+		},
+		vk::DescriptorImageInfo {
+			.imageView = color.accesses[frame].view,
+			.imageLayout = vk::ImageLayout::eGeneral,
+		},
+	};
+
+	auto bufferInfo = [&](std::string_view name) {
+		Buffer& buffer = resourceManager.getNamedBuffer(name);
+		uint8_t accessIndex = buffer.transient ? frame : 0;
+		return vk::DescriptorBufferInfo {
+			.buffer = buffer.buffer,
+			.offset = buffer.bufferAccess[accessIndex].offset,
+			.range = buffer.bufferAccess[accessIndex].length,
+		};
+	};
+	std::array<vk::DescriptorBufferInfo, 4> bufferInfos {
+		bufferInfo(m_instances),
+		bufferInfo("index_buffer"),
+		bufferInfo("vertex_buffer"),
+		bufferInfo("gset_buffer"),
+	};
+
+	std::array<vk::WriteDescriptorSet, RESOLVE_BINDING_COUNT> writes;
+	for (uint32_t i = 0; i < writes.size(); i++) {
+		writes[i] = {
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = getDescriptorType(i),
+		};
+		if (i < imageInfos.size())
+			writes[i].pImageInfo = &imageInfos[i];
+		else
+			writes[i].pBufferInfo = &bufferInfos[i - imageInfos.size()];
+	}
+
+	commandBuffer.bindPipeline(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipeline
+	);
+	commandBuffer.pushDescriptorSetKHR(
+		vk::PipelineBindPoint::eCompute, m_pipeline.pipelineLayout, 0, writes
+	);
+	commandBuffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eCompute,
+		m_pipeline.pipelineLayout,
+		1,
+		{ m_material->materialSet.set },
+		{}
+	);
+	commandBuffer.dispatch(
+		(color.size.width + RESOLVE_GROUP_SIZE - 1) / RESOLVE_GROUP_SIZE,
+		(color.size.height + RESOLVE_GROUP_SIZE - 1) / RESOLVE_GROUP_SIZE,
+		1
+	);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Task.hpp"
+#include "Vertex.hpp"
+#include "material/MaterialManager.hpp"
+#include "material/Pipeline.hpp"
+
+// Shades every pixel of "visibility_buffer" once into "main_color". The
+// triangle of each ID is fetched from the index and vertex buffers, its
+// attributes interpolated with barycentrics rebuilt at the pixel, and the
+// bindless material sampled with their screen space derivatives.
+class VisibilityResolve : public Task {
+private:
+	vk::DescriptorSetLayout m_layout;
+	Pipeline m_pipeline;
+	std::shared_ptr<Material> m_material;
+	// "instance_buffer" or "gpu_instances", written for the visibility pass
+	std::string_view m_instances;
+
+public:
+	VisibilityResolve(
+		vk::Device& device,
+		std::shared_ptr<Material> material,
+		VertexFormat vertexFormat,
+		std::string_view instances
+	);
+
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override;
+	void execute(vk::CommandBuffer& commandBuffer, const Resources& resources)
+		override;
+};
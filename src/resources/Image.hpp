@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <optional>
 #include <vector>
 #include <vulkan/vulkan.hpp>
@@ -34,3 +36,11 @@ struct Image {
 		return flags;
 	}
 };
+
+// Decoded RGBA8 pixels, ready to be uploaded
+struct ImageData {
+	uint32_t x;
+	uint32_t y;
+	uint8_t channels;
+	std::vector<std::byte> data;
+};
@@ -1,10 +1,12 @@
 #include "ResourceManager.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <vector>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
@@ -32,6 +34,12 @@ ResourceManager::ResourceManager(
 		.flags = vk::CommandPoolCreateFlagBits::eTransient,
 		.queueFamilyIndex = instance.queueFamiliesIndices.transferIndex,
 	});
+	m_transferCommands = m_device.allocateCommandBuffers({
+		.commandPool = m_commandPool,
+		.level = vk::CommandBufferLevel::ePrimary,
+		.commandBufferCount = 1,
+	})[0];
+	m_transferFence = m_device.createFence({});
 }
 
 BufferHandle ResourceManager::createBuffer(const BufferDescription &description
@@ -152,14 +160,7 @@ ImageHandle ResourceManager::createImage(const ImageDescription &description) {
 	return handle;
 }
 
-struct ImageData {
-	uint32_t x;
-	uint32_t y;
-	uint8_t channels;
-	std::vector<std::byte> data;
-};
-
-ImageData load(const std::filesystem::path &image) {
+ImageData ResourceManager::DecodeImage(const std::filesystem::path &image) {
 	assert(!image.empty());
 
 	int x, y, _;
@@ -183,7 +184,10 @@ ImageData load(const std::filesystem::path &image) {
 	};
 }
 ImageHandle ResourceManager::loadImage(const std::filesystem::path &path) {
-	ImageData data = load(path);
+	return uploadImage(DecodeImage(path));
+}
+
+ImageHandle ResourceManager::uploadImage(const ImageData &data) {
 	ImageDescription description {
 		.width = data.x,
 		.height = data.y,
@@ -194,116 +198,15 @@ ImageHandle ResourceManager::loadImage(const std::filesystem::path &path) {
 	};
 
 	ImageHandle image = createImage(description);
-
-	BufferHandle staging = createStagingBuffer(data.data.size());
-
-	copyToBuffer(data.data, staging);
-
-	copyToImage(staging, image, {
-		.bufferOffset = 0,
-		.bufferRowLength = data.x,
-		.bufferImageHeight = data.y,
-		.imageSubresource = {
-			.aspectMask = vk::ImageAspectFlagBits::eColor,
-			.mipLevel = 0,
-			.baseArrayLayer = 0,
-			.layerCount = 1,
-		},
-		.imageOffset = {0,0,0},
-		.imageExtent = {
-			.width = data.x,
-			.height = data.y,
-			.depth = 1
-		},
-		
-		
-	});
-
-	free(staging);
-	return image;
-}
-
-BufferHandle ResourceManager::createStagingBuffer(uint32_t size) {
-	vk::BufferCreateInfo info {
-		.size = size,
-		.usage = vk::BufferUsageFlagBits::eTransferSrc,
-	};
-	vk::Buffer buffer = m_device.createBuffer(info);
-	SubAllocation allocation = m_memoryAllocator.allocate(
-		buffer, AllocationType::Staging, AllocationLocation::Host
-	);
-	BufferHandle handle { m_resourceCounter };
-	m_resourceCounter++;
-
-	m_buffers[handle.value] = Buffer { .buffer = buffer,
-		                               .allocation = allocation,
-		                               .size = size,
-		                               .bufferAccess = { BufferAccess {
-										   .length = size,
-										   .offset = 0,
-									   }, }, };
-
-	return handle;
-}
-ImageHandle ResourceManager::registerImage(Image image) {
-	ImageHandle handle { m_resourceCounter };
-	m_resourceCounter++;
-
-	m_images[handle.value] = image;
-	return handle;
-}
-void ResourceManager::copyBuffer(
-	BufferHandle origin, BufferHandle destination, vk::BufferCopy offset
-) {
-	vk::CommandBufferAllocateInfo commandBufferInfo {
-		.commandPool = m_commandPool,
-		.level = vk::CommandBufferLevel::ePrimary,
-		.commandBufferCount = 1,
-
-	};
-	vk::CommandBuffer commandBuffer =
-		m_device.allocateCommandBuffers(commandBufferInfo)[0];
-
-	vk::CommandBufferBeginInfo beginInfo {
-		.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit
-	};
-	commandBuffer.begin(beginInfo);
-
-	commandBuffer.copyBuffer(
-		m_buffers[origin.value].buffer,
-		m_buffers[destination.value].buffer,
-		offset
-	);
-	commandBuffer.end();
-	vk::SubmitInfo submitInfo { .commandBufferCount = 1,
-		                        .pCommandBuffers = &commandBuffer };
-
-	m_queue.submit({ submitInfo });
-};
-void ResourceManager::copyToImage(
-	BufferHandle origin, ImageHandle destination, vk::BufferImageCopy offset
-) {
-	vk::CommandBufferAllocateInfo commandBufferInfo {
-		.commandPool = m_commandPool,
-		.level = vk::CommandBufferLevel::ePrimary,
-		.commandBufferCount = 1,
-
-	};
-
-	vk::CommandBuffer commandBuffer =
-		m_device.allocateCommandBuffers(commandBufferInfo)[0];
-
-	vk::CommandBufferBeginInfo beginInfo {
-		.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit
-	};
-	commandBuffer.begin(beginInfo);
+	uint32_t stagingOffset = stage(data.data);
+	vk::CommandBuffer &commandBuffer = getTransferCommands();
 
 	vk::ImageMemoryBarrier2 barrier {
         .dstStageMask = vk::PipelineStageFlagBits2::eAllTransfer,
         .dstAccessMask = vk::AccessFlagBits2::eTransferWrite,
         .oldLayout = vk::ImageLayout::eUndefined,
         .newLayout = vk::ImageLayout::eTransferDstOptimal,
-        .image = m_images[destination.value].image,
+        .image = m_images[image.value].image,
         .subresourceRange = {
             .aspectMask = vk::ImageAspectFlagBits::eColor,
             .baseMipLevel = 0,
@@ -317,17 +220,33 @@ void ResourceManager::copyToImage(
 		.pImageMemoryBarriers = &barrier,
 	});
 	commandBuffer.copyBufferToImage(
-		m_buffers[origin.value].buffer,
-		m_images[destination.value].image,
+		m_stagingBuffer,
+		m_images[image.value].image,
 		vk::ImageLayout::eTransferDstOptimal,
-		{ offset }
+		vk::BufferImageCopy {
+			.bufferOffset = stagingOffset,
+			.bufferRowLength = data.x,
+			.bufferImageHeight = data.y,
+			.imageSubresource = {
+				.aspectMask = vk::ImageAspectFlagBits::eColor,
+				.mipLevel = 0,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+			.imageOffset = {0,0,0},
+			.imageExtent = {
+				.width = data.x,
+				.height = data.y,
+				.depth = 1
+			},
+		}
 	);
 	barrier = {
         .srcStageMask = vk::PipelineStageFlagBits2::eAllTransfer,
         .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
         .oldLayout = vk::ImageLayout::eTransferDstOptimal,
         .newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
-        .image = m_images[destination.value].image,
+        .image = m_images[image.value].image,
         .subresourceRange = {
             .aspectMask = vk::ImageAspectFlagBits::eColor,
             .baseMipLevel = 0,
@@ -339,33 +258,121 @@ void ResourceManager::copyToImage(
 	commandBuffer.pipelineBarrier2({
 		.imageMemoryBarrierCount = 1,
 		.pImageMemoryBarriers = &barrier,
-
 	});
-	commandBuffer.end();
-	vk::SubmitInfo submitInfo {
-		.commandBufferCount = 1,
-		.pCommandBuffers = &commandBuffer,
-	};
 
-	m_queue.submit({ submitInfo });
+	return image;
 }
 
+ImageHandle ResourceManager::registerImage(Image image) {
+	ImageHandle handle { m_resourceCounter };
+	m_resourceCounter++;
+
+	m_images[handle.value] = image;
+	return handle;
+}
 void ResourceManager::copyToBuffer(
-	const std::vector<std::byte> &data, BufferHandle handle
+	const std::vector<std::byte> &data, BufferHandle handle, uint32_t offset
 ) {
 	Buffer &buffer = m_buffers[handle.value];
 	if (buffer.allocation.address != nullptr) {
-		memcpy((char *)buffer.allocation.address, data.data(), data.size());
+		memcpy(
+			(char *)buffer.allocation.address + offset, data.data(), data.size()
+		);
 		return;
 	}
 
-	BufferHandle staging = createStagingBuffer(data.size());
-	std::memcpy(
-		(char *)m_buffers[staging.value].allocation.address,
-		data.data(),
-		data.size()
+	uint32_t stagingOffset = stage(data);
+	getTransferCommands().copyBuffer(
+		m_stagingBuffer,
+		buffer.buffer,
+		vk::BufferCopy {
+			.srcOffset = stagingOffset,
+			.dstOffset = offset,
+			.size = data.size(),
+		}
 	);
+}
 
-	copyBuffer(staging, handle, { .size = data.size() });
-	free(staging);
+uint32_t ResourceManager::stage(const std::vector<std::byte> &bytes) {
+	assert(!m_transfersPending);
+	if (bytes.size() > getStagingSpace()) {
+		// Callers keep within the space left, otherwise the copies recorded
+		// so far are flushed before the buffer is reused
+		if (m_recordingTransfers) {
+			submitTransfers();
+			waitTransfers();
+		}
+		if (bytes.size() > getStagingSpace()) reserveStaging(bytes.size());
+	}
+
+	uint32_t offset = m_stagingUsed;
+	std::memcpy(m_stagingAddress + offset, bytes.data(), bytes.size());
+	m_stagingUsed = std::min<uint32_t>(
+		(offset + bytes.size() + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT *
+			STAGING_ALIGNMENT,
+		m_stagingSize
+	);
+	return offset;
+}
+
+vk::CommandBuffer &ResourceManager::getTransferCommands() {
+	assert(!m_transfersPending);
+	if (!m_recordingTransfers) {
+		m_transferCommands.begin(vk::CommandBufferBeginInfo {
+			.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		});
+		m_recordingTransfers = true;
+	}
+	return m_transferCommands;
+}
+
+void ResourceManager::reserveStaging(uint32_t size) {
+	assert(!m_recordingTransfers && !m_transfersPending);
+	if (size <= m_stagingSize) return;
+
+	// Staging allocations wrap around, the old range is simply reused
+	if (m_stagingBuffer) m_device.destroyBuffer(m_stagingBuffer);
+	m_stagingBuffer = m_device.createBuffer({
+		.size = size,
+		.usage = vk::BufferUsageFlagBits::eTransferSrc,
+	});
+	SubAllocation allocation = m_memoryAllocator.allocate(
+		m_stagingBuffer, AllocationType::Staging, AllocationLocation::Host
+	);
+	m_stagingAddress = (std::byte *)allocation.address;
+	m_stagingSize = size;
+}
+
+void ResourceManager::submitTransfers() {
+	if (!m_recordingTransfers) return;
+	m_transferCommands.end();
+	m_queue.submit(
+		vk::SubmitInfo {
+			.commandBufferCount = 1,
+			.pCommandBuffers = &m_transferCommands,
+		},
+		m_transferFence
+	);
+	m_recordingTransfers = false;
+	m_transfersPending = true;
+}
+
+bool ResourceManager::transfersDone() {
+	if (!m_transfersPending) return true;
+	if (m_device.getFenceStatus(m_transferFence) != vk::Result::eSuccess)
+		return false;
+
+	m_device.resetFences(m_transferFence);
+	m_device.resetCommandPool(m_commandPool);
+	m_stagingUsed = 0;
+	m_transfersPending = false;
+	return true;
+}
+
+void ResourceManager::waitTransfers() {
+	if (!m_transfersPending) return;
+	auto _ = m_device.waitForFences(
+		{ m_transferFence }, vk::True, std::numeric_limits<uint64_t>::max()
+	);
+	transfersDone();
 }
@@ -6,6 +6,7 @@
 #include <optional>
 #include <set>
 #include <string_view>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "Buffer.hpp"
@@ -40,10 +41,27 @@ private:
 	// TODO: indexing, for now we can't initialize more than 2^32 resources
 	uint32_t m_resourceCounter = 0;
 
+	// Copies to device local memory are recorded in one command buffer,
+	// reading from a staging buffer reused once their submission completed
+	vk::Buffer m_stagingBuffer;
+	std::byte* m_stagingAddress = nullptr;
+	uint32_t m_stagingSize = 0;
+	uint32_t m_stagingUsed = 0;
+	vk::CommandBuffer m_transferCommands;
+	bool m_recordingTransfers = false;
+	vk::Fence m_transferFence;
+	bool m_transfersPending = false;
+
+	// Copies `bytes` to the staging buffer and returns their offset
+	uint32_t stage(const std::vector<std::byte>& bytes);
+	vk::CommandBuffer& getTransferCommands();
+
 public:
+	// Every staged copy starts at a multiple of it, as image copies need
+	static constexpr uint32_t STAGING_ALIGNMENT = 16;
+
 	ResourceManager(Instance& instance, MemoryAllocator& memoryAllocator);
 
-	BufferHandle createStagingBuffer(uint32_t size);
 	BufferHandle createBuffer(const BufferDescription& description);
 	inline BufferHandle createBuffer(
 		std::string_view name, const BufferDescription& description
@@ -63,20 +81,29 @@ public:
 	}
 
 	ImageHandle loadImage(const std::filesystem::path& path);
+	// Decoding only touches the CPU, so it can run outside the render thread
+	static ImageData DecodeImage(const std::filesystem::path& path);
+	ImageHandle uploadImage(const ImageData& data);
 
+	// Lookups do not insert, so threads recording commands can call them
+	// concurrently
 	inline Image& getNamedImage(std::string_view name) {
 		assert(m_imageNames.contains(name));
-		return m_images[m_imageNames[name]];
+		return m_images.at(m_imageNames.at(name));
 	}
 	inline Buffer& getNamedBuffer(std::string_view name) {
 		assert(m_bufferNames.contains(name));
-		return m_buffers[m_bufferNames[name]];
+		return m_buffers.at(m_bufferNames.at(name));
+	}
+	inline BufferHandle getNamedBufferHandle(std::string_view name) {
+		assert(m_bufferNames.contains(name));
+		return { m_bufferNames.at(name) };
 	}
 	inline Image& getImage(ImageHandle handle) {
-		return m_images[handle.value];
+		return m_images.at(handle.value);
 	}
 	inline Buffer& getBuffer(BufferHandle handle) {
-		return m_buffers[handle.value];
+		return m_buffers.at(handle.value);
 	}
 
 	inline void setName(std::string_view name, ImageHandle handle) {
@@ -87,16 +114,30 @@ public:
 	}
 
 	ImageHandle registerImage(Image image);
-
-	void copyToBuffer(const std::vector<std::byte>& bytes, BufferHandle);
-
-	void copyBuffer(
-		BufferHandle source, BufferHandle destination, vk::BufferCopy offset
-	);
-	void copyToImage(
-		BufferHandle origin, ImageHandle destination, vk::BufferImageCopy offset
+	// Grows with every created or registered resource
+	inline uint32_t getResourceCount() const { return m_resourceCounter; }
+
+	// Host visible buffers are written directly, copies to the others are
+	// recorded and run once submitTransfers is called
+	void copyToBuffer(
+		const std::vector<std::byte>& bytes,
+		BufferHandle,
+		uint32_t offset = 0
 	);
 
+	// Staging memory left for the copies recorded before the next
+	// submission. A single copy larger than the whole buffer grows it.
+	inline uint32_t getStagingSpace() const {
+		return m_stagingSize - m_stagingUsed;
+	}
+	// No copy may be recorded or running
+	void reserveStaging(uint32_t size);
+	void submitTransfers();
+	// Whether the submitted copies completed, new ones can only be recorded
+	// once they did
+	bool transfersDone();
+	void waitTransfers();
+
 	void free(BufferHandle buffer) {}
 	void free(ImageHandle buffer) {}
 };
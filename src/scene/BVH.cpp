@@ -0,0 +1,347 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+#include "Primitive.hpp"
+
+namespace {
+
+constexpr uint32_t SAH_BIN_COUNT = 16;
+constexpr uint32_t MAX_LEAF_SIZE = 4;
+
+struct SplitCandidate {
+	uint32_t axis;
+	uint32_t bin;
+	float cost = std::numeric_limits<float>::max();
+};
+
+uint32_t getBin(float centroid, float boundsMin, float boundsExtent) {
+	float bin = (centroid - boundsMin) / boundsExtent * SAH_BIN_COUNT;
+	return std::min((uint32_t)bin, SAH_BIN_COUNT - 1);
+}
+
+SplitCandidate findSplit(
+	const std::vector<AABB>& bounds,
+	const uint32_t* indices,
+	uint32_t count,
+	const AABB& centroidBounds
+) {
+	SplitCandidate best;
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if (extent <= 0) continue;
+
+		std::array<AABB, SAH_BIN_COUNT> binBounds;
+		std::array<uint32_t, SAH_BIN_COUNT> binCounts {};
+		for (uint32_t i = 0; i < count; i++) {
+			const AABB& primitive = bounds[indices[i]];
+			uint32_t bin = getBin(
+				primitive.center()[axis], centroidBounds.min[axis], extent
+			);
+			binBounds[bin].grow(primitive);
+			binCounts[bin]++;
+		}
+
+		// Sweep from the right first, so the left sweep can evaluate every
+		// split plane in one pass
+		std::array<float, SAH_BIN_COUNT> rightCosts;
+		AABB right;
+		uint32_t rightCount = 0;
+		for (uint32_t bin = SAH_BIN_COUNT - 1; bin > 0; bin--) {
+			right.grow(binBounds[bin]);
+			rightCount += binCounts[bin];
+			rightCosts[bin] = rightCount > 0 ? rightCount * right.area() : 0;
+		}
+
+		AABB left;
+		uint32_t leftCount = 0;
+		for (uint32_t bin = 1; bin < SAH_BIN_COUNT; bin++) {
+			left.grow(binBounds[bin - 1]);
+			leftCount += binCounts[bin - 1];
+			if (leftCount == 0 || leftCount == count) continue;
+
+			float cost = leftCount * left.area() + rightCosts[bin];
+			if (cost < best.cost) best = { axis, bin, cost };
+		}
+	}
+	return best;
+}
+
+}  // namespace
+
+AABB BVH::getRangeBounds(uint32_t first, uint32_t count) const {
+	AABB bounds;
+	for (uint32_t i = first; i < first + count; i++)
+		bounds.grow(m_bounds[m_indices[i]]);
+	return bounds;
+}
+
+void BVH::build(const std::vector<AABB>& bounds) {
+	m_bounds = bounds;
+	m_indices.resize(bounds.size());
+	std::iota(m_indices.begin(), m_indices.end(), 0);
+	m_nodes.clear();
+	if (bounds.empty()) return;
+
+	m_nodes.reserve(bounds.size() * 2);
+	m_nodes.push_back({
+		.bounds = getRangeBounds(0, bounds.size()),
+		.first = 0,
+		.count = (uint32_t)bounds.size(),
+	});
+
+	std::vector<uint32_t> stack { 0 };
+	while (!stack.empty()) {
+		uint32_t nodeIndex = stack.back();
+		stack.pop_back();
+
+		Node node = m_nodes[nodeIndex];
+		if (node.count <= MAX_LEAF_SIZE) continue;
+
+		AABB centroidBounds;
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+			centroidBounds.grow(m_bounds[m_indices[i]].center());
+
+		SplitCandidate split = findSplit(
+			m_bounds, &m_indices[node.first], node.count, centroidBounds
+		);
+		// Splitting has to beat intersecting every primitive of the node
+		if (split.cost >= node.count * node.bounds.area()) continue;
+
+		float boundsMin = centroidBounds.min[split.axis];
+		float extent = centroidBounds.max[split.axis] - boundsMin;
+		auto middle = std::partition(
+			m_indices.begin() + node.first,
+			m_indices.begin() + node.first + node.count,
+			[&](uint32_t primitive) {
+				float centroid = m_bounds[primitive].center()[split.axis];
+				return getBin(centroid, boundsMin, extent) < split.bin;
+			}
+		);
+		uint32_t leftCount = middle - (m_indices.begin() + node.first);
+
+		uint32_t left = m_nodes.size();
+		m_nodes.push_back({
+			.bounds = getRangeBounds(node.first, leftCount),
+			.first = node.first,
+			.count = leftCount,
+		});
+		m_nodes.push_back({
+			.bounds = getRangeBounds(
+				node.first + leftCount, node.count - leftCount
+			),
+			.first = node.first + leftCount,
+			.count = node.count - leftCount,
+		});
+		m_nodes[nodeIndex].first = left;
+		m_nodes[nodeIndex].count = 0;
+
+		stack.push_back(left);
+		stack.push_back(left + 1);
+	}
+}
+
+void BVH::refit(const std::vector<AABB>& bounds) {
+	assert(bounds.size() == m_bounds.size());
+	m_bounds = bounds;
+
+	for (uint32_t i = m_nodes.size(); i-- > 0;) {
+		Node& node = m_nodes[i];
+		if (node.count > 0) {
+			node.bounds = getRangeBounds(node.first, node.count);
+			continue;
+		}
+
+		node.bounds = m_nodes[node.first].bounds;
+		node.bounds.grow(m_nodes[node.first + 1].bounds);
+	}
+}
+
+void BVH::collect(uint32_t node, std::vector<uint32_t>& result) const {
+	std::vector<uint32_t> stack { node };
+	while (!stack.empty()) {
+		const Node& current = m_nodes[stack.back()];
+		stack.pop_back();
+
+		if (current.count > 0) {
+			result.insert(
+				result.end(),
+				m_indices.begin() + current.first,
+				m_indices.begin() + current.first + current.count
+			);
+			continue;
+		}
+		stack.push_back(current.first);
+		stack.push_back(current.first + 1);
+	}
+}
+
+namespace {
+
+enum class Containment {
+	OUTSIDE,
+	INTERSECTING,
+	INSIDE,
+};
+
+Containment classify(
+	const AABB& bounds, const std::array<glm::vec4, 6>& planes
+) {
+	Containment containment = Containment::INSIDE;
+	for (const auto& plane : planes) {
+		glm::vec3 normal(plane);
+		// Corners furthest along and against the plane normal
+		glm::vec3 positive = glm::mix(
+			bounds.min, bounds.max, glm::greaterThanEqual(normal, glm::vec3(0))
+		);
+		glm::vec3 negative = glm::mix(
+			bounds.max, bounds.min, glm::greaterThanEqual(normal, glm::vec3(0))
+		);
+
+		if (glm::dot(normal, positive) + plane.w < 0)
+			return Containment::OUTSIDE;
+		if (glm::dot(normal, negative) + plane.w < 0)
+			containment = Containment::INTERSECTING;
+	}
+	return containment;
+}
+
+}  // namespace
+
+void BVH::queryFrustum(
+	const std::array<glm::vec4, 6>& planes, std::vector<uint32_t>& result
+) const {
+	if (m_nodes.empty()) return;
+
+	std::vector<uint32_t> stack { 0 };
+	while (!stack.empty()) {
+		uint32_t nodeIndex = stack.back();
+		stack.pop_back();
+		const Node& node = m_nodes[nodeIndex];
+
+		Containment containment = classify(node.bounds, planes);
+		if (containment == Containment::OUTSIDE) continue;
+		if (containment == Containment::INSIDE) {
+			collect(nodeIndex, result);
+			continue;
+		}
+
+		if (node.count == 0) {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+			continue;
+		}
+
+		for (uint32_t i = node.first; i < node.first + node.count; i++) {
+			if (classify(m_bounds[m_indices[i]], planes) !=
+			    Containment::OUTSIDE)
+				result.push_back(m_indices[i]);
+		}
+	}
+}
+
+namespace {
+
+bool intersects(const AABB& bounds, glm::vec3 center, float radius) {
+	glm::vec3 closest = glm::clamp(center, bounds.min, bounds.max);
+	glm::vec3 offset = closest - center;
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+}  // namespace
+
+void BVH::querySphere(
+	glm::vec3 center, float radius, std::vector<uint32_t>& result
+) const {
+	if (m_nodes.empty()) return;
+
+	std::vector<uint32_t> stack { 0 };
+	while (!stack.empty()) {
+		const Node& node = m_nodes[stack.back()];
+		stack.pop_back();
+
+		if (!intersects(node.bounds, center, radius)) continue;
+
+		if (node.count == 0) {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+			continue;
+		}
+
+		for (uint32_t i = node.first; i < node.first + node.count; i++) {
+			if (intersects(m_bounds[m_indices[i]], center, radius))
+				result.push_back(m_indices[i]);
+		}
+	}
+}
+
+namespace {
+
+// Entry distance of the ray in the box, or infinity when it is missed
+float intersect(
+	const AABB& bounds, glm::vec3 origin, glm::vec3 inverseDirection
+) {
+	glm::vec3 near = (bounds.min - origin) * inverseDirection;
+	glm::vec3 far = (bounds.max - origin) * inverseDirection;
+	glm::vec3 entry = glm::min(near, far);
+	glm::vec3 exit = glm::max(near, far);
+
+	float entryDistance = glm::max(glm::max(entry.x, entry.y), entry.z);
+	float exitDistance = glm::min(glm::min(exit.x, exit.y), exit.z);
+	if (exitDistance < glm::max(entryDistance, 0.f))
+		return std::numeric_limits<float>::infinity();
+	return glm::max(entryDistance, 0.f);
+}
+
+}  // namespace
+
+std::optional<BVH::RayHit> BVH::raycast(
+	glm::vec3 origin, glm::vec3 direction, float maxDistance
+) const {
+	if (m_nodes.empty()) return std::nullopt;
+
+	glm::vec3 inverseDirection = 1.f / direction;
+	std::optional<RayHit> hit;
+	float closest = maxDistance;
+
+	std::vector<uint32_t> stack { 0 };
+	while (!stack.empty()) {
+		const Node& node = m_nodes[stack.back()];
+		stack.pop_back();
+
+		if (intersect(node.bounds, origin, inverseDirection) > closest)
+			continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				uint32_t primitive = m_indices[i];
+				float distance =
+					intersect(m_bounds[primitive], origin, inverseDirection);
+				if (distance > closest) continue;
+
+				closest = distance;
+				hit = RayHit { .primitive = primitive, .distance = distance };
+			}
+			continue;
+		}
+
+		// Visit the nearest child first, so it can shorten the ray for the
+		// other one
+		uint32_t near = node.first;
+		uint32_t far = node.first + 1;
+		if (intersect(m_nodes[far].bounds, origin, inverseDirection) <
+		    intersect(m_nodes[near].bounds, origin, inverseDirection))
+			std::swap(near, far);
+		stack.push_back(far);
+		stack.push_back(near);
+	}
+	return hit;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "Primitive.hpp"
+
+// Bounding volume hierarchy over world space primitive bounds, built with
+// the binned surface area heuristic. Nodes are stored with children after
+// their parent, so refitting is a single backward pass.
+class BVH {
+public:
+	struct Node;
+	struct RayHit;
+
+private:
+	std::vector<Node> m_nodes;
+	// Leaves reference a contiguous range of primitive indices
+	std::vector<uint32_t> m_indices;
+	std::vector<AABB> m_bounds;
+
+	AABB getRangeBounds(uint32_t first, uint32_t count) const;
+	void collect(uint32_t node, std::vector<uint32_t>& result) const;
+
+public:
+	void build(const std::vector<AABB>& bounds);
+	// Updates node bounds after primitives moved, keeping the topology
+	void refit(const std::vector<AABB>& bounds);
+
+	// Planes in world space with normals pointing inside
+	void queryFrustum(
+		const std::array<glm::vec4, 6>& planes, std::vector<uint32_t>& result
+	) const;
+	void querySphere(
+		glm::vec3 center, float radius, std::vector<uint32_t>& result
+	) const;
+	// Closest primitive whose bounds are hit by the ray
+	std::optional<RayHit> raycast(
+		glm::vec3 origin,
+		glm::vec3 direction,
+		float maxDistance = std::numeric_limits<float>::max()
+	) const;
+
+	inline uint32_t size() const { return m_bounds.size(); }
+	inline uint32_t nodeCount() const { return m_nodes.size(); }
+};
+
+struct BVH::Node {
+	AABB bounds;
+	// Left child for interior nodes, the right one follows it. First index
+	// of the range for leaves.
+	uint32_t first;
+	// Primitives of a leaf, 0 for interior nodes
+	uint32_t count;
+};
+
+struct BVH::RayHit {
+	uint32_t primitive;
+	float distance;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Vertex.hpp"
+
+// Full precision mesh data kept on the CPU while a mesh is processed, before
+// it is encoded into the layout selected for the GPU buffers.
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+};
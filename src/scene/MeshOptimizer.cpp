@@ -0,0 +1,380 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "MeshData.hpp"
+#include "Vertex.hpp"
+
+struct VertexHash {
+	size_t operator()(const Vertex& vertex) const {
+		// FNV-1a over the raw vertex bytes
+		auto bytes = reinterpret_cast<const uint8_t*>(&vertex);
+		size_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(Vertex); i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+};
+
+struct VertexEqual {
+	bool operator()(const Vertex& a, const Vertex& b) const {
+		return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+void MeshOptimizer::WeldVertices(MeshData& mesh) {
+	std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual>
+		uniqueVertices;
+	uniqueVertices.reserve(mesh.vertices.size());
+
+	std::vector<uint32_t> remap(mesh.vertices.size());
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	for (uint32_t i = 0; i < mesh.vertices.size(); i++) {
+		auto [it, inserted] = uniqueVertices.try_emplace(
+			mesh.vertices[i], (uint32_t)vertices.size()
+		);
+		if (inserted) vertices.push_back(mesh.vertices[i]);
+		remap[i] = it->second;
+	}
+
+	for (auto& index : mesh.indices) index = remap[index];
+	mesh.vertices = std::move(vertices);
+}
+
+//// Vertex cache
+
+const uint32_t FORSYTH_CACHE_SIZE = 32;
+
+float getVertexScore(int32_t cachePosition, uint32_t activeTriangles) {
+	const float cacheDecayPower = 1.5f;
+	const float lastTriangleScore = 0.75f;
+	const float valenceBoostScale = 2.0f;
+	const float valenceBoostPower = 0.5f;
+
+	if (activeTriangles == 0) return -1.f;
+
+	float score = 0;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {
+			score = lastTriangleScore;
+		} else {
+			float scale = 1.f / (FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(
+				1.f - (cachePosition - 3) * scale, cacheDecayPower
+			);
+		}
+	}
+
+	return score + valenceBoostScale *
+	                   std::pow((float)activeTriangles, -valenceBoostPower);
+}
+
+void MeshOptimizer::OptimizeVertexCache(MeshData& mesh) {
+	OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+}
+
+void MeshOptimizer::OptimizeVertexCache(
+	std::vector<uint32_t>& indices, uint32_t vertexCount
+) {
+	const uint32_t invalid = std::numeric_limits<uint32_t>::max();
+	uint32_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return;
+
+	// Triangle adjacency, the active triangles of a vertex are kept at the
+	// front of its range
+	std::vector<uint32_t> activeTriangles(vertexCount, 0);
+	for (auto index : indices) activeTriangles[index]++;
+
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (uint32_t i = 0; i < vertexCount; i++)
+		offsets[i + 1] = offsets[i] + activeTriangles[i];
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (uint32_t i = 0; i < indices.size(); i++)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	std::vector<int32_t> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; i++)
+		vertexScores[i] = getVertexScore(-1, activeTriangles[i]);
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	uint32_t bestTriangle = 0;
+	for (uint32_t i = 0; i < triangleCount; i++) {
+		triangleScores[i] = vertexScores[indices[i * 3]] +
+		                    vertexScores[indices[i * 3 + 1]] +
+		                    vertexScores[indices[i * 3 + 2]];
+		if (triangleScores[i] > triangleScores[bestTriangle])
+			bestTriangle = i;
+	}
+
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> nextCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	uint32_t nextUnemitted = 0;
+
+	while (result.size() < indices.size()) {
+		if (bestTriangle == invalid) {
+			// No candidate left around the cache, restart from the first
+			// triangle not emitted yet
+			while (emitted[nextUnemitted]) nextUnemitted++;
+			bestTriangle = nextUnemitted;
+		}
+
+		emitted[bestTriangle] = true;
+		nextCache.clear();
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t vertex = indices[bestTriangle * 3 + k];
+			result.push_back(vertex);
+
+			auto begin = adjacency.begin() + offsets[vertex];
+			auto end = begin + activeTriangles[vertex];
+			auto it = std::find(begin, end, bestTriangle);
+			if (it != end) {
+				std::iter_swap(it, end - 1);
+				activeTriangles[vertex]--;
+			}
+
+			if (std::find(nextCache.begin(), nextCache.end(), vertex) ==
+			    nextCache.end())
+				nextCache.push_back(vertex);
+		}
+
+		for (auto vertex : cache) {
+			if (std::find(nextCache.begin(), nextCache.end(), vertex) ==
+			    nextCache.end())
+				nextCache.push_back(vertex);
+		}
+
+		for (uint32_t i = 0; i < nextCache.size(); i++) {
+			uint32_t vertex = nextCache[i];
+			cachePosition[vertex] = i < FORSYTH_CACHE_SIZE ? i : -1;
+			vertexScores[vertex] =
+				getVertexScore(cachePosition[vertex], activeTriangles[vertex]);
+		}
+		if (nextCache.size() > FORSYTH_CACHE_SIZE)
+			nextCache.resize(FORSYTH_CACHE_SIZE);
+
+		bestTriangle = invalid;
+		float bestScore = -1;
+		for (auto vertex : nextCache) {
+			for (uint32_t i = 0; i < activeTriangles[vertex]; i++) {
+				uint32_t triangle = adjacency[offsets[vertex] + i];
+				triangleScores[triangle] =
+					vertexScores[indices[triangle * 3]] +
+					vertexScores[indices[triangle * 3 + 1]] +
+					vertexScores[indices[triangle * 3 + 2]];
+
+				if (triangleScores[triangle] > bestScore) {
+					bestScore = triangleScores[triangle];
+					bestTriangle = triangle;
+				}
+			}
+		}
+
+		std::swap(cache, nextCache);
+	}
+
+	indices = std::move(result);
+}
+
+//// Overdraw
+
+struct FifoCache {
+	std::vector<uint32_t> timestamps;
+	uint32_t time;
+	uint32_t size;
+
+	FifoCache(uint32_t vertexCount, uint32_t cacheSize) :
+		timestamps(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+	// Returns true on a cache miss
+	inline bool access(uint32_t vertex) {
+		if (time - timestamps[vertex] <= size) return false;
+		timestamps[vertex] = time++;
+		return true;
+	}
+	inline void reset() { time += size + 1; }
+};
+
+void MeshOptimizer::OptimizeOverdraw(MeshData& mesh, float threshold) {
+	uint32_t triangleCount = mesh.indices.size() / 3;
+	if (triangleCount == 0) return;
+
+	FifoCache cache(mesh.vertices.size(), SIMULATED_CACHE_SIZE);
+
+	// Hard boundaries: triangles missing the cache for all of their vertices
+	// start a new cluster at no extra transform cost
+	std::vector<uint32_t> hardBoundaries;
+	for (uint32_t i = 0; i < triangleCount; i++) {
+		uint32_t misses = 0;
+		for (uint32_t k = 0; k < 3; k++)
+			misses += cache.access(mesh.indices[i * 3 + k]);
+		if (i == 0 || misses == 3) hardBoundaries.push_back(i);
+	}
+	hardBoundaries.push_back(triangleCount);
+
+	// Soft boundaries: split clusters further as long as each part stays
+	// close to the cache efficiency of the whole cluster
+	std::vector<uint32_t> clusters;
+	for (uint32_t c = 0; c + 1 < hardBoundaries.size(); c++) {
+		uint32_t start = hardBoundaries[c];
+		uint32_t end = hardBoundaries[c + 1];
+
+		cache.reset();
+		uint32_t clusterMisses = 0;
+		for (uint32_t i = start * 3; i < end * 3; i++)
+			clusterMisses += cache.access(mesh.indices[i]);
+		float clusterAcmr = (float)clusterMisses / (end - start);
+
+		cache.reset();
+		uint32_t partStart = start;
+		uint32_t partMisses = 0;
+		clusters.push_back(start);
+		for (uint32_t i = start; i < end; i++) {
+			for (uint32_t k = 0; k < 3; k++)
+				partMisses += cache.access(mesh.indices[i * 3 + k]);
+
+			float partAcmr = (float)partMisses / (i - partStart + 1);
+			if (i + 1 < end && partAcmr <= clusterAcmr * threshold) {
+				clusters.push_back(i + 1);
+				partStart = i + 1;
+				partMisses = 0;
+				cache.reset();
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	glm::vec3 meshCentroid(0);
+	for (const auto& vertex : mesh.vertices) meshCentroid += vertex.position;
+	meshCentroid /= (float)std::max<size_t>(mesh.vertices.size(), 1);
+
+	struct Cluster {
+		uint32_t start;
+		uint32_t end;
+		float sortKey;
+	};
+	std::vector<Cluster> sortedClusters;
+	sortedClusters.reserve(clusters.size() - 1);
+
+	for (uint32_t c = 0; c + 1 < clusters.size(); c++) {
+		glm::vec3 centroid(0);
+		glm::vec3 normal(0);
+		float area = 0;
+
+		for (uint32_t i = clusters[c]; i < clusters[c + 1]; i++) {
+			const glm::vec3& a = mesh.vertices[mesh.indices[i * 3]].position;
+			const glm::vec3& b =
+				mesh.vertices[mesh.indices[i * 3 + 1]].position;
+			const glm::vec3& d =
+				mesh.vertices[mesh.indices[i * 3 + 2]].position;
+
+			glm::vec3 triangleNormal = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(triangleNormal);
+
+			centroid += (a + b + d) * (triangleArea / 3.f);
+			normal += triangleNormal;
+			area += triangleArea;
+		}
+
+		centroid = area > 0 ? centroid / area : meshCentroid;
+		float normalLength = glm::length(normal);
+		normal = normalLength > 0 ? normal / normalLength : glm::vec3(0);
+
+		sortedClusters.push_back({
+			.start = clusters[c],
+			.end = clusters[c + 1],
+			.sortKey = glm::dot(centroid - meshCentroid, normal),
+		});
+	}
+
+	std::stable_sort(
+		sortedClusters.begin(),
+		sortedClusters.end(),
+		[](const Cluster& a, const Cluster& b) {
+			return a.sortKey > b.sortKey;
+		}
+	);
+
+	std::vector<uint32_t> result;
+	result.reserve(mesh.indices.size());
+	for (const auto& cluster : sortedClusters) {
+		result.insert(
+			result.end(),
+			mesh.indices.begin() + cluster.start * 3,
+			mesh.indices.begin() + cluster.end * 3
+		);
+	}
+
+	mesh.indices = std::move(result);
+}
+
+//// Vertex fetch
+
+void MeshOptimizer::OptimizeVertexFetch(MeshData& mesh) {
+	const uint32_t unused = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> remap(mesh.vertices.size(), unused);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	for (auto& index : mesh.indices) {
+		if (remap[index] == unused) {
+			remap[index] = vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	mesh.vertices = std::move(vertices);
+}
+
+std::array<VertexCacheStatistics, 2> MeshOptimizer::Optimize(
+	MeshData& mesh
+) {
+	WeldVertices(mesh);
+	VertexCacheStatistics welded =
+		AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+	OptimizeVertexCache(mesh);
+	OptimizeOverdraw(mesh);
+	OptimizeVertexFetch(mesh);
+	return {
+		welded,
+		AnalyzeVertexCache(mesh.indices, mesh.vertices.size()),
+	};
+}
+
+VertexCacheStatistics MeshOptimizer::AnalyzeVertexCache(
+	const std::vector<uint32_t>& indices,
+	uint32_t vertexCount,
+	uint32_t cacheSize
+) {
+	FifoCache cache(vertexCount, cacheSize);
+	VertexCacheStatistics statistics {
+		.triangles = (uint32_t)indices.size() / 3,
+		.vertices = vertexCount,
+	};
+
+	for (auto index : indices) statistics.misses += cache.access(index);
+
+	return statistics;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "MeshData.hpp"
+
+struct VertexCacheStatistics {
+	uint32_t misses = 0;
+	uint32_t triangles = 0;
+	uint32_t vertices = 0;
+
+	// Average cache miss ratio, transformed vertices per triangle.
+	inline float acmr() const {
+		return triangles == 0 ? 0 : (float)misses / triangles;
+	}
+	// Average transform to vertex ratio, 1 is optimal.
+	inline float atvr() const {
+		return vertices == 0 ? 0 : (float)misses / vertices;
+	}
+
+	inline VertexCacheStatistics& operator+=(const VertexCacheStatistics& b) {
+		misses += b.misses;
+		triangles += b.triangles;
+		vertices += b.vertices;
+		return *this;
+	}
+};
+
+class MeshOptimizer {
+public:
+	// Size of the FIFO cache used to estimate post transform cache reuse.
+	static const uint32_t SIMULATED_CACHE_SIZE = 16;
+
+	// Merges bitwise identical vertices.
+	static void WeldVertices(MeshData& mesh);
+	// Reorders triangles for post transform cache reuse (Forsyth).
+	static void OptimizeVertexCache(MeshData& mesh);
+	static void OptimizeVertexCache(
+		std::vector<uint32_t>& indices, uint32_t vertexCount
+	);
+	// Reorders clusters of cache friendly triangles so outward facing ones
+	// are drawn first, a cluster may cost at most `threshold` times the mesh
+	// ACMR.
+	static void OptimizeOverdraw(MeshData& mesh, float threshold = 1.05f);
+	// Renumbers vertices in order of first use.
+	static void OptimizeVertexFetch(MeshData& mesh);
+
+	// Runs every step above. Returns the cache statistics of the welded
+	// mesh before and after reordering, so welding does not count as a gain.
+	static std::array<VertexCacheStatistics, 2> Optimize(MeshData& mesh);
+
+	static VertexCacheStatistics AnalyzeVertexCache(
+		const std::vector<uint32_t>& indices,
+		uint32_t vertexCount,
+		uint32_t cacheSize = SIMULATED_CACHE_SIZE
+	);
+};
@@ -0,0 +1,324 @@
+#include "MeshSimplifier.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "MeshData.hpp"
+#include "MeshOptimizer.hpp"
+
+// Symmetric 4x4 matrix accumulating squared distances to a set of planes
+struct Quadric {
+	double a2 = 0, b2 = 0, c2 = 0, d2 = 0;
+	double ab = 0, ac = 0, ad = 0;
+	double bc = 0, bd = 0, cd = 0;
+
+	static Quadric FromPlane(glm::vec3 normal, double distance) {
+		double a = normal.x, b = normal.y, c = normal.z, d = distance;
+		return {
+			.a2 = a * a,
+			.b2 = b * b,
+			.c2 = c * c,
+			.d2 = d * d,
+			.ab = a * b,
+			.ac = a * c,
+			.ad = a * d,
+			.bc = b * c,
+			.bd = b * d,
+			.cd = c * d,
+		};
+	}
+
+	Quadric& operator+=(const Quadric& q) {
+		a2 += q.a2, b2 += q.b2, c2 += q.c2, d2 += q.d2;
+		ab += q.ab, ac += q.ac, ad += q.ad;
+		bc += q.bc, bd += q.bd, cd += q.cd;
+		return *this;
+	}
+
+	double evaluate(glm::vec3 p) const {
+		double x = p.x, y = p.y, z = p.z;
+		return a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+		       2 * (ab * x * y + ac * x * z + ad * x + bc * y * z + bd * y +
+		            cd * z);
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+struct PositionHash {
+	size_t operator()(const glm::vec3& position) const {
+		uint32_t bits[3];
+		std::memcpy(bits, &position, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^
+		       (bits[2] * 83492791u);
+	}
+};
+
+// Maps every vertex to the first vertex sharing its position
+std::vector<uint32_t> buildPositionRemap(const std::vector<Vertex>& vertices) {
+	std::unordered_map<glm::vec3, uint32_t, PositionHash> firstVertex;
+	firstVertex.reserve(vertices.size());
+
+	std::vector<uint32_t> remap(vertices.size());
+	for (uint32_t i = 0; i < vertices.size(); i++)
+		remap[i] =
+			firstVertex.try_emplace(vertices[i].position, i).first->second;
+
+	return remap;
+}
+
+std::vector<bool> findLockedVertices(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	const std::vector<uint32_t>& positionRemap
+) {
+	std::vector<bool> locked(vertices.size(), false);
+
+	// Vertices sharing a position sit on an attribute seam
+	std::vector<uint32_t> positionUses(vertices.size(), 0);
+	for (uint32_t i = 0; i < vertices.size(); i++)
+		positionUses[positionRemap[i]]++;
+
+	// Edges not shared by exactly two triangles are borders or non manifold
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	edgeUses.reserve(indices.size());
+	for (uint32_t i = 0; i < indices.size(); i += 3) {
+		for (uint32_t k = 0; k < 3; k++) {
+			uint64_t a = positionRemap[indices[i + k]];
+			uint64_t b = positionRemap[indices[i + (k + 1) % 3]];
+			edgeUses[std::min(a, b) << 32 | std::max(a, b)]++;
+		}
+	}
+
+	std::vector<bool> lockedPositions(vertices.size(), false);
+	for (auto [edge, uses] : edgeUses) {
+		if (uses == 2) continue;
+		lockedPositions[edge >> 32] = true;
+		lockedPositions[edge & 0xffffffff] = true;
+	}
+
+	for (uint32_t i = 0; i < vertices.size(); i++) {
+		uint32_t position = positionRemap[i];
+		locked[i] = lockedPositions[position] || positionUses[position] > 1;
+	}
+	return locked;
+}
+
+bool flipsTriangle(
+	const std::vector<Vertex>& vertices,
+	const std::array<uint32_t, 3>& triangle,
+	uint32_t from,
+	uint32_t to
+) {
+	std::array<glm::vec3, 3> before;
+	std::array<glm::vec3, 3> after;
+	for (uint32_t k = 0; k < 3; k++) {
+		before[k] = vertices[triangle[k]].position;
+		after[k] = vertices[triangle[k] == from ? to : triangle[k]].position;
+	}
+
+	glm::vec3 normalBefore =
+		glm::cross(before[1] - before[0], before[2] - before[0]);
+	glm::vec3 normalAfter =
+		glm::cross(after[1] - after[0], after[2] - after[0]);
+
+	return glm::dot(normalBefore, normalAfter) <= 0;
+}
+
+std::vector<uint32_t> MeshSimplifier::Simplify(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	uint32_t targetIndexCount,
+	float& resultError,
+	float maxError
+) {
+	resultError = 0;
+	std::vector<uint32_t> result = indices;
+	if (result.size() <= targetIndexCount) return result;
+
+	std::vector<uint32_t> positionRemap = buildPositionRemap(vertices);
+	std::vector<bool> locked =
+		findLockedVertices(vertices, indices, positionRemap);
+
+	// Quadrics live on positions so seam vertices share their error
+	std::vector<Quadric> quadrics(vertices.size());
+	for (uint32_t i = 0; i < result.size(); i += 3) {
+		glm::vec3 a = vertices[result[i]].position;
+		glm::vec3 b = vertices[result[i + 1]].position;
+		glm::vec3 c = vertices[result[i + 2]].position;
+
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length == 0) continue;
+		normal /= length;
+
+		Quadric quadric = Quadric::FromPlane(normal, -glm::dot(normal, a));
+		for (uint32_t k = 0; k < 3; k++)
+			quadrics[positionRemap[result[i + k]]] += quadric;
+	}
+
+	double maxCost = 0;
+	double costLimit = (double)maxError * maxError;
+	std::vector<uint32_t> collapseTo(vertices.size());
+	std::vector<bool> touched(vertices.size());
+	std::vector<uint32_t> triangleCounts(vertices.size());
+	std::vector<uint32_t> triangleOffsets(vertices.size() + 1);
+	std::vector<uint32_t> triangles;
+	std::vector<Collapse> collapses;
+
+	// Each pass collapses a set of independent edges, cheapest first
+	while (result.size() > targetIndexCount) {
+		std::fill(triangleCounts.begin(), triangleCounts.end(), 0);
+		for (auto index : result) triangleCounts[index]++;
+		triangleOffsets[0] = 0;
+		for (uint32_t i = 0; i < vertices.size(); i++)
+			triangleOffsets[i + 1] = triangleOffsets[i] + triangleCounts[i];
+
+		triangles.resize(result.size());
+		std::vector<uint32_t> fill(
+			triangleOffsets.begin(), triangleOffsets.end() - 1
+		);
+		for (uint32_t i = 0; i < result.size(); i++)
+			triangles[fill[result[i]]++] = i / 3;
+
+		collapses.clear();
+		for (uint32_t i = 0; i < result.size(); i += 3) {
+			for (uint32_t k = 0; k < 3; k++) {
+				uint32_t a = result[i + k];
+				uint32_t b = result[i + (k + 1) % 3];
+
+				for (auto [from, to] : { std::pair(a, b), std::pair(b, a) }) {
+					if (locked[from]) continue;
+
+					Quadric quadric = quadrics[positionRemap[from]];
+					quadric += quadrics[positionRemap[to]];
+					collapses.push_back({
+						.from = from,
+						.to = to,
+						.cost = std::max(
+							quadric.evaluate(vertices[to].position), 0.0
+						),
+					});
+				}
+			}
+		}
+		std::sort(
+			collapses.begin(),
+			collapses.end(),
+			[](const Collapse& a, const Collapse& b) {
+				return a.cost < b.cost;
+			}
+		);
+
+		for (uint32_t i = 0; i < vertices.size(); i++) collapseTo[i] = i;
+		std::fill(touched.begin(), touched.end(), false);
+
+		uint32_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		uint32_t removedTriangles = 0;
+		bool collapsed = false;
+
+		for (const auto& collapse : collapses) {
+			if (collapse.cost > costLimit) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			uint32_t begin = triangleOffsets[collapse.from];
+			uint32_t end = triangleOffsets[collapse.from + 1];
+
+			bool flips = false;
+			uint32_t sharedTriangles = 0;
+			for (uint32_t t = begin; t < end && !flips; t++) {
+				std::array<uint32_t, 3> triangle {
+					result[triangles[t] * 3],
+					result[triangles[t] * 3 + 1],
+					result[triangles[t] * 3 + 2],
+				};
+				if (std::find(triangle.begin(), triangle.end(), collapse.to) !=
+				    triangle.end()) {
+					sharedTriangles++;
+					continue;
+				}
+				flips = flipsTriangle(
+					vertices, triangle, collapse.from, collapse.to
+				);
+			}
+			if (flips) continue;
+
+			collapseTo[collapse.from] = collapse.to;
+			quadrics[positionRemap[collapse.to]] +=
+				quadrics[positionRemap[collapse.from]];
+
+			for (uint32_t t = begin; t < end; t++) {
+				for (uint32_t k = 0; k < 3; k++)
+					touched[result[triangles[t] * 3 + k]] = true;
+			}
+
+			maxCost = std::max(maxCost, collapse.cost);
+			collapsed = true;
+			removedTriangles += sharedTriangles;
+			if (removedTriangles >= trianglesToRemove) break;
+		}
+
+		if (!collapsed) break;
+
+		uint32_t writeIndex = 0;
+		for (uint32_t i = 0; i < result.size(); i += 3) {
+			uint32_t a = collapseTo[result[i]];
+			uint32_t b = collapseTo[result[i + 1]];
+			uint32_t c = collapseTo[result[i + 2]];
+			if (a == b || b == c || c == a) continue;
+
+			result[writeIndex++] = a;
+			result[writeIndex++] = b;
+			result[writeIndex++] = c;
+		}
+		result.resize(writeIndex);
+	}
+
+	resultError = (float)std::sqrt(maxCost);
+	return result;
+}
+
+std::vector<MeshLod> MeshSimplifier::GenerateLods(
+	const MeshData& mesh, uint32_t maxLodCount
+) {
+	std::vector<MeshLod> lods { MeshLod {
+		.indices = mesh.indices,
+		.error = 0,
+	} };
+
+	while (lods.size() < maxLodCount) {
+		const MeshLod& previous = lods.back();
+		uint32_t target = previous.indices.size() / 6 * 3;
+		if (target < 3) break;
+
+		float error;
+		std::vector<uint32_t> indices =
+			Simplify(mesh.vertices, previous.indices, target, error);
+
+		// Keep a level only if it removes a meaningful amount of triangles
+		if (indices.empty() ||
+		    indices.size() * 10 > previous.indices.size() * 9)
+			break;
+
+		MeshOptimizer::OptimizeVertexCache(indices, mesh.vertices.size());
+		// Each level is simplified from the previous one, so the deviation
+		// from level 0 is bounded by the sum of the steps
+		float accumulatedError = previous.error + error;
+		lods.push_back({
+			.indices = std::move(indices),
+			.error = accumulatedError,
+		});
+	}
+
+	return lods;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "MeshData.hpp"
+
+struct MeshLod {
+	std::vector<uint32_t> indices;
+	// Mesh space geometric deviation from the full detail mesh
+	float error;
+};
+
+class MeshSimplifier {
+public:
+	// Edge collapse simplification driven by quadric error metrics. Only the
+	// index buffer is rewritten, so every level keeps sharing the vertices of
+	// the source mesh. Border and attribute seam vertices are never moved.
+	static std::vector<uint32_t> Simplify(
+		const std::vector<Vertex>& vertices,
+		const std::vector<uint32_t>& indices,
+		uint32_t targetIndexCount,
+		float& resultError,
+		float maxError = std::numeric_limits<float>::max()
+	);
+
+	// Builds a chain of levels halving the triangle count each step, level 0
+	// is the source mesh. The chain stops early once simplification stalls.
+	static std::vector<MeshLod> GenerateLods(
+		const MeshData& mesh, uint32_t maxLodCount
+	);
+};
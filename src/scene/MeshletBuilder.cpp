@@ -0,0 +1,118 @@
+#include "MeshletBuilder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+#include "Vertex.hpp"
+
+Meshlet buildMeshlet(
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	uint32_t firstIndex,
+	uint32_t indexCount
+) {
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+	for (uint32_t i = firstIndex; i < firstIndex + indexCount; i++) {
+		boundsMin = glm::min(boundsMin, vertices[indices[i]].position);
+		boundsMax = glm::max(boundsMax, vertices[indices[i]].position);
+	}
+
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = 0;
+	for (uint32_t i = firstIndex; i < firstIndex + indexCount; i++) {
+		radius = std::max(
+			radius, glm::distance(center, vertices[indices[i]].position)
+		);
+	}
+
+	std::vector<glm::vec3> normals;
+	normals.reserve(indexCount / 3);
+	glm::vec3 axis(0);
+	for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3) {
+		glm::vec3 a = vertices[indices[i]].position;
+		glm::vec3 b = vertices[indices[i + 1]].position;
+		glm::vec3 c = vertices[indices[i + 2]].position;
+
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length == 0) continue;
+
+		normals.push_back(normal / length);
+		axis += normals.back();
+	}
+
+	// The cluster can be rejected only when the viewer is behind the plane
+	// of every triangle, which holds inside the cone whose half angle is the
+	// normal spread plus 90 degrees.
+	float cutoff = 1;
+	if (glm::length(axis) > 0) {
+		axis = glm::normalize(axis);
+		float minDot = 1;
+		for (const auto& normal : normals)
+			minDot = std::min(minDot, glm::dot(axis, normal));
+
+		if (minDot > 0) cutoff = std::sqrt(1 - minDot * minDot);
+	} else {
+		axis = glm::vec3(0, 0, 1);
+	}
+
+	return Meshlet {
+		.boundingSphere = glm::vec4(center, radius),
+		.cone = glm::vec4(axis, cutoff),
+		.firstIndex = firstIndex,
+		.indexCount = indexCount,
+		.padding = {},
+	};
+}
+
+std::vector<Meshlet> MeshletBuilder::Build(
+	const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices
+) {
+	std::vector<Meshlet> meshlets;
+
+	// Last meshlet each vertex was added to, avoids clearing a set per
+	// meshlet
+	std::vector<uint32_t> vertexMeshlet(
+		vertices.size(), std::numeric_limits<uint32_t>::max()
+	);
+	uint32_t firstIndex = 0;
+	uint32_t vertexCount = 0;
+
+	for (uint32_t i = 0; i < indices.size(); i += 3) {
+		uint32_t meshletIndex = meshlets.size();
+		uint32_t newVertices = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			if (vertexMeshlet[indices[i + k]] != meshletIndex) newVertices++;
+		}
+
+		uint32_t triangleCount = (i - firstIndex) / 3;
+		if (vertexCount + newVertices > MESHLET_MAX_VERTICES ||
+		    triangleCount + 1 > MESHLET_MAX_TRIANGLES) {
+			meshlets.push_back(
+				buildMeshlet(vertices, indices, firstIndex, i - firstIndex)
+			);
+			firstIndex = i;
+			vertexCount = 0;
+			meshletIndex++;
+		}
+
+		for (uint32_t k = 0; k < 3; k++) {
+			if (vertexMeshlet[indices[i + k]] == meshletIndex) continue;
+			vertexMeshlet[indices[i + k]] = meshletIndex;
+			vertexCount++;
+		}
+	}
+
+	if (firstIndex < indices.size()) {
+		meshlets.push_back(buildMeshlet(
+			vertices, indices, firstIndex, indices.size() - firstIndex
+		));
+	}
+
+	return meshlets;
+}
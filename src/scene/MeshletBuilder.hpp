@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Vertex.hpp"
+
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// std430 layout shared with cluster_cull.comp
+struct Meshlet {
+	// Mesh space center and radius
+	glm::vec4 boundingSphere;
+	// Average normal and sine of the cone spread, a cutoff of 1 disables
+	// backface rejection for the cluster.
+	glm::vec4 cone;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+class MeshletBuilder {
+public:
+	// Splits an index buffer in runs of consecutive triangles referencing at
+	// most MESHLET_MAX_VERTICES vertices. Triangles are not reordered, so the
+	// vertex cache order of the input gives the clusters their locality and
+	// firstIndex is relative to the start of `indices`.
+	static std::vector<Meshlet> Build(
+		const std::vector<Vertex>& vertices,
+		const std::vector<uint32_t>& indices
+	);
+};
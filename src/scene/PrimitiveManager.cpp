@@ -1,6 +1,10 @@
 #include "PrimitiveManager.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
+#include <string_view>
+#include <utility>
 #include <vulkan/vulkan_enums.hpp>
 
 #include "memory/MemoryAllocator.hpp"
@@ -10,38 +14,136 @@
 void PrimitiveManager::addPrimitive(
 	std::vector<std::byte> vertices,
 	std::vector<std::byte> indices,
+	vk::IndexType indexType,
 	uint32_t& vertexByteOffset,
 	uint32_t& indexByteOffset
 ) {
-	vertexByteOffset = m_vertexbuffer.size();
-	m_vertexbuffer.insert(
-		m_vertexbuffer.end(), vertices.begin(), vertices.end()
+	vertexByteOffset = m_chunk.vertexByteOffset + m_chunk.vertices.size();
+	m_chunk.vertices.insert(
+		m_chunk.vertices.end(), vertices.begin(), vertices.end()
 	);
-	indexByteOffset = m_indexBuffer.size();
-	m_indexBuffer.insert(m_indexBuffer.end(), indices.begin(), indices.end());
+
+	uint32_t stride = getVertexStride(m_format);
+	uint32_t positionStride = getPositionStride(m_format);
+	for (size_t offset = 0; offset < vertices.size(); offset += stride) {
+		auto position = vertices.begin() + offset;
+		m_chunk.positions.insert(
+			m_chunk.positions.end(), position, position + positionStride
+		);
+	}
+
+	// 16 and 32 bit indices share the pool, each range is aligned to its own
+	// index size so it can be addressed as firstIndex of either type.
+	uint32_t indexSize = getIndexSize(indexType);
+	uint32_t padding =
+		(m_chunk.indexByteOffset + m_chunk.indices.size()) % indexSize;
+	if (padding > 0)
+		m_chunk.indices.resize(m_chunk.indices.size() + indexSize - padding);
+
+	indexByteOffset = m_chunk.indexByteOffset + m_chunk.indices.size();
+	m_chunk.indices.insert(
+		m_chunk.indices.end(), indices.begin(), indices.end()
+	);
+}
+uint32_t PrimitiveManager::addMeshlets(const std::vector<Meshlet>& meshlets) {
+	uint32_t offset = m_chunk.meshletOffset + m_chunk.meshlets.size();
+	m_chunk.meshlets.insert(
+		m_chunk.meshlets.end(), meshlets.begin(), meshlets.end()
+	);
+	return offset;
+}
+
+GeometryChunk PrimitiveManager::takeChunk() {
+	// Dedicated transfer queues only copy ranges aligned to 4 bytes
+	uint32_t padding = m_chunk.indices.size() % 4;
+	if (padding > 0)
+		m_chunk.indices.resize(m_chunk.indices.size() + 4 - padding);
+
+	GeometryChunk chunk = std::move(m_chunk);
+	m_chunk = GeometryChunk {
+		.vertexByteOffset =
+			(uint32_t)(chunk.vertexByteOffset + chunk.vertices.size()),
+		.positionByteOffset =
+			(uint32_t)(chunk.positionByteOffset + chunk.positions.size()),
+		.indexByteOffset =
+			(uint32_t)(chunk.indexByteOffset + chunk.indices.size()),
+		.meshletOffset =
+			(uint32_t)(chunk.meshletOffset + chunk.meshlets.size()),
+	};
+	return chunk;
 }
-bool PrimitiveManager::buildBuffers(ResourceManager& resourceManager) {
-	BufferHandle vertexBuffer = resourceManager.createBuffer(
+
+void PrimitiveManager::CreateBuffers(
+	ResourceManager& resourceManager, const GeometryCapacity& capacity
+) {
+	resourceManager.createBuffer(
 		"vertex_buffer",
 		{
-			.size = (uint32_t)m_vertexbuffer.size(),
+			.size = std::max(capacity.vertexBytes, 4u),
 			.usage = vk::BufferUsageFlagBits::eVertexBuffer |
-	                 vk::BufferUsageFlagBits::eTransferDst,
+	                 vk::BufferUsageFlagBits::eTransferDst |
+	                 vk::BufferUsageFlagBits::eStorageBuffer,
 			.location = AllocationLocation::Device,
 		}
 	);
 
-	resourceManager.copyToBuffer(m_vertexbuffer, vertexBuffer);
+	resourceManager.createBuffer(
+		"position_buffer",
+		{
+			.size = std::max(capacity.positionBytes, 4u),
+			.usage = vk::BufferUsageFlagBits::eVertexBuffer |
+	                 vk::BufferUsageFlagBits::eTransferDst,
+			.location = AllocationLocation::Device,
+		}
+	);
 
-	BufferHandle indexBuffer = resourceManager.createBuffer(
+	resourceManager.createBuffer(
 		"index_buffer",
 		{
-			.size = (uint32_t)m_indexBuffer.size(),
+			.size = std::max(capacity.indexBytes, 4u),
 			.usage = vk::BufferUsageFlagBits::eIndexBuffer |
+	                 vk::BufferUsageFlagBits::eStorageBuffer |
+	                 vk::BufferUsageFlagBits::eTransferDst,
+			.location = AllocationLocation::Device,
+		}
+	);
+
+	if (capacity.meshletCount == 0) return;
+
+	resourceManager.createBuffer(
+		"meshlet_buffer",
+		{
+			.size = (uint32_t)(capacity.meshletCount * sizeof(Meshlet)),
+			.usage = vk::BufferUsageFlagBits::eStorageBuffer |
 	                 vk::BufferUsageFlagBits::eTransferDst,
 			.location = AllocationLocation::Device,
 		}
 	);
-	resourceManager.copyToBuffer(m_indexBuffer, indexBuffer);
-	return true;
-}
\ No newline at end of file
+}
+
+void PrimitiveManager::UploadChunk(
+	ResourceManager& resourceManager, const GeometryChunk& chunk
+) {
+	auto upload = [&](std::string_view name,
+	                  const std::vector<std::byte>& bytes,
+	                  uint32_t offset) {
+		if (bytes.empty()) return;
+		BufferHandle buffer = resourceManager.getNamedBufferHandle(name);
+		assert(offset + bytes.size() <= resourceManager.getBuffer(buffer).size);
+		resourceManager.copyToBuffer(bytes, buffer, offset);
+	};
+
+	upload("vertex_buffer", chunk.vertices, chunk.vertexByteOffset);
+	upload("position_buffer", chunk.positions, chunk.positionByteOffset);
+	upload("index_buffer", chunk.indices, chunk.indexByteOffset);
+
+	auto rawMeshlets =
+		reinterpret_cast<const std::byte*>(chunk.meshlets.data());
+	upload(
+		"meshlet_buffer",
+		std::vector<std::byte>(
+			rawMeshlets, rawMeshlets + chunk.meshlets.size() * sizeof(Meshlet)
+		),
+		chunk.meshletOffset * sizeof(Meshlet)
+	);
+}
@@ -3,22 +3,78 @@
 #include <cstddef>
 #include <cstdint>
 #include <vector>
+#include <vulkan/vulkan_enums.hpp>
 
+#include "MeshletBuilder.hpp"
 #include "Primitive.hpp"
+#include "Vertex.hpp"
 #include "resources/Buffer.hpp"
 #include "resources/ResourceManager.hpp"
 
+// Upper bounds of the geometry of a scene, known once it has been parsed so
+// its buffers can be created before the meshes are processed
+struct GeometryCapacity {
+	uint32_t vertexBytes = 0;
+	uint32_t positionBytes = 0;
+	uint32_t indexBytes = 0;
+	uint32_t meshletCount = 0;
+	uint32_t primitiveCount = 0;
+	// Sum of the full detail index count of every primitive
+	uint32_t drawIndexCount = 0;
+	// Upper bound of the triangles of a single draw, the full detail level
+	// of the largest primitive
+	uint32_t maxDrawTriangles = 0;
+	// Scene graph nodes
+	uint32_t transformCount = 0;
+};
+
+// Geometry added since the previous chunk, placed at its final offsets in
+// the scene buffers
+struct GeometryChunk {
+	uint32_t vertexByteOffset = 0;
+	std::vector<std::byte> vertices;
+	// Positions of the same vertices, see getPositionStride
+	uint32_t positionByteOffset = 0;
+	std::vector<std::byte> positions;
+	uint32_t indexByteOffset = 0;
+	std::vector<std::byte> indices;
+	uint32_t meshletOffset = 0;
+	std::vector<Meshlet> meshlets;
+
+	inline size_t size() const {
+		return vertices.size() + positions.size() + indices.size() +
+		       meshlets.size() * sizeof(Meshlet);
+	}
+};
+
 class PrimitiveManager {
 private:
-	std::vector<std::byte> m_vertexbuffer;
-	std::vector<std::byte> m_indexBuffer;
+	VertexFormat m_format;
+	GeometryChunk m_chunk;
 
 public:
+	PrimitiveManager(VertexFormat format) : m_format(format) {}
+
+	// Also appends the positions of `vertices` to the position stream, at
+	// the same vertex index
 	void addPrimitive(
 		std::vector<std::byte> vertices,
 		std::vector<std::byte> indices,
+		vk::IndexType indexType,
 		uint32_t& vertexByteOffset,
 		uint32_t& indexByteOffset
 	);
-	bool buildBuffers(ResourceManager& resourceManager);
-};
\ No newline at end of file
+	// Returns the offset of the first meshlet in the shared meshlet buffer
+	uint32_t addMeshlets(const std::vector<Meshlet>& meshlets);
+
+	// Hands over the pending geometry, later additions are placed after it
+	GeometryChunk takeChunk();
+	inline size_t pendingSize() const { return m_chunk.size(); }
+
+	static void CreateBuffers(
+		ResourceManager& resourceManager, const GeometryCapacity& capacity
+	);
+	static void UploadChunk(
+		ResourceManager& resourceManager, const GeometryChunk& chunk
+	);
+};
@@ -0,0 +1,39 @@
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include "Primitive.hpp"
+
+void Scene::updateWorldBounds(uint32_t first) {
+	const std::vector<glm::mat4>& transforms =
+		m_sceneGraph.getWorldTransforms();
+
+	m_worldBounds.resize(m_primitives.size());
+	for (uint32_t i = first; i < m_primitives.size(); i++) {
+		const Primitive& primitive = m_primitives[i];
+		m_worldBounds[i] =
+			transformAABB(primitive.bounds, transforms[primitive.transform]);
+	}
+}
+
+bool Scene::update() {
+	bool moved = m_sceneGraph.update() && !m_primitives.empty();
+	if (!moved && m_primitives.size() == m_worldBounds.size()) return false;
+
+	// Primitives streamed in since the last update only need their own
+	updateWorldBounds(moved ? 0 : m_worldBounds.size());
+	m_bvhOutdated = true;
+	return true;
+}
+
+const BVH& Scene::getBVH() {
+	if (!m_bvhOutdated) return m_bvh;
+
+	if (m_bvh.size() != m_worldBounds.size())
+		m_bvh.build(m_worldBounds);
+	else
+		m_bvh.refit(m_worldBounds);
+	m_bvhOutdated = false;
+	return m_bvh;
+}
@@ -3,19 +3,54 @@
 #include <assimp/mesh.h>
 #include <assimp/scene.h>
 
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
 
+#include "BVH.hpp"
 #include "Camera.hpp"
 #include "Primitive.hpp"
+#include "SceneGraph.hpp"
+#include "culling/OcclusionBuffer.hpp"
 
 class Scene {
 private:
 	friend class SceneLoader;
 	std::vector<Primitive> m_primitives;
+	SceneGraph m_sceneGraph;
 	Camera camera;
 
+	// World space bounds of every primitive, indexed like m_primitives
+	std::vector<AABB> m_worldBounds;
+	// Brought up to date with m_worldBounds by getBVH, so streaming does not
+	// rebuild it for every batch and scenes nobody queries never build it
+	BVH m_bvh;
+	bool m_bvhOutdated = false;
+	// Simplified meshes used by the software occlusion culling, keyed by
+	// Primitive::mesh
+	std::unordered_map<uint32_t, OccluderMesh> m_occluders;
+
+	// Bounds of the primitives from `first` on
+	void updateWorldBounds(uint32_t first);
+
 public:
+	// Resolves the scene graph and computes the world bounds of added and
+	// moved primitives. Returns whether the world bounds changed.
+	bool update();
+
 	const std::vector<Primitive>& getPrimitives() const { return m_primitives; }
+	inline SceneGraph& getSceneGraph() { return m_sceneGraph; }
+	// Rebuilds the BVH when primitives were added since the last call and
+	// refits it when they moved
+	const BVH& getBVH();
+	inline const std::vector<AABB>& getWorldBounds() const {
+		return m_worldBounds;
+	}
+
+	inline const std::unordered_map<uint32_t, OccluderMesh>& getOccluders(
+	) const {
+		return m_occluders;
+	}
 
 	inline Camera& getCamera() { return camera; }
-};
\ No newline at end of file
+};
@@ -0,0 +1,50 @@
+#include "SceneGraph.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+uint32_t SceneGraph::addNode(uint32_t parent, const glm::mat4& localTransform) {
+	assert(parent == NO_PARENT || parent < m_parents.size());
+
+	uint32_t node = m_parents.size();
+	m_parents.push_back(parent);
+	m_localTransforms.push_back(localTransform);
+	m_worldTransforms.push_back(glm::mat4(1));
+	m_dirty.push_back(true);
+	m_hasDirtyNodes = true;
+
+	return node;
+}
+
+void SceneGraph::setLocalTransform(
+	uint32_t node, const glm::mat4& localTransform
+) {
+	m_localTransforms[node] = localTransform;
+	m_dirty[node] = true;
+	m_hasDirtyNodes = true;
+}
+
+bool SceneGraph::update() {
+	if (!m_hasDirtyNodes) return false;
+
+	// Parents are resolved first, so a dirty flag reaches the whole subtree
+	// in the same pass
+	for (uint32_t i = 0; i < m_parents.size(); i++) {
+		uint32_t parent = m_parents[i];
+		if (parent == NO_PARENT) {
+			if (m_dirty[i]) m_worldTransforms[i] = m_localTransforms[i];
+			continue;
+		}
+
+		if (m_dirty[parent]) m_dirty[i] = true;
+		if (m_dirty[i])
+			m_worldTransforms[i] =
+				m_worldTransforms[parent] * m_localTransforms[i];
+	}
+
+	std::fill(m_dirty.begin(), m_dirty.end(), false);
+	m_hasDirtyNodes = false;
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+// Transform hierarchy flattened in breadth first order, so every parent is
+// stored before its children and world transforms are resolved in a single
+// forward pass.
+class SceneGraph {
+public:
+	static constexpr uint32_t NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+private:
+	std::vector<uint32_t> m_parents;
+	std::vector<glm::mat4> m_localTransforms;
+	std::vector<glm::mat4> m_worldTransforms;
+	std::vector<bool> m_dirty;
+	bool m_hasDirtyNodes = false;
+
+public:
+	// `parent` must already be in the graph, nodes are appended breadth first
+	uint32_t addNode(uint32_t parent, const glm::mat4& localTransform);
+
+	void setLocalTransform(uint32_t node, const glm::mat4& localTransform);
+	inline const glm::mat4& getLocalTransform(uint32_t node) const {
+		return m_localTransforms[node];
+	}
+
+	// Recomputes the world transform of dirty nodes and their descendants,
+	// returns whether any of them changed
+	bool update();
+
+	inline const std::vector<glm::mat4>& getWorldTransforms() const {
+		return m_worldTransforms;
+	}
+	inline uint32_t size() const { return m_parents.size(); }
+};
@@ -1,5 +1,6 @@
 #include "SceneLoader.hpp"
 
+#include <SDL3/SDL_log.h>
 #include <assimp/material.h>
 #include <assimp/matrix4x4.h>
 #include <assimp/mesh.h>
@@ -9,14 +10,28 @@
 #include <assimp/vector3.h>
 
 #include <assimp/Importer.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <glm/ext/matrix_float4x4.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
+#include <set>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <vulkan/vulkan_enums.hpp>
 
 #include "Primitive.hpp"
+#include "Vertex.hpp"
 #include "material/MaterialManager.hpp"
 #include "resources/ResourceManager.hpp"
 
@@ -24,27 +39,40 @@
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
 
+#include "MeshData.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "MeshletBuilder.hpp"
 #include "PrimitiveManager.hpp"
+#include "StaticBatcher.hpp"
 #include "material/MaterialManager.hpp"
 
 SceneLoader::SceneLoader(
-	ResourceManager& resourceManager, MaterialManager& materialManager
+	vk::Device device,
+	ResourceManager& resourceManager,
+	MaterialManager& materialManager,
+	const LoadSettings& settings
 ) :
+	m_device(device),
 	m_resourceManager(resourceManager),
 	m_materialManager(materialManager),
-	m_primitiveManager() {}
+	m_settings(settings),
+	m_primitiveManager(settings.vertexFormat) {}
 
-struct Vertex {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 texcoord;
-};
+SceneLoader::~SceneLoader() {
+	m_cancelled = true;
+	if (m_worker.joinable()) m_worker.join();
+	m_resourceManager.waitTransfers();
+}
 
-void loadMaterials() {}
+template <typename T>
+std::vector<std::byte> toBytes(const std::vector<T>& data) {
+	auto rawData = reinterpret_cast<const std::byte*>(data.data());
+	return std::vector<std::byte>(rawData, rawData + sizeof(T) * data.size());
+}
 
-glm::mat4 getBaseTransform(aiNode& node, const aiScene& scene) {
+glm::mat4 toMat4(const aiMatrix4x4& base) {
 	glm::mat4 transform;
-	aiMatrix4x4 base = node.mTransformation;
 
 	transform[0][0] = base.a1;
 	transform[1][0] = base.a2;
@@ -63,91 +91,206 @@ glm::mat4 getBaseTransform(aiNode& node, const aiScene& scene) {
 	transform[2][3] = base.d3;
 	transform[3][3] = base.d4;
 
-	if (node.mParent == nullptr) return transform;
-
-	return transform * getBaseTransform(*node.mParent, scene);
+	return transform;
 }
 
-Primitive SceneLoader::loadMesh(aiMesh& mesh) {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+MeshData readMesh(const aiMesh& mesh) {
+	MeshData meshData;
 
 	for (unsigned int i = 0; i < mesh.mNumFaces; i++) {
 		auto face = mesh.mFaces[i];
 
-		indices.push_back(face.mIndices[0]);
-		indices.push_back(face.mIndices[1]);
-		indices.push_back(face.mIndices[2]);
+		meshData.indices.push_back(face.mIndices[0]);
+		meshData.indices.push_back(face.mIndices[1]);
+		meshData.indices.push_back(face.mIndices[2]);
 	}
 
 	for (unsigned int i = 0; i < mesh.mNumVertices; i++) {
 		auto vertex = mesh.mVertices[i];
 		auto normal = mesh.mNormals[i];
 		auto texcoord = mesh.mTextureCoords[0][i];
-		vertices.push_back(Vertex {
+		meshData.vertices.push_back(Vertex {
 			{ vertex.x, vertex.y, vertex.z },
 			{ normal.x, normal.y, normal.z },
 			{ texcoord.x, texcoord.y }
         });
 	};
 
-	size_t vertexBufferSize = sizeof(Vertex) * vertices.size();
+	return meshData;
+}
+
+// Copy of a level keeping only the positions it references
+OccluderMesh buildOccluder(
+	const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices
+) {
+	OccluderMesh occluder;
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	occluder.indices.reserve(indices.size());
+	for (uint32_t index : indices) {
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = occluder.positions.size();
+			occluder.positions.push_back(vertices[index].position);
+		}
+		occluder.indices.push_back(remap[index]);
+	}
+	return occluder;
+}
+
+Primitive SceneLoader::loadMesh(MeshData& meshData, uint32_t mesh) {
+	auto& vertices = meshData.vertices;
+
+	if (m_settings.optimizeMeshes) {
+		auto statistics = MeshOptimizer::Optimize(meshData);
+		m_cacheStatistics[0] += statistics[0];
+		m_cacheStatistics[1] += statistics[1];
+	}
+
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+	for (const auto& vertex : vertices) {
+		boundsMin = glm::min(boundsMin, vertex.position);
+		boundsMax = glm::max(boundsMax, vertex.position);
+	}
+	glm::vec3 boundsExtent = boundsMax - boundsMin;
+	boundsExtent = glm::max(boundsExtent, glm::vec3(1e-6f));
+
+	BoundingSphere boundingSphere {
+		.center = (boundsMin + boundsMax) * 0.5f,
+		.radius = 0,
+	};
+	for (const auto& vertex : vertices) {
+		boundingSphere.radius = glm::max(
+			boundingSphere.radius,
+			glm::distance(boundingSphere.center, vertex.position)
+		);
+	}
 
-	auto vertexData = reinterpret_cast<const std::byte*>(vertices.data());
-	std::vector<std::byte> rawVertices(
-		vertexData, vertexData + vertexBufferSize
+	std::vector<MeshLod> lods = MeshSimplifier::GenerateLods(
+		meshData, std::clamp(m_settings.lodCount, 1u, MAX_LODS)
 	);
-	uint32_t indexBufferSize = sizeof(uint32_t) * indices.size();
 
-	auto indexData = reinterpret_cast<const std::byte*>(indices.data());
-	std::vector<std::byte> rawIndices(indexData, indexData + indexBufferSize);
+	// Coarse levels keep the positions of the full one, so they stay close
+	// to the surface they simplify
+	const std::vector<uint32_t>& coarsest = lods.back().indices;
+	if (m_settings.softwareOcclusion &&
+	    coarsest.size() / 3 <= m_settings.occluderMaxTriangles)
+		m_occluders.push_back({ mesh, buildOccluder(vertices, coarsest) });
+
+	// Every level is appended to the same index range so they can share
+	// the vertex offset and index type of the mesh
+	std::vector<uint32_t> lodIndices;
+	for (const auto& lod : lods)
+		lodIndices.insert(
+			lodIndices.end(), lod.indices.begin(), lod.indices.end()
+		);
+
+	std::vector<std::byte> rawVertices;
+	if (m_settings.vertexFormat == VertexFormat::Compact) {
+		std::vector<CompactVertex> compactVertices;
+		compactVertices.reserve(vertices.size());
+		for (const auto& vertex : vertices)
+			compactVertices.push_back(
+				compressVertex(vertex, boundsMin, boundsExtent)
+			);
+		rawVertices = toBytes(compactVertices);
+	} else {
+		rawVertices = toBytes(vertices);
+	}
+
+	// Indices are local to the mesh, so any mesh addressing less than 2^16
+	// vertices can use half sized indices.
+	vk::IndexType indexType =
+		vertices.size() <= std::numeric_limits<uint16_t>::max() + 1u
+			? vk::IndexType::eUint16
+			: vk::IndexType::eUint32;
+
+	std::vector<std::byte> rawIndices;
+	if (indexType == vk::IndexType::eUint16) {
+		rawIndices = toBytes(
+			std::vector<uint16_t>(lodIndices.begin(), lodIndices.end())
+		);
+	} else {
+		rawIndices = toBytes(lodIndices);
+	}
 
 	uint32_t vertexOffset;
 	uint32_t indexOffset;
 	m_primitiveManager.addPrimitive(
-		rawVertices, rawIndices, vertexOffset, indexOffset
+		rawVertices, rawIndices, indexType, vertexOffset, indexOffset
 	);
 
-	return Primitive {
-		.baseVertex = vertexOffset / (uint32_t)sizeof(Vertex),
-		.baseIndex = indexOffset / (uint32_t)sizeof(uint32_t),
-		.indexCount = (uint32_t)indices.size(),
+	Primitive primitive {
+		.mesh = mesh,
+		.baseVertex =
+			vertexOffset / getVertexStride(m_settings.vertexFormat),
+		.lodCount = (uint32_t)lods.size(),
+		.boundingSphere = boundingSphere,
+		.bounds = { .min = boundsMin, .max = boundsMax },
+		.indexType = indexType,
 	};
+
+	uint32_t baseIndex = indexOffset / getIndexSize(indexType);
+	for (uint32_t i = 0; i < lods.size(); i++) {
+		primitive.lods[i] = PrimitiveLod {
+			.baseIndex = baseIndex,
+			.indexCount = (uint32_t)lods[i].indices.size(),
+			.error = lods[i].error,
+		};
+
+		if (m_settings.buildMeshlets) {
+			std::vector<Meshlet> meshlets =
+				MeshletBuilder::Build(vertices, lods[i].indices);
+			for (auto& meshlet : meshlets) meshlet.firstIndex += baseIndex;
+
+			primitive.lods[i].meshletOffset =
+				m_primitiveManager.addMeshlets(meshlets);
+			primitive.lods[i].meshletCount = meshlets.size();
+		}
+		baseIndex += lods[i].indices.size();
+	}
+
+	if (m_settings.vertexFormat == VertexFormat::Compact) {
+		primitive.dequantization =
+			glm::scale(glm::translate(glm::mat4(1), boundsMin), boundsExtent);
+	}
+
+	return primitive;
+}
+
+bool SceneLoader::isBatched(const aiMesh& mesh) const {
+	return m_settings.staticBatching &&
+	       mesh.mNumVertices <= m_settings.batchMaxMeshVertices;
 }
 
-std::vector<Primitive> SceneLoader::loadNode(
-	aiNode& root, const aiScene& importedScene
+std::vector<SceneLoader::MeshInstance> SceneLoader::loadNodes(
+	aiNode& root, SceneGraph& sceneGraph
 ) {
-	std::vector<Primitive> nodePrimitives;
+	std::vector<MeshInstance> instances;
 
-	if (root.mNumMeshes > 0) {
-		glm::mat4 transform = getBaseTransform(root, importedScene);
+	// Breadth first, so nodes land in the graph after their parent
+	std::queue<std::pair<aiNode*, uint32_t>> nodes;
+	nodes.push({ &root, SceneGraph::NO_PARENT });
 
-		for (uint32_t i = 0; i < root.mNumMeshes; i++) {
-			aiMesh* mesh = importedScene.mMeshes[root.mMeshes[i]];
-			Primitive primitive = loadMesh(*mesh);
+	while (!nodes.empty()) {
+		auto [node, parent] = nodes.front();
+		nodes.pop();
 
-			primitive.material.instanceIndex = mesh->mMaterialIndex;
-			primitive.modelMatrix = transform;
-			nodePrimitives.push_back(primitive);
-		}
-	}
+		uint32_t transform =
+			sceneGraph.addNode(parent, toMat4(node->mTransformation));
 
-	for (int i = 0; i < root.mNumChildren; i++) {
-		auto primitives = loadNode(*root.mChildren[i], importedScene);
-		nodePrimitives.insert(
-			nodePrimitives.end(), primitives.begin(), primitives.end()
-		);
+		for (uint32_t i = 0; i < node->mNumMeshes; i++)
+			instances.push_back({ node->mMeshes[i], transform });
+
+		for (uint32_t i = 0; i < node->mNumChildren; i++)
+			nodes.push({ node->mChildren[i], transform });
 	}
-	return nodePrimitives;
+	return instances;
 }
 
-void SceneLoader::loadMaterials(
-	const aiScene& scene, std::filesystem::path& texturePath
+std::vector<MaterialDescription> SceneLoader::loadMaterials(
+	const aiScene& scene, const std::filesystem::path& texturePath
 ) {
-	std::set<uint32_t> materialCache;
-	// std::unordered_map<aiString, ImageHandle> textureCache;
-
+	std::vector<MaterialDescription> materials;
 	for (uint32_t i = 0; i < scene.mNumMaterials; i++) {
 		aiMaterial* materialInstance = scene.mMaterials[i];
 		aiString path;
@@ -160,23 +303,340 @@ void SceneLoader::loadMaterials(
 				texturePath / std::filesystem::path(path.C_Str());
 		}
 
-		auto defaultDescription = MaterialDescription::Default(defaultTextures);
-		m_materialManager.instantiateMaterial(defaultDescription);
+		auto description = MaterialDescription::Default(
+			defaultTextures,
+			m_settings.vertexFormat,
+			m_settings.bindlessMaterials || m_settings.visibilityBuffer
+		);
+		description.depthPrepass =
+			m_settings.depthPrepass && !m_settings.visibilityBuffer &&
+			!(m_settings.gpuDriven && m_settings.occlusionCulling);
+		description.visibility = m_settings.visibilityBuffer;
+		materials.push_back(description);
+	}
+	return materials;
+}
+
+// Decodes every texture file once, materials referencing the same file share
+// its image
+void SceneLoader::loadTextures(
+	const std::vector<MaterialDescription>& materials
+) {
+	std::map<std::filesystem::path, std::vector<TextureUser>> textures;
+	for (uint32_t i = 0; i < materials.size(); i++) {
+		uint32_t binding = 0;
+		for (const auto& resource : materials[i].instanceResources) {
+			if (resource.type != vk::DescriptorType::eCombinedImageSampler)
+				continue;
+			if (!resource.path.empty())
+				textures[resource.path].push_back({ i, binding });
+			binding++;
+		}
+	}
+
+	for (auto& [path, users] : textures) {
+		if (m_cancelled) return;
+		TextureBatch batch {
+			.image = ResourceManager::DecodeImage(path),
+			.users = std::move(users),
+		};
+		std::lock_guard lock(m_mutex);
+		m_textures.push(std::move(batch));
+	}
+}
+
+GeometryCapacity SceneLoader::getCapacity(
+	const aiScene& scene, const std::vector<MeshInstance>& instances
+) {
+	// Every level keeps at most 90% of the triangles of the previous one
+	uint32_t lodCount = std::clamp(m_settings.lodCount, 1u, MAX_LODS);
+	float lodScale = 0;
+	for (uint32_t i = 0; i < lodCount; i++) lodScale += std::pow(0.9f, i);
+
+	GeometryCapacity capacity;
+	auto addMesh = [&](const aiMesh& mesh) {
+		uint32_t triangleCount = (uint32_t)std::ceil(mesh.mNumFaces * lodScale);
+
+		capacity.vertexBytes +=
+			mesh.mNumVertices * getVertexStride(m_settings.vertexFormat);
+		capacity.positionBytes +=
+			mesh.mNumVertices * getPositionStride(m_settings.vertexFormat);
+		// 32 bit indices, plus the alignment of the range and of its chunk
+		capacity.indexBytes += (triangleCount * 3 + 2) * sizeof(uint32_t);
+
+		// Meshlets only close early once they hold MESHLET_MAX_VERTICES / 3
+		// triangles, the last one of each level can be smaller
+		if (m_settings.buildMeshlets) {
+			capacity.meshletCount +=
+				triangleCount / (MESHLET_MAX_VERTICES / 3) + lodCount;
+		}
+	};
+
+	std::set<uint32_t> loadedMeshes;
+	// Batches only merge meshes of the same material
+	std::map<uint32_t, uint32_t> batchedTriangles;
+	for (auto [meshIndex, node] : instances) {
+		const aiMesh& mesh = *scene.mMeshes[meshIndex];
+		capacity.primitiveCount++;
+		capacity.drawIndexCount += mesh.mNumFaces * 3;
+		if (isBatched(mesh))
+			batchedTriangles[mesh.mMaterialIndex] += mesh.mNumFaces;
+		else {
+			capacity.maxDrawTriangles =
+				std::max(capacity.maxDrawTriangles, mesh.mNumFaces);
+		}
+
+		// Batched meshes are stored once per instance, others once per mesh
+		if (isBatched(mesh) || loadedMeshes.insert(meshIndex).second)
+			addMesh(mesh);
+	}
+	for (auto [material, triangles] : batchedTriangles) {
+		capacity.maxDrawTriangles =
+			std::max(capacity.maxDrawTriangles, triangles);
+	}
+	return capacity;
+}
+
+void SceneLoader::loadGeometry(
+	const aiScene& scene,
+	const std::vector<MeshInstance>& instances,
+	const std::vector<glm::mat4>& worldTransforms,
+	uint32_t worldNode
+) {
+	// Instances of a mesh are published next to each other so they can be
+	// drawn with a single instanced call
+	std::map<uint32_t, std::vector<uint32_t>> meshNodes;
+	for (auto [meshIndex, node] : instances)
+		meshNodes[meshIndex].push_back(node);
+
+	StaticBatcher batcher(
+		m_settings.batchCellSize, m_settings.batchMaxVertices
+	);
+	uint32_t batchedInstances = 0;
+
+	std::vector<Primitive> primitives;
+	for (const auto& [meshIndex, nodes] : meshNodes) {
+		if (m_cancelled) return;
+
+		const aiMesh& mesh = *scene.mMeshes[meshIndex];
+		MeshData meshData = readMesh(mesh);
+
+		if (isBatched(mesh)) {
+			for (uint32_t node : nodes) {
+				batcher.add(
+					meshData, mesh.mMaterialIndex, worldTransforms[node]
+				);
+			}
+			batchedInstances += nodes.size();
+			continue;
+		}
+
+		Primitive primitive = loadMesh(meshData, meshIndex);
+		primitive.material.instanceIndex = mesh.mMaterialIndex;
+		for (uint32_t node : nodes) {
+			primitive.transform = node;
+			primitives.push_back(primitive);
+		}
+
+		if (m_primitiveManager.pendingSize() >= m_settings.streamBatchBytes)
+			publish(primitives);
+	}
+
+	const auto& batches = batcher.getBatches();
+	for (uint32_t i = 0; i < batches.size(); i++) {
+		if (m_cancelled) return;
+
+		MeshData meshData = batches[i].mesh;
+		Primitive primitive = loadMesh(meshData, scene.mNumMeshes + i);
+
+		primitive.material.instanceIndex = batches[i].material;
+		// Batched geometry is already in world space
+		primitive.transform = worldNode;
+		primitives.push_back(primitive);
+
+		if (m_primitiveManager.pendingSize() >= m_settings.streamBatchBytes)
+			publish(primitives);
 	}
+	if (!primitives.empty()) publish(primitives);
+
+	if (batchedInstances > 0) {
+		SDL_Log(
+			"Static batching: %u meshes merged in %zu batches",
+			batchedInstances,
+			batches.size()
+		);
+	}
+}
+
+void SceneLoader::publish(std::vector<Primitive>& primitives) {
+	PrimitiveBatch batch {
+		.geometry = m_primitiveManager.takeChunk(),
+		.primitives = std::move(primitives),
+		.occluders = std::move(m_occluders),
+	};
+	primitives.clear();
+	m_occluders.clear();
+
+	std::lock_guard lock(m_mutex);
+	m_batches.push(std::move(batch));
 }
 
-Scene SceneLoader::load(const std::filesystem::path& path) {
+void SceneLoader::run(const std::filesystem::path& path) {
 	Assimp::Importer importer;
-	auto import = importer.ReadFile(
+	const aiScene* importedScene = importer.ReadFile(
 		path.string().c_str(), aiProcessPreset_TargetRealtime_Quality
 	);
-	auto folderPath = path.parent_path();
-	loadMaterials(*import, folderPath);
-	Scene scene;
-	std::vector<Primitive> primitives = loadNode(*import->mRootNode, *import);
+	if (importedScene == nullptr) {
+		std::cerr << "Failed to load " << path << ": "
+				  << importer.GetErrorString() << std::endl;
+		std::lock_guard lock(m_mutex);
+		m_loadingDone = true;
+		return;
+	}
+
+	SceneLayout layout;
+	std::vector<MeshInstance> instances =
+		loadNodes(*importedScene->mRootNode, layout.sceneGraph);
+	uint32_t worldNode =
+		layout.sceneGraph.addNode(SceneGraph::NO_PARENT, glm::mat4(1));
+	layout.sceneGraph.update();
+
+	layout.materials = loadMaterials(*importedScene, path.parent_path());
+	layout.capacity = getCapacity(*importedScene, instances);
+	layout.capacity.transformCount = layout.sceneGraph.size();
+
+	std::vector<glm::mat4> worldTransforms =
+		layout.sceneGraph.getWorldTransforms();
+	std::vector<MaterialDescription> materials = layout.materials;
+	// Materials sample a placeholder until their textures are decoded and
+	// copied, so rendering starts before
+	{
+		std::lock_guard lock(m_mutex);
+		m_layout = std::move(layout);
+	}
 
-	scene.m_primitives = primitives;
-	m_primitiveManager.buildBuffers(m_resourceManager);
+	loadTextures(materials);
+	loadGeometry(*importedScene, instances, worldTransforms, worldNode);
 
-	return scene;
-}
\ No newline at end of file
+	if (m_settings.optimizeMeshes) {
+		SDL_Log(
+			"Mesh optimization: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+			m_cacheStatistics[0].acmr(),
+			m_cacheStatistics[1].acmr(),
+			m_cacheStatistics[0].atvr(),
+			m_cacheStatistics[1].atvr()
+		);
+	}
+
+	std::lock_guard lock(m_mutex);
+	m_loadingDone = true;
+}
+
+void SceneLoader::loadAsync(const std::filesystem::path& path) {
+	assert(!m_worker.joinable());
+	m_worker = std::thread(&SceneLoader::run, this, path);
+}
+
+void SceneLoader::update(Scene& scene) {
+	// The staging memory of the previous copies is reused once they are done
+	if (!m_resourceManager.transfersDone()) return;
+
+	if (!m_resourcesCreated) {
+		std::optional<SceneLayout> layout;
+		{
+			std::lock_guard lock(m_mutex);
+			std::swap(layout, m_layout);
+		}
+		if (!layout.has_value()) return;
+
+		for (auto& material : layout->materials) {
+			m_materialInstances.push_back(
+				m_materialManager.instantiateMaterial(material)
+			);
+		}
+		PrimitiveManager::CreateBuffers(m_resourceManager, layout->capacity);
+		m_resourceManager.reserveStaging(m_settings.uploadBudget);
+
+		scene.m_sceneGraph = std::move(layout->sceneGraph);
+		m_capacity = layout->capacity;
+		m_resourcesCreated = true;
+	}
+
+	// Primitives become visible and textures are sampled once their copies
+	// completed
+	scene.m_primitives.insert(
+		scene.m_primitives.end(),
+		m_uploadingPrimitives.begin(),
+		m_uploadingPrimitives.end()
+	);
+	m_uploadingPrimitives.clear();
+	for (const auto& [texture, users] : m_uploadingTextures) {
+		for (auto [material, binding] : users) {
+			m_materialManager.setTexture(
+				m_materialInstances[material], binding, texture
+			);
+		}
+	}
+	m_uploadingTextures.clear();
+
+	// Textures are decoded before the geometry, so they are copied first
+	size_t uploadedBytes = 0;
+	while (uploadedBytes < m_settings.uploadBudget) {
+		TextureBatch texture;
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_textures.empty()) break;
+			size_t stagedBytes = m_textures.front().image.data.size() +
+			                     ResourceManager::STAGING_ALIGNMENT;
+			if (uploadedBytes > 0 &&
+			    stagedBytes > m_resourceManager.getStagingSpace())
+				break;
+			texture = std::move(m_textures.front());
+			m_textures.pop();
+		}
+
+		m_uploadingTextures.push_back(
+			{ m_resourceManager.uploadImage(texture.image),
+		      std::move(texture.users) }
+		);
+		uploadedBytes += texture.image.data.size();
+	}
+
+	while (uploadedBytes < m_settings.uploadBudget) {
+		PrimitiveBatch batch;
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_batches.empty()) break;
+			// At least one batch is copied, growing the staging buffer if
+			// it has to. Each of its four streams may be padded.
+			size_t stagedBytes = m_batches.front().geometry.size() +
+			                     4 * ResourceManager::STAGING_ALIGNMENT;
+			if (uploadedBytes > 0 &&
+			    stagedBytes > m_resourceManager.getStagingSpace())
+				break;
+			batch = std::move(m_batches.front());
+			m_batches.pop();
+		}
+
+		// Occluders are only read on the CPU, they are ready already
+		for (auto& [mesh, occluder] : batch.occluders)
+			scene.m_occluders[mesh] = std::move(occluder);
+
+		PrimitiveManager::UploadChunk(m_resourceManager, batch.geometry);
+		uploadedBytes += batch.geometry.size();
+		m_uploadingPrimitives.insert(
+			m_uploadingPrimitives.end(),
+			batch.primitives.begin(),
+			batch.primitives.end()
+		);
+	}
+
+	m_resourceManager.submitTransfers();
+}
+
+bool SceneLoader::isFinished() {
+	std::lock_guard lock(m_mutex);
+	return m_loadingDone && !m_layout.has_value() && m_batches.empty() &&
+	       m_textures.empty() && m_uploadingPrimitives.empty() &&
+	       m_uploadingTextures.empty();
+}
@@ -3,33 +3,191 @@
 #include <assimp/mesh.h>
 #include <assimp/scene.h>
 
+#include <array>
+#include <atomic>
 #include <filesystem>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
 
+#include "MeshData.hpp"
+#include "MeshOptimizer.hpp"
 #include "Primitive.hpp"
 #include "PrimitiveManager.hpp"
 #include "Scene.hpp"
+#include "SceneGraph.hpp"
+#include "Vertex.hpp"
+#include "culling/OcclusionBuffer.hpp"
 #include "material/MaterialManager.hpp"
 #include "resources/ResourceManager.hpp"
 
+// Everything known once a scene file is parsed, before its meshes are
+// processed
+struct SceneLayout {
+	SceneGraph sceneGraph;
+	std::vector<MaterialDescription> materials;
+	GeometryCapacity capacity;
+};
+
+struct PrimitiveBatch {
+	GeometryChunk geometry;
+	std::vector<Primitive> primitives;
+	// Occluder meshes of the batch, keyed by Primitive::mesh
+	std::vector<std::pair<uint32_t, OccluderMesh>> occluders;
+};
+
+// Index in SceneLayout::materials and binding of a texture
+using TextureUser = std::pair<uint32_t, uint32_t>;
+
+struct TextureBatch {
+	ImageData image;
+	// Every material texture sampling the image
+	std::vector<TextureUser> users;
+};
+
+// Parses and processes a scene on a background thread. The render thread
+// polls `update` every frame, which creates the materials and buffers once
+// the file is parsed and then publishes primitives and textures as they
+// become resident.
 class SceneLoader {
+public:
+	struct LoadSettings {
+		VertexFormat vertexFormat = VertexFormat::Full;
+		// Welds vertices and reorders triangles and vertices for cache,
+		// overdraw and fetch efficiency
+		bool optimizeMeshes = true;
+		// Maximum number of detail levels generated per mesh, 1 disables
+		// simplification
+		uint32_t lodCount = MAX_LODS;
+		// Splits every level in meshlets so they can be culled on the GPU
+		bool buildMeshlets = true;
+		// Culls primitives and selects their level in a compute pass, drawing
+		// each material with a single indirect count call. Takes precedence
+		// over meshlet culling.
+		bool gpuDriven = false;
+		// Draws what was visible last frame, then tests the rest against a
+		// depth pyramid built from it. Only used with `gpuDriven`.
+		bool occlusionCulling = true;
+		// Keeps the coarsest level of meshes with at most
+		// `occluderMaxTriangles` triangles on the CPU, and culls primitives
+		// hidden behind the largest visible ones with a software rasterizer.
+		// Only used without `gpuDriven`.
+		bool softwareOcclusion = false;
+		uint32_t occluderMaxTriangles = 512;
+		// Occluder triangles rasterized per frame
+		uint32_t occluderBudget = 8192;
+		// Puts every texture in one descriptor array and the material
+		// parameters in a table, draws only push the index of their material
+		bool bindlessMaterials = false;
+		// Keeps the command buffers recorded by the opaque passes and replays
+		// them until the draws change
+		bool cacheDrawCommands = false;
+		// Lays down depth with a position only pass first, so the opaque pass
+		// shades each pixel once. Not used with two phase occlusion culling,
+		// whose late pass adds to the depth of the early one.
+		bool depthPrepass = false;
+		// Rasterizes only triangle and instance IDs, then shades every covered
+		// pixel once in a compute pass. Turns bindless materials on and draws
+		// whole primitives, without meshlets, depth prepass or two phase
+		// occlusion culling.
+		bool visibilityBuffer = false;
+		// Runs GPU culling and the depth pyramid build on a compute only queue
+		// when the device has one, next to the graphics work they do not feed
+		bool asyncCompute = false;
+		// Pre-transforms meshes with at most `batchMaxMeshVertices` vertices
+		// to world space and merges them per material and `batchCellSize` wide
+		// grid cell. Batched meshes no longer follow their scene graph node.
+		bool staticBatching = false;
+		uint32_t batchMaxMeshVertices = 512;
+		float batchCellSize = 16.f;
+		// Batches are split past this size so they keep 16 bit indices
+		uint32_t batchMaxVertices = 1 << 16;
+		// Processed geometry is handed to the render thread in batches of
+		// about this many bytes
+		uint32_t streamBatchBytes = 1 << 20;
+		// Geometry and texture bytes copied per frame while loading, at least
+		// one batch or texture is copied every frame
+		uint32_t uploadBudget = 8 << 20;
+	};
+
+private:
+	// aiMesh index and scene graph node of every mesh reference
+	using MeshInstance = std::pair<uint32_t, uint32_t>;
+
+	vk::Device m_device;
 	ResourceManager& m_resourceManager;
 	MaterialManager& m_materialManager;
+	// Copied, the loading thread reads it while the caller may change its own
+	const LoadSettings m_settings;
+
+	// Loading thread state
 	PrimitiveManager m_primitiveManager;
+	// Vertex cache efficiency of the loaded meshes before and after
+	// optimization
+	std::array<VertexCacheStatistics, 2> m_cacheStatistics;
+	std::vector<std::pair<uint32_t, OccluderMesh>> m_occluders;
+
+	// Shared state, guarded by m_mutex
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::optional<SceneLayout> m_layout;
+	std::queue<PrimitiveBatch> m_batches;
+	std::queue<TextureBatch> m_textures;
+	bool m_loadingDone = false;
+	std::atomic<bool> m_cancelled = false;
+
+	// Render thread state
+	bool m_resourcesCreated = false;
+	GeometryCapacity m_capacity;
+	std::vector<MaterialInstance> m_materialInstances;
+	// Published once ResourceManager::transfersDone
+	std::vector<Primitive> m_uploadingPrimitives;
+	std::vector<std::pair<ImageHandle, std::vector<TextureUser>>>
+		m_uploadingTextures;
 
-	Primitive loadMesh(aiMesh& mesh);
-	std::vector<Primitive> loadNode(aiNode& root, const aiScene& importedScene);
-	std::optional<ImageHandle> loadTexture(
-		aiMaterial* material,
-		aiTextureType type,
-		std::filesystem::path& folderPath
+	void run(const std::filesystem::path& path);
+	bool isBatched(const aiMesh& mesh) const;
+	std::vector<MeshInstance> loadNodes(
+		aiNode& root, SceneGraph& sceneGraph
 	);
-	void loadMaterials(
-		const aiScene& scene, std::filesystem::path& texturePath
+	std::vector<MaterialDescription> loadMaterials(
+		const aiScene& scene, const std::filesystem::path& texturePath
 	);
+	void loadTextures(const std::vector<MaterialDescription>& materials);
+	GeometryCapacity getCapacity(
+		const aiScene& scene, const std::vector<MeshInstance>& instances
+	);
+	void loadGeometry(
+		const aiScene& scene,
+		const std::vector<MeshInstance>& instances,
+		const std::vector<glm::mat4>& worldTransforms,
+		uint32_t worldNode
+	);
+	// Encodes, simplifies and stores a mesh, the data is optimized in place
+	Primitive loadMesh(MeshData& meshData, uint32_t mesh);
+	void publish(std::vector<Primitive>& primitives);
 
 public:
 	SceneLoader(
-		ResourceManager& resourceManager, MaterialManager& materialManager
+		vk::Device device,
+		ResourceManager& resourceManager,
+		MaterialManager& materialManager,
+		const LoadSettings& settings
 	);
-	Scene load(const std::filesystem::path& path);
+	~SceneLoader();
+
+	void loadAsync(const std::filesystem::path& path);
+	// Render thread side of the loading, copies at most
+	// LoadSettings::uploadBudget bytes of geometry per call
+	void update(Scene& scene);
+
+	// Materials and scene buffers exist, so the scene can be rendered
+	inline bool isReady() const { return m_resourcesCreated; }
+	inline const GeometryCapacity& getCapacity() const { return m_capacity; }
+	bool isFinished();
 };
@@ -0,0 +1,68 @@
+#include "StaticBatcher.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+#include "MeshData.hpp"
+#include "Vertex.hpp"
+
+StaticBatcher::StaticBatcher(float cellSize, uint32_t maxBatchVertices) :
+	m_cellSize(cellSize), m_maxBatchVertices(maxBatchVertices) {}
+
+void StaticBatcher::add(
+	const MeshData& mesh, uint32_t material, const glm::mat4& transform
+) {
+	if (mesh.vertices.empty()) return;
+
+	glm::mat3 normalTransform =
+		glm::transpose(glm::inverse(glm::mat3(transform)));
+	// Mirroring transforms flip the winding of the transformed triangles
+	bool flipWinding = glm::determinant(glm::mat3(transform)) < 0;
+
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (const auto& vertex : mesh.vertices) {
+		glm::vec3 position = transform * glm::vec4(vertex.position, 1);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+
+		vertices.push_back(Vertex {
+			.position = position,
+			.normal = glm::normalize(normalTransform * vertex.normal),
+			.texcoord = vertex.texcoord,
+		});
+	}
+
+	glm::ivec3 cell(glm::floor((boundsMin + boundsMax) * 0.5f / m_cellSize));
+	CellKey key { material, cell.x, cell.y, cell.z };
+
+	auto openBatch = m_openBatches.find(key);
+	if (openBatch == m_openBatches.end() ||
+	    m_batches[openBatch->second].mesh.vertices.size() + vertices.size() >
+	        m_maxBatchVertices) {
+		m_batches.push_back({ .material = material, .mesh = {} });
+		openBatch =
+			m_openBatches.insert_or_assign(key, m_batches.size() - 1).first;
+	}
+
+	MeshData& batch = m_batches[openBatch->second].mesh;
+	uint32_t baseVertex = batch.vertices.size();
+	batch.vertices.insert(
+		batch.vertices.end(), vertices.begin(), vertices.end()
+	);
+	for (uint32_t i = 0; i < mesh.indices.size(); i += 3) {
+		batch.indices.push_back(baseVertex + mesh.indices[i]);
+		if (flipWinding) {
+			batch.indices.push_back(baseVertex + mesh.indices[i + 2]);
+			batch.indices.push_back(baseVertex + mesh.indices[i + 1]);
+		} else {
+			batch.indices.push_back(baseVertex + mesh.indices[i + 1]);
+			batch.indices.push_back(baseVertex + mesh.indices[i + 2]);
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "MeshData.hpp"
+
+struct StaticBatch {
+	uint32_t material;
+	// World space geometry of every mesh merged in the batch
+	MeshData mesh;
+};
+
+// Merges small static meshes into world space batches sharing a material.
+// Meshes are bucketed by the grid cell containing their center, so batches
+// stay spatially compact and can still be culled by their bounds.
+class StaticBatcher {
+private:
+	using CellKey = std::tuple<uint32_t, int32_t, int32_t, int32_t>;
+
+	float m_cellSize;
+	uint32_t m_maxBatchVertices;
+
+	std::vector<StaticBatch> m_batches;
+	// Batch currently filled for each material and cell
+	std::map<CellKey, uint32_t> m_openBatches;
+
+public:
+	StaticBatcher(float cellSize, uint32_t maxBatchVertices);
+
+	void add(
+		const MeshData& mesh, uint32_t material, const glm::mat4& transform
+	);
+	inline const std::vector<StaticBatch>& getBatches() const {
+		return m_batches;
+	}
+};
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/glm.hpp>
+#include <glm/trigonometric.hpp>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "Primitive.hpp"
+#include "Test.hpp"
+#include "culling/Frustum.hpp"
+#include "scene/BVH.hpp"
+
+// Boxes of up to four units in a 200 unit cube, the same for every run
+static std::vector<AABB> getRandomBounds(uint32_t count) {
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> position(-100.f, 100.f);
+	std::uniform_real_distribution<float> size(0.f, 2.f);
+
+	std::vector<AABB> bounds(count);
+	for (AABB& box : bounds) {
+		glm::vec3 center(position(random), position(random), position(random));
+		glm::vec3 extent(size(random), size(random), size(random));
+		box = { .min = center - extent, .max = center + extent };
+	}
+	return bounds;
+}
+
+static std::array<glm::vec4, 6> getPlanes(glm::vec3 position) {
+	glm::mat4 projection =
+		glm::perspectiveRH_ZO(glm::radians(60.f), 16.f / 9.f, 0.1f, 80.f);
+	glm::mat4 view = glm::lookAt(position, glm::vec3(0), glm::vec3(0, 1, 0));
+	return getFrustumPlanes(projection * view);
+}
+
+static std::vector<uint32_t> sorted(std::vector<uint32_t> indices) {
+	std::sort(indices.begin(), indices.end());
+	return indices;
+}
+
+// Boxes not entirely behind one of the planes, like BVH::queryFrustum
+static std::vector<uint32_t> queryFrustumLinear(
+	const std::vector<AABB>& bounds, const std::array<glm::vec4, 6>& planes
+) {
+	std::vector<uint32_t> result;
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		bool outside = std::any_of(
+			planes.begin(),
+			planes.end(),
+			[&](const glm::vec4& plane) {
+				glm::vec3 normal(plane);
+				glm::vec3 positive = glm::mix(
+					bounds[i].min,
+					bounds[i].max,
+					glm::greaterThanEqual(normal, glm::vec3(0))
+				);
+				return glm::dot(normal, positive) + plane.w < 0;
+			}
+		);
+		if (!outside) result.push_back(i);
+	}
+	return result;
+}
+
+static std::vector<uint32_t> querySphereLinear(
+	const std::vector<AABB>& bounds, glm::vec3 center, float radius
+) {
+	std::vector<uint32_t> result;
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		glm::vec3 offset =
+			glm::clamp(center, bounds[i].min, bounds[i].max) - center;
+		if (glm::dot(offset, offset) <= radius * radius) result.push_back(i);
+	}
+	return result;
+}
+
+// Entry distance of the ray, infinity when it misses the box. Computed like
+// BVH::raycast, so distances can be compared exactly.
+static float intersectLinear(
+	const AABB& bounds, glm::vec3 origin, glm::vec3 direction
+) {
+	glm::vec3 inverseDirection = 1.f / direction;
+	glm::vec3 near = (bounds.min - origin) * inverseDirection;
+	glm::vec3 far = (bounds.max - origin) * inverseDirection;
+	glm::vec3 entry = glm::min(near, far);
+	glm::vec3 exit = glm::max(near, far);
+	float entryDistance = glm::max(glm::max(entry.x, entry.y), entry.z);
+	float exitDistance = glm::min(glm::min(exit.x, exit.y), exit.z);
+	if (exitDistance < glm::max(entryDistance, 0.f))
+		return std::numeric_limits<float>::infinity();
+	return glm::max(entryDistance, 0.f);
+}
+
+TEST_CASE(emptyHierarchyFindsNothing) {
+	BVH bvh;
+	bvh.build({});
+
+	std::vector<uint32_t> result;
+	bvh.queryFrustum(getPlanes(glm::vec3(0, 0, 50)), result);
+	bvh.querySphere(glm::vec3(0), 10.f, result);
+	CHECK(result.empty());
+	CHECK(!bvh.raycast(glm::vec3(0), glm::vec3(0, 0, -1)).has_value());
+}
+
+TEST_CASE(buildReferencesEveryPrimitiveOnce) {
+	std::vector<AABB> bounds = getRandomBounds(5000);
+	BVH bvh;
+	bvh.build(bounds);
+	CHECK(bvh.size() == bounds.size());
+	CHECK(bvh.nodeCount() < bounds.size() * 2);
+
+	std::vector<uint32_t> result;
+	bvh.querySphere(glm::vec3(0), 1000.f, result);
+	result = sorted(result);
+	CHECK(result.size() == bounds.size());
+	CHECK(std::adjacent_find(result.begin(), result.end()) == result.end());
+}
+
+TEST_CASE(queriesMatchLinearScans) {
+	std::vector<AABB> bounds = getRandomBounds(5000);
+	BVH bvh;
+	bvh.build(bounds);
+
+	for (glm::vec3 position :
+	     { glm::vec3(0, 0, 120), glm::vec3(30, 40, 10), glm::vec3(0) }) {
+		auto planes = getPlanes(position + glm::vec3(0.1f));
+		std::vector<uint32_t> result;
+		bvh.queryFrustum(planes, result);
+		CHECK(sorted(result) == queryFrustumLinear(bounds, planes));
+
+		result.clear();
+		bvh.querySphere(position, 25.f, result);
+		CHECK(sorted(result) == querySphereLinear(bounds, position, 25.f));
+	}
+}
+
+TEST_CASE(raycastFindsTheClosestBox) {
+	std::vector<AABB> bounds = getRandomBounds(5000);
+	// On the path of the first ray
+	bounds[0] = { .min = glm::vec3(0, 0, 1), .max = glm::vec3(2, 4, 7) };
+	BVH bvh;
+	bvh.build(bounds);
+
+	glm::vec3 origin(-150.f, 1.f, 2.f);
+	for (glm::vec3 direction :
+	     { glm::vec3(1, 0.01f, 0.02f), glm::vec3(1, 0.3f, -0.2f) }) {
+		direction = glm::normalize(direction);
+		float closest = std::numeric_limits<float>::infinity();
+		for (const AABB& box : bounds)
+			closest =
+				std::min(closest, intersectLinear(box, origin, direction));
+
+		auto hit = bvh.raycast(origin, direction);
+		CHECK(hit.has_value() == !std::isinf(closest));
+		if (!hit.has_value()) continue;
+		CHECK(hit->distance == closest);
+		CHECK(intersectLinear(bounds[hit->primitive], origin, direction) ==
+		      closest);
+	}
+}
+
+TEST_CASE(refitFollowsMovedPrimitives) {
+	std::vector<AABB> bounds = getRandomBounds(5000);
+	BVH bvh;
+	bvh.build(bounds);
+
+	// Moves every box, so stale node bounds would miss most of them
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		glm::vec3 offset(i % 7 * 10.f, i % 5 * -10.f, 30.f);
+		bounds[i].min += offset;
+		bounds[i].max += offset;
+	}
+	bvh.refit(bounds);
+
+	glm::vec3 position(20, -10, 40);
+	auto planes = getPlanes(position);
+	std::vector<uint32_t> result;
+	bvh.queryFrustum(planes, result);
+	CHECK(sorted(result) == queryFrustumLinear(bounds, planes));
+
+	result.clear();
+	bvh.querySphere(position, 40.f, result);
+	CHECK(sorted(result) == querySphereLinear(bounds, position, 40.f));
+}
@@ -0,0 +1,177 @@
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/glm.hpp>
+#include <glm/trigonometric.hpp>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "Primitive.hpp"
+#include "ThreadPool.hpp"
+#include "culling/Frustum.hpp"
+#include "culling/OcclusionBuffer.hpp"
+#include "culling/PrimitiveCuller.hpp"
+#include "scene/BVH.hpp"
+
+// Average milliseconds of `iterations` runs, after a warm up run
+static double measure(uint32_t iterations, const std::function<void()>& run) {
+	run();
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < iterations; i++) run();
+	std::chrono::duration<double, std::milli> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+static void report(std::string_view name, double milliseconds) {
+	std::cout << name << ": " << milliseconds << " ms" << std::endl;
+}
+
+static glm::mat4 getProjection() {
+	glm::mat4 projection =
+		glm::perspectiveRH_ZO(glm::radians(60.f), 2.f, 0.1f, 1000.f);
+	projection[1][1] *= -1;
+	return projection;
+}
+
+static glm::mat4 getView() {
+	return glm::lookAt(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+}
+
+static glm::mat4 getViewProjection() { return getProjection() * getView(); }
+
+// Boxes of one to four units scattered in front of the camera, the same
+// for every run
+static std::vector<AABB> getSceneBounds(uint32_t count) {
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> side(-200.f, 200.f);
+	std::uniform_real_distribution<float> depth(-400.f, -5.f);
+	std::uniform_real_distribution<float> size(0.5f, 2.f);
+
+	std::vector<AABB> bounds(count);
+	for (AABB& box : bounds) {
+		glm::vec3 center(side(random), side(random) * 0.5f, depth(random));
+		glm::vec3 extent(size(random), size(random), size(random));
+		box = { .min = center - extent, .max = center + extent };
+	}
+	return bounds;
+}
+
+// Closed box made of twelve triangles
+static OccluderMesh getBoxOccluder(const AABB& box) {
+	OccluderMesh mesh;
+	for (uint32_t i = 0; i < 8; i++) {
+		mesh.positions.push_back({
+			i & 1 ? box.max.x : box.min.x,
+			i & 2 ? box.max.y : box.min.y,
+			i & 4 ? box.max.z : box.min.z,
+		});
+	}
+	mesh.indices = {
+		0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+		2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3,
+	};
+	return mesh;
+}
+
+static void benchmarkOcclusionBuffer() {
+	constexpr uint32_t OCCLUDER_COUNT = 512;
+	constexpr uint32_t TESTED_COUNT = 100000;
+
+	glm::mat4 viewProjection = getViewProjection();
+	std::vector<AABB> occluderBounds = getSceneBounds(OCCLUDER_COUNT);
+	std::vector<OccluderMesh> occluders;
+	for (const AABB& box : occluderBounds)
+		occluders.push_back(getBoxOccluder(box));
+	std::vector<AABB> tested = getSceneBounds(TESTED_COUNT);
+
+	for (uint32_t workerCount :
+	     { 0u, 3u, ThreadPool::GetDefaultWorkerCount() }) {
+		ThreadPool threadPool(workerCount);
+		OcclusionBuffer buffer(threadPool);
+		double rasterize = measure(20, [&] {
+			buffer.clear();
+			for (const OccluderMesh& occluder : occluders)
+				buffer.addOccluder(occluder, viewProjection);
+			buffer.rasterize();
+		});
+
+		uint32_t visible = 0;
+		double test = measure(20, [&] {
+			visible = 0;
+			for (const AABB& box : tested)
+				visible += buffer.isVisible(box, viewProjection);
+		});
+
+		std::cout << "OcclusionBuffer, " << threadPool.size() << " threads, "
+		          << buffer.getTriangleCount() << " triangles, " << visible
+		          << " of " << TESTED_COUNT << " boxes visible" << std::endl;
+		report("  add and rasterize occluders", rasterize);
+		report("  test boxes", test);
+	}
+}
+
+// Frustum queries of the BVH against the SIMD linear culler and a plain
+// loop over the same bounds
+static void benchmarkBVH() {
+	glm::mat4 projection = getProjection();
+	glm::mat4 view = getView();
+	std::array<glm::vec4, 6> planes = getFrustumPlanes(projection * view);
+
+	for (uint32_t count : { 10000u, 100000u, 1000000u }) {
+		std::vector<AABB> bounds = getSceneBounds(count);
+
+		BVH bvh;
+		double build = measure(5, [&] { bvh.build(bounds); });
+		double refit = measure(5, [&] { bvh.refit(bounds); });
+		std::vector<uint32_t> result;
+		double query = measure(20, [&] {
+			result.clear();
+			bvh.queryFrustum(planes, result);
+		});
+		uint32_t visible = result.size();
+
+		PrimitiveCuller culler(0.f);
+		culler.setBounds(bounds);
+		double simd = measure(20, [&] {
+			result.clear();
+			culler.cull(view, projection, 600.f, result);
+		});
+
+		double linear = measure(20, [&] {
+			result.clear();
+			for (uint32_t i = 0; i < bounds.size(); i++) {
+				bool outside = false;
+				for (const glm::vec4& plane : planes) {
+					glm::vec3 normal(plane);
+					glm::vec3 positive = glm::mix(
+						bounds[i].min,
+						bounds[i].max,
+						glm::greaterThanEqual(normal, glm::vec3(0))
+					);
+					outside |= glm::dot(normal, positive) + plane.w < 0;
+				}
+				if (!outside) result.push_back(i);
+			}
+		});
+
+		std::cout << "BVH, " << count << " boxes, " << bvh.nodeCount()
+		          << " nodes, " << visible << " visible" << std::endl;
+		report("  build", build);
+		report("  refit", refit);
+		report("  frustum query", query);
+		report("  PrimitiveCuller::cull", simd);
+		report("  linear frustum test", linear);
+	}
+}
+
+int main() {
+	benchmarkOcclusionBuffer();
+	benchmarkBVH();
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/glm.hpp>
+#include <glm/trigonometric.hpp>
+
+#include "Primitive.hpp"
+#include "Test.hpp"
+#include "ThreadPool.hpp"
+#include "culling/OcclusionBuffer.hpp"
+
+// Camera at the origin looking down -z, projected like the renderer does
+static glm::mat4 getViewProjection() {
+	glm::mat4 projection =
+		glm::perspectiveRH_ZO(glm::radians(60.f), 2.f, 0.1f, 100.f);
+	projection[1][1] *= -1;
+	glm::mat4 view =
+		glm::lookAt(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+	return projection * view;
+}
+
+// Ten units wide square facing the camera at z = -10
+static OccluderMesh getWall() {
+	return {
+		.positions = {
+			{ -5, -5, -10 },
+			{ 5, -5, -10 },
+			{ 5, 5, -10 },
+			{ -5, 5, -10 },
+		},
+		.indices = { 0, 1, 2, 0, 2, 3 },
+	};
+}
+
+static AABB getBox(glm::vec3 min, glm::vec3 max) {
+	return { .min = min, .max = max };
+}
+
+TEST_CASE(emptyBufferHidesNothing) {
+	ThreadPool threadPool(0);
+	OcclusionBuffer buffer(threadPool);
+	buffer.rasterize();
+
+	glm::mat4 viewProjection = getViewProjection();
+	CHECK(buffer.isVisible(
+		getBox({ -1, -1, -51 }, { 1, 1, -49 }), viewProjection
+	));
+}
+
+TEST_CASE(wallHidesBoxesBehindIt) {
+	ThreadPool threadPool(0);
+	OcclusionBuffer buffer(threadPool);
+	glm::mat4 viewProjection = getViewProjection();
+	buffer.addOccluder(getWall(), viewProjection);
+	buffer.rasterize();
+
+	// Behind the wall and within its outline
+	CHECK(!buffer.isVisible(
+		getBox({ -1, -1, -21 }, { 1, 1, -19 }), viewProjection
+	));
+	// In front of the wall
+	CHECK(buffer.isVisible(
+		getBox({ -1, -1, -6 }, { 1, 1, -4 }), viewProjection
+	));
+	// Behind the wall but reaching past its left edge
+	CHECK(buffer.isVisible(
+		getBox({ -15, -1, -21 }, { -3, 1, -19 }), viewProjection
+	));
+	// Crossing the near plane
+	CHECK(buffer.isVisible(
+		getBox({ -1, -1, -1 }, { 1, 1, 1 }), viewProjection
+	));
+}
+
+TEST_CASE(occludersDoNotHideThemselves) {
+	ThreadPool threadPool(0);
+	OcclusionBuffer buffer(threadPool);
+	glm::mat4 viewProjection = getViewProjection();
+	buffer.addOccluder(getWall(), viewProjection);
+	buffer.rasterize();
+
+	// Bounds of the wall itself, and a box cutting through it
+	CHECK(buffer.isVisible(
+		getBox({ -5, -5, -10 }, { 5, 5, -10 }), viewProjection
+	));
+	CHECK(buffer.isVisible(
+		getBox({ -1, -1, -11 }, { 1, 1, -9 }), viewProjection
+	));
+}
+
+TEST_CASE(rasterizedDepthIsNeverNearerThanTheOccluder) {
+	ThreadPool threadPool(0);
+	OcclusionBuffer buffer(threadPool);
+	glm::mat4 viewProjection = getViewProjection();
+	// Tilted, so depth varies across the triangles
+	OccluderMesh wall = getWall();
+	wall.positions[1].z = wall.positions[2].z = -20;
+	buffer.addOccluder(wall, viewProjection);
+	buffer.rasterize();
+
+	glm::vec4 nearest = viewProjection * glm::vec4(-5, 0, -10, 1);
+	float nearestDepth = nearest.z / nearest.w;
+	bool covered = false;
+	for (float depth : buffer.getDepth()) {
+		if (depth == 1.f) continue;
+		covered = true;
+		CHECK(depth >= nearestDepth - 1e-6f);
+	}
+	CHECK(covered);
+}
+
+TEST_CASE(resultDoesNotDependOnThreadCount) {
+	glm::mat4 viewProjection = getViewProjection();
+	OccluderMesh wall = getWall();
+	auto rasterize = [&](uint32_t workerCount) {
+		ThreadPool threadPool(workerCount);
+		OcclusionBuffer buffer(threadPool);
+		for (int i = 0; i < 4; i++) {
+			glm::mat4 model = glm::translate(
+				glm::mat4(1), glm::vec3(i * 3 - 4.5f, i - 1.5f, -i * 2.f)
+			);
+			buffer.addOccluder(wall, viewProjection * model);
+		}
+		buffer.rasterize();
+		return buffer.getDepth();
+	};
+
+	CHECK(rasterize(0) == rasterize(3));
+}
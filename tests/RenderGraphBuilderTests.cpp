@@ -0,0 +1,167 @@
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Test.hpp"
+#include "rendergraph/RenderGraphBuilder.hpp"
+#include "rendergraph/tasks/Task.hpp"
+
+// Declares its accesses and records nothing
+class FakeTask : public Task {
+private:
+	std::vector<BufferDependencyInfo> m_buffers;
+	std::vector<ImageDependencyInfo> m_images;
+
+public:
+	FakeTask(
+		std::vector<BufferDependencyInfo> buffers,
+		std::vector<ImageDependencyInfo> images = {}
+	) :
+		m_buffers(std::move(buffers)), m_images(std::move(images)) {}
+
+	void setup(
+		std::vector<ImageDependencyInfo>& requiredImages,
+		std::vector<BufferDependencyInfo>& requiredBuffers
+	) override {
+		requiredImages = m_images;
+		requiredBuffers = m_buffers;
+	}
+	void execute(vk::CommandBuffer&, const Resources&) override {}
+};
+
+static BufferDependencyInfo read(std::string_view name) {
+	return {
+		.name = name,
+		.usage = {
+			.type = ResourceUsage::Type::READ,
+			.access = vk::AccessFlagBits2::eShaderStorageRead,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	};
+}
+
+// Overwrites the whole buffer without reading it
+static BufferDependencyInfo write(std::string_view name) {
+	return {
+		.name = name,
+		.usage = {
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eShaderStorageWrite,
+			.stage = vk::PipelineStageFlagBits2::eComputeShader,
+		},
+	};
+}
+
+static ImageDependencyInfo writeOutput() {
+	return {
+		.name = OUTPUT_IMAGE,
+		.usage = {
+			.type = ResourceUsage::Type::WRITE,
+			.access = vk::AccessFlagBits2::eTransferWrite,
+			.stage = vk::PipelineStageFlagBits2::eTransfer,
+		},
+		.requiredLayout = vk::ImageLayout::eTransferDstOptimal,
+	};
+}
+
+using Order = std::vector<std::string_view>;
+
+TEST_CASE(ordersProducersBeforeConsumers) {
+	FakeTask producer({ write("a") });
+	FakeTask middle({ read("a"), write("b") });
+	FakeTask output({ read("b") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("producer", producer);
+	builder.addTask("middle", middle);
+	builder.addTask("output", output);
+
+	CHECK((builder.compile() == Order { "producer", "middle", "output" }));
+}
+
+TEST_CASE(keepsRegistrationOrderOfIndependentTasks) {
+	FakeTask first({ write("a") });
+	FakeTask second({ write("b") });
+	FakeTask output({ read("b"), read("a") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("first", first);
+	builder.addTask("second", second);
+	builder.addTask("output", output);
+
+	CHECK((builder.compile() == Order { "first", "second", "output" }));
+}
+
+TEST_CASE(cullsTasksNotFeedingTheOutput) {
+	FakeTask used({ write("a") });
+	FakeTask unused({ write("b") });
+	// Only feeds a culled task, so it is culled too
+	FakeTask feedsUnused({ write("c") });
+	FakeTask readsUnused({ read("c"), write("d") });
+	FakeTask output({ read("a") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("used", used);
+	builder.addTask("unused", unused);
+	builder.addTask("feeds_unused", feedsUnused);
+	builder.addTask("reads_unused", readsUnused);
+	builder.addTask("output", output);
+
+	CHECK((builder.compile() == Order { "used", "output" }));
+}
+
+TEST_CASE(overwritesCullThePreviousWriter) {
+	FakeTask overwritten({ write("a") });
+	FakeTask writer({ write("a") });
+	FakeTask output({ read("a") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("overwritten", overwritten);
+	builder.addTask("writer", writer);
+	builder.addTask("output", output);
+
+	CHECK((builder.compile() == Order { "writer", "output" }));
+}
+
+TEST_CASE(readsBeforeTheFirstWriteSeeThePreviousFrame) {
+	// Written after the output reads it, for the next frame
+	FakeTask history({ write("a") });
+	FakeTask output({ read("a") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("output", output);
+	builder.addTask("history", history);
+
+	CHECK((builder.compile() == Order { "output", "history" }));
+}
+
+TEST_CASE(acceptsReadModifyWrite) {
+	FakeTask producer({ write("a") });
+	// Declares the same buffer as read and written
+	FakeTask accumulate({ read("a"), write("a") });
+	FakeTask output({ read("a") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("producer", producer);
+	builder.addTask("accumulate", accumulate);
+	builder.addTask("output", output);
+
+	CHECK((builder.compile() == Order { "producer", "accumulate", "output" }));
+}
+
+TEST_CASE(skipsDisabledTasks) {
+	FakeTask first({ write("a") });
+	FakeTask second({ read("a"), write("b") });
+	FakeTask output({ read("a"), read("b") }, { writeOutput() });
+
+	RenderGraphBuilder builder;
+	builder.addTask("first", first);
+	builder.addTask("second", second);
+	builder.addTask("output", output);
+	builder.setEnabled("second", false);
+
+	CHECK((builder.compile() == Order { "first", "output" }));
+	builder.setEnabled("second", true);
+	CHECK((builder.compile() == Order { "first", "second", "output" }));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+// Test cases register themselves and are all run by main
+struct TestCase {
+	std::string_view name;
+	std::function<void()> body;
+};
+
+std::vector<TestCase>& getTestCases();
+void reportFailure(std::string_view expression, const char* file, int line);
+
+struct TestRegistration {
+	TestRegistration(std::string_view name, std::function<void()> body) {
+		getTestCases().push_back({ name, std::move(body) });
+	}
+};
+
+#define TEST_CASE(name)                                       \
+	static void name();                                       \
+	static TestRegistration name##Registration(#name, name); \
+	static void name()
+
+// Failed checks are reported without stopping the test case
+#define CHECK(expression)                                      \
+	do {                                                       \
+		if (!(expression))                                     \
+			reportFailure(#expression, __FILE__, __LINE__);    \
+	} while (0)
@@ -0,0 +1,33 @@
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "Test.hpp"
+
+static uint32_t failures = 0;
+
+std::vector<TestCase>& getTestCases() {
+	static std::vector<TestCase> testCases;
+	return testCases;
+}
+
+void reportFailure(std::string_view expression, const char* file, int line) {
+	std::cerr << file << ":" << line << ": " << expression << std::endl;
+	failures++;
+}
+
+int main() {
+	for (auto& testCase : getTestCases()) {
+		uint32_t previousFailures = failures;
+		try {
+			testCase.body();
+		} catch (const std::exception& exception) {
+			reportFailure(exception.what(), __FILE__, __LINE__);
+		}
+		std::cout << (failures == previousFailures ? "passed " : "FAILED ")
+		          << testCase.name << std::endl;
+	}
+	return failures == 0 ? 0 : 1;
+}